@@ -0,0 +1,55 @@
+#ifndef ANALYZER_HPP
+#define ANALYZER_HPP
+#include "audio_sys.hpp"
+#include "define.hpp"
+
+#include <array>
+#include <complex>
+
+enum ANALYZER_CONSTANTS : size_t {
+  FFT_SIZE = 2048,
+  FFT_LOG2 = 11,
+  SCOPE_SPAN = 1024,
+  // Most recent samples kept, enough to find a trigger before the span
+  ANALYZER_HISTORY = 4096,
+  SPECTRUM_BANDS = 96,
+};
+
+// UI thread only. Drains the audio tap, and when asked for a frame, runs a
+// Hann windowed FFT folded into log spaced bands with peak hold, plus a
+// rising zero crossing triggered scope window
+class Analyzer {
+public:
+  Analyzer(void);
+
+  void pull(Audio_Tap &tap);
+  void update(i32 sample_rate);
+
+  const std::array<f32, SCOPE_SPAN> &get_scope(void) const { return scope; }
+  const std::array<f32, SPECTRUM_BANDS> &get_bands(void) const {
+    return bands;
+  }
+  const std::array<f32, SPECTRUM_BANDS> &get_peaks(void) const {
+    return peaks;
+  }
+  f32 get_floor_db(void) const;
+
+private:
+  void fft(void);
+  void update_scope(void);
+  void update_spectrum(i32 sample_rate);
+
+  std::array<f32, ANALYZER_HISTORY> history;
+  size_t write_pos;
+
+  std::array<f32, FFT_SIZE> window;
+  std::array<u16, FFT_SIZE> bit_reverse;
+  std::array<std::complex<f32>, FFT_SIZE / 2> twiddles;
+  std::array<std::complex<f32>, FFT_SIZE> bins;
+  f32 window_gain;
+
+  std::array<f32, SCOPE_SPAN> scope;
+  std::array<f32, SPECTRUM_BANDS> bands, peaks;
+};
+
+#endif
@@ -1,32 +1,138 @@
-#ifndef AUDIO_SYS_HPP
-#define AUDIO_SYS_HPP
-#include "define.hpp"
-#include <SDL3/SDL.h>
-
-void stream_get(void *data, SDL_AudioStream *stream, i32 add, i32 total);
-
-class Audio_Sys {
-public:
-  Audio_Sys(i32 chan, i32 sample_rate);
-  ~Audio_Sys(void) = default;
-  bool open(void *userdata);
-  void close(void);
-  bool set_audio_callback(void *userdata);
-  bool bind_stream(void);
-  bool unbind_stream(void);
-  bool open_audio_device(void);
-  bool create_audio_stream(void);
-  bool close_audio_device(void);
-  bool destroy_audio_stream(void);
-  bool resume(void);
-  bool pause(void);
-  void clear(void);
-
-private:
-  u32 dev;
-  SDL_AudioStream *stream;
-  SDL_AudioSpec internal;
-  SDL_AudioSpec output;
-};
-
-#endif
+#ifndef AUDIO_SYS_HPP
+#define AUDIO_SYS_HPP
+#include "define.hpp"
+#include "lockfree.hpp"
+#include <SDL3/SDL.h>
+
+#include <array>
+#include <atomic>
+
+class Ensemble;
+class Recorder;
+class Render_Ahead;
+class Synth;
+
+enum AUDIO_CONSTANTS : size_t {
+  SIMD_ALIGN = 64,
+  RENDER_FRAMES_MAX = 4096,
+  // Mono samples, about 170ms at 48k
+  TAP_RING_SIZE = 8192,
+};
+
+typedef Spsc_Ring<f32, TAP_RING_SIZE> Audio_Tap;
+
+void stream_get(void *data, SDL_AudioStream *stream, i32 add, i32 total);
+// Renders interleaved frames straight into out, no device required
+bool render_block(Synth *syn, f32 *out, size_t frames);
+
+// TPDF dither, four xorshift lanes so the SIMD path can run them side by side
+class Dither {
+public:
+  Dither(u32 seed);
+  void set_active(bool val) { active = val; }
+  bool get_active_state(void) const { return active; }
+  u32 *lanes(void) { return state.data(); }
+  f32 uniform(void);
+  f32 tpdf(void);
+
+private:
+  std::array<u32, 4> state;
+  bool active;
+};
+
+void expand_channels(const f32 *in, f32 *out, size_t frames, size_t in_chan,
+                     size_t out_chan);
+void convert_f32_to_s16(const f32 *in, i16 *out, size_t count, Dither &dither);
+void convert_f32_to_s32(const f32 *in, i32 *out, size_t count);
+
+class Audio_Sys {
+public:
+  Audio_Sys(i32 chan, i32 sample_rate, i32 _device_frames);
+  ~Audio_Sys(void);
+  bool open(Synth *_syn);
+  void close(void);
+  bool set_audio_callback(void);
+  bool bind_stream(void);
+  bool unbind_stream(void);
+  void request_device_frames(void);
+  bool open_audio_device(void);
+  bool create_audio_stream(void);
+  bool close_audio_device(void);
+  bool destroy_audio_stream(void);
+  bool allocate_render_buffer(void);
+  void free_render_buffer(void);
+  bool allocate_output_buffers(void);
+  void free_output_buffers(void);
+  void adopt_device_format(void);
+  void start_render_ahead(void);
+  bool reconfigure(void);
+  const void *output_stage(const f32 *samples, size_t frames);
+  const void *silent_stage(const f32 *zeros, size_t frames);
+  bool resume(void);
+  bool pause(void);
+  void clear(void);
+
+  Synth *get_synth(void) { return syn; }
+  // Before open(), the callback renders every part instead of just the synth
+  void set_ensemble(Ensemble *_ensemble) { ensemble = _ensemble; }
+  Ensemble *get_ensemble(void) { return ensemble; }
+  // Gets every rendered block, it decides whether a take is running
+  void set_recorder(Recorder *_recorder) { recorder = _recorder; }
+  Recorder *get_recorder(void) { return recorder; }
+  // Before open(), the callback copies from a producer thread instead of
+  // rendering. Restarted in the new format on reconfigure()
+  void set_render_ahead(Render_Ahead *_ahead) { ahead = _ahead; }
+  Render_Ahead *get_render_ahead(void) { return ahead; }
+  // One block of every part, or just the synth
+  bool render(f32 *out, size_t frames);
+  f32 *get_render_buffer(void) { return render_buffer; }
+  size_t get_render_capacity(void) const { return render_capacity; }
+  i32 get_channels(void) const { return internal.channels; }
+  size_t get_frame_size(void) const {
+    return SDL_AUDIO_BYTESIZE(internal.format) *
+           static_cast<size_t>(internal.channels);
+  }
+  void set_dither(bool val) { dither.set_active(val); }
+  i32 get_device_frames(void) const { return device_frames; }
+  u32 get_device(void) const { return dev; }
+  f32 get_latency_ms(void) const;
+
+  // The audio thread copies every rendered block here while enabled, the UI
+  // side drains it. A full ring drops the block rather than wait
+  void tap_block(const f32 *samples, size_t frames);
+  void set_tap_enabled(bool val) { tap_enabled.store(val); }
+  Audio_Tap &get_tap(void) { return tap; }
+  u64 get_tap_dropped(void) const { return tap_dropped.load(); }
+
+  // Latency probe. Once armed, the first rendered sample at or above the
+  // threshold stamps when it was due and disarms. callback_ns is the
+  // callback's start, offset how many frames it had already rendered
+  void arm_onset(f32 threshold);
+  bool get_onset(u64 &ns) const;
+  void detect_onset(const f32 *samples, size_t frames, size_t offset,
+                    u64 callback_ns);
+
+private:
+  u32 dev;
+  SDL_AudioStream *stream;
+  SDL_AudioSpec internal;
+  SDL_AudioSpec output;
+  i32 requested_frames, device_frames;
+  Synth *syn;
+  Ensemble *ensemble;
+  Recorder *recorder;
+  Render_Ahead *ahead;
+  f32 *render_buffer;
+  size_t render_capacity;
+  f32 *expand_buffer;
+  void *convert_buffer;
+  Dither dither;
+  Audio_Tap tap;
+  std::atomic<bool> tap_enabled;
+  std::atomic<u64> tap_dropped;
+  std::atomic<bool> onset_armed;
+  std::atomic<u64> onset_ns;
+  f32 onset_threshold;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+#include "define.hpp"
+#include "preset.hpp"
+
+#include <string>
+#include <vector>
+
+enum BATCH_CONSTANTS : u32 {
+  BATCH_SEED = 0xBA7C,
+  BATCH_BLOCK = 256,
+  BATCH_BITS_DEFAULT = 24,
+};
+
+// Every key x velocity x round robin is one note, held for hold_s then let
+// go. The tail runs until the synth goes silent or tail_s is up, then
+// anything under trim_db at the end is cut. Round robins differ by seed, so
+// each one starts its oscs on different phases
+struct Batch_Grid {
+  std::vector<u32> keys;
+  std::vector<u32> velocities;
+  u32 round_robins = 1;
+  f32 hold_s = 1.0f;
+  f32 tail_s = 4.0f;
+  f32 trim_db = -90.0f;
+  u32 bits = BATCH_BITS_DEFAULT;
+};
+
+// "36-96" or "36-96:12" or "40,80,127" into values, false on junk
+bool parse_batch_list(const char *arg, std::vector<u32> &out);
+
+// Headless. Every note is its own job with its own synth, jobs are spread
+// over threads (every core when 0) and nothing is shared but the job
+// counter. Writes one wav per note and manifest.csv into dir
+bool batch_render(const Preset &preset, const Batch_Grid &grid,
+                  const std::string &dir, size_t threads);
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+#include "define.hpp"
+#include "lockfree.hpp"
+#include "preset.hpp"
+#include "synth.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+
+enum CAPTURE_CONSTANTS : u32 {
+  CAPTURE_MAGIC = 0x43534753, // "SGSC"
+  CAPTURE_VERSION = 1,
+  CAPTURE_RING_SIZE = 4096,
+  // Patches are rare and big, they ride in their own ring
+  CAPTURE_PATCH_RING_SIZE = 8,
+};
+
+enum CAPTURE_FLAGS : u32 {
+  // Notes started on fixed phases, a note cache was attached
+  CAPTURE_FIXED_PHASE = 1 << 0,
+};
+
+enum CAPTURE_RECORD : u8 {
+  CAP_BLOCK,   // value = frames, stamp = ns since the capture opened
+  CAP_COMMAND, // kind/data = the command, value = status, stamp = frame
+  CAP_FORMAT,  // value = sample rate, kind = channels
+  CAP_PATCH,   // stamp = block the fade started on, a Preset follows
+  CAP_END,     // stamp = records dropped, non zero means it won't replay
+};
+
+struct Capture_Header {
+  u32 magic;
+  u32 version;
+  u32 seed;
+  i32 sample_rate;
+  i32 channels;
+  f32 silence_db;
+  u32 flags;
+  u32 reserved;
+};
+
+struct Capture_Record {
+  u8 type;
+  u8 kind;
+  u8 data1, data2;
+  u32 value;
+  u64 stamp;
+};
+static_assert(sizeof(Capture_Record) == 16, "Capture_Record layout changed");
+
+// Logs everything that reaches the audio thread, in the order it got there:
+// each callback's size, every command drained at its top, format changes and
+// patches at the block their fade began. The audio thread only pushes into
+// rings, a writer thread owns the file. Once a ring fills the rest of the
+// session is dropped, a log with a hole in it wouldn't replay the same anyway
+class Session_Capture {
+public:
+  Session_Capture(void);
+  ~Session_Capture(void);
+  Session_Capture(const Session_Capture &) = delete;
+  Session_Capture &operator=(const Session_Capture &) = delete;
+
+  // Before the audio device opens, with the synth's state at that point
+  bool open(const std::string &path, u32 seed, i32 sample_rate, i32 channels,
+            f32 silence_db, u32 flags);
+  // After the audio device closes
+  void close(void);
+  bool is_open(void) const { return running.load(); }
+  u64 get_dropped(void) const { return dropped.load(); }
+
+  // audio thread
+  void block(size_t frames, i32 sample_rate, i32 channels);
+  void command(const Keyboard_Command &command);
+  void patch_pending(void);
+  void patch(const Preset &preset);
+
+private:
+  void push(const Capture_Record &record);
+  void write_loop(void);
+  void flush(void);
+
+  Spsc_Ring<Capture_Record, CAPTURE_RING_SIZE> records;
+  Spsc_Ring<Preset, CAPTURE_PATCH_RING_SIZE> patches;
+  std::ofstream file;
+  std::atomic<u64> dropped;
+  std::atomic<bool> running;
+  std::thread writer;
+
+  // audio thread only
+  u64 blocks, position, fade_block, start_ns;
+  i32 last_rate, last_channels;
+};
+
+// Feeds a capture back through a fresh synth offline, block for block, and
+// prints how long each took. out_path, if set, gets the raw interleaved f32
+bool replay_session(const std::string &path, const char *out_path);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef ENSEMBLE_HPP
+#define ENSEMBLE_HPP
+#include "define.hpp"
+#include "synth.hpp"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+enum ENSEMBLE_CONSTANTS : size_t {
+  ENSEMBLE_PARTS_MAX = 16,
+};
+
+// Multi-timbral parts, part p plays MIDI channel p + 1. Part 0 is the synth
+// the UI edits, the rest are owned here and each keeps its own voices, patch
+// and delay.
+//
+// Every callback is a fork and join: the audio thread bumps the epoch, the
+// worker lanes render their parts into their own buffers while the audio
+// thread renders lane 0's, then it waits for the lanes and sums. After a job
+// a lane spins for a slice of the period, so back to back blocks skip the
+// scheduler, then parks on the epoch until the next one. The audio thread
+// only spins briefly on the join before sleeping on it, at FIFO a spinning
+// thread starves a lane that shares its core.
+class Ensemble {
+public:
+  Ensemble(Synth &_main);
+  ~Ensemble(void);
+  Ensemble(const Ensemble &) = delete;
+  Ensemble &operator=(const Ensemble &) = delete;
+
+  // Before the audio device opens. One part leaves everything to the main
+  // synth and starts no threads
+  bool start(size_t count, u32 seed, f32 silence_db);
+  // After the audio device closes
+  void stop(void);
+  size_t get_part_count(void) const { return parts.size(); }
+  size_t get_lane_count(void) const { return assignment.size(); }
+  Synth &get_part(size_t pos) { return *parts[pos]; }
+
+  // Main thread, like Synth::read_event but every part gets its own channel.
+  // Part 0's commands come back so the UI can add to them before queueing,
+  // the rest are queued here. False if a part's queue was full
+  bool read_event(Midi_Input &input, std::vector<Keyboard_Command> &first);
+  // Caller holds the audio thread off, every part follows the main synth
+  void match_format(void);
+
+  // audio thread, false when every part was silent and out was just zeroed
+  bool render(f32 *out, size_t frames);
+
+private:
+  void rollback(void);
+  void render_lane(size_t lane);
+  // seen is the epoch at start, a block can land before the lane runs
+  void lane_loop(size_t lane, u32 seen);
+  void join_lanes(void);
+
+  Synth &main_part;
+  std::vector<Synth *> parts;
+  std::vector<std::unique_ptr<Synth>> owned;
+  // Parts per lane. Lane 0 is the audio thread, only the rest have a thread
+  std::vector<std::vector<size_t>> assignment;
+  std::vector<std::thread> lanes;
+  std::vector<std::vector<f32>> buffers;
+  std::array<bool, ENSEMBLE_PARTS_MAX> sounding;
+  std::array<std::vector<Keyboard_Command>, ENSEMBLE_PARTS_MAX> routed;
+
+  std::atomic<bool> running;
+  std::atomic<u32> epoch;
+  std::atomic<u32> pending;
+  // Lanes parked on the epoch, render() only wakes when there are any
+  std::atomic<u32> parked;
+  // The audio thread is asleep on pending, the last lane wakes it
+  std::atomic<bool> joining;
+  // How long a lane spins after a job, a slice of the last period
+  std::atomic<u64> spin_ns;
+  // Set before the epoch moves, read by every lane
+  f32 *job_out;
+  size_t job_frames;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef GOLDEN_HPP
+#define GOLDEN_HPP
+#include "define.hpp"
+#include "preset.hpp"
+#include "synth.hpp"
+
+#include <string>
+#include <vector>
+
+enum GOLDEN_CONSTANTS : u32 {
+  GOLDEN_MAGIC = 0x47534753, // "SGSG"
+  GOLDEN_VERSION = 1,
+  GOLDEN_SEED = 0x5EED,
+  // Render chunk when no event splits it, same as a small device buffer
+  GOLDEN_BLOCK = 256,
+  GOLDEN_FFT = 2048,
+};
+
+struct Golden_Header {
+  u32 magic;
+  u32 version;
+  u32 channels;
+  u32 sample_rate;
+  u64 frames;
+};
+
+struct Golden_Event {
+  f32 seconds;
+  Keyboard_Command command;
+};
+
+// max_abs is per sample, max_db is the mean band difference of the worst
+// spectrum window, only counting bands where either render is audible
+struct Golden_Scenario {
+  const char *name;
+  f32 seconds;
+  f32 max_abs;
+  f32 max_db;
+  std::vector<Golden_Event> events;
+  // Empty plays the default patch
+  std::vector<Preset_Osc> oscs;
+};
+
+struct Golden_Result {
+  f32 max_abs;
+  size_t max_abs_frame;
+  size_t first_diverged; // SIZE_MAX when nothing went past max_abs
+  f32 max_db;
+  size_t max_db_frame;
+};
+
+// Renders a fixed set of scenarios through the engine without an audio
+// device, seeded so every run is identical. record writes one reference per
+// scenario into dir, check renders again and compares against them
+const std::vector<Golden_Scenario> &get_golden_scenarios(void);
+bool render_scenario(const Golden_Scenario &scenario, std::vector<f32> &out,
+                     u32 &channels, u32 &sample_rate);
+bool golden_record(const std::string &dir);
+bool golden_check(const std::string &dir);
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef GRAPH_HPP
+#define GRAPH_HPP
+#include "define.hpp"
+
+#include <array>
+#include <memory>
+#include <vector>
+
+class Synth;
+class Voice;
+struct Preset;
+
+enum PORT_TYPE : u8 {
+  PORT_MONO,    // one sample per frame
+  PORT_AUDIO,   // interleaved, one sample per channel per frame
+  PORT_CONTROL, // one modulation value per frame
+};
+
+enum GRAPH_CONSTANTS : size_t {
+  PORT_MAX = 4,
+  GRAPH_BUFFER_STRIDE = BLOCK_FRAMES * CHANNEL_MAX,
+  // Pseudo node for connect() that stands for the buffer passed to run()
+  GRAPH_INPUT = SIZE_MAX,
+};
+
+// Patch flags, a set bit drops the stage so older presets keep every stage
+enum CHAIN_FLAGS : u32 {
+  CHAIN_NO_SATURATE = 1 << 0,
+  CHAIN_NO_TREMOLO = 1 << 1, // drops the amp stage, so gain and pan routes too
+  CHAIN_NO_DELAY = 1 << 2,
+};
+
+struct Node_Ctx {
+  Synth *syn;
+  Voice *voice; // null on the master bus
+  size_t voice_iter;
+  size_t frames;
+  size_t channels;
+};
+
+class Node {
+public:
+  // name is a literal, it labels the node's spans in a trace
+  Node(const char *_name, std::vector<u8> _inputs, std::vector<u8> _outputs)
+      : name(_name), inputs(_inputs), outputs(_outputs) {}
+  virtual ~Node(void) = default;
+  virtual void process(const Node_Ctx &ctx, const f32 *const *in,
+                       f32 *const *out) = 0;
+
+  size_t get_input_count(void) const { return inputs.size(); }
+  size_t get_output_count(void) const { return outputs.size(); }
+  u8 get_input_type(size_t port) const { return inputs[port]; }
+  u8 get_output_type(size_t port) const { return outputs[port]; }
+  const char *get_name(void) const { return name; }
+
+private:
+  const char *name;
+  std::vector<u8> inputs, outputs;
+};
+
+struct Graph_Edge {
+  size_t from, from_port;
+  size_t to, to_port;
+};
+
+struct Graph_Step {
+  Node *node;
+  std::array<u16, PORT_MAX> in, out;
+};
+
+// Nodes are wired up front, compile() flattens them into a topologically
+// sorted list of calls and hands out buffers by liveness so a block only
+// touches as many buffers as are alive at once. run() just walks the list.
+class Graph {
+public:
+  Graph(void);
+  Graph(const Graph &) = delete;
+  Graph &operator=(const Graph &) = delete;
+
+  void clear(void);
+  size_t add_node(std::unique_ptr<Node> node);
+  bool connect(size_t from, size_t from_port, size_t to, size_t to_port);
+  bool set_output(size_t node, size_t port);
+  bool compile(void);
+  void run(const Node_Ctx &ctx, const f32 *input, f32 *output);
+
+  bool is_compiled(void) const { return compiled; }
+  size_t get_buffer_count(void) const { return buffer_count; }
+  size_t get_step_count(void) const { return schedule.size(); }
+
+private:
+  enum : u16 { BUFFER_IN, BUFFER_OUT, BUFFER_ZERO, BUFFER_POOL };
+
+  std::vector<std::unique_ptr<Node>> nodes;
+  std::vector<Graph_Edge> edges;
+  std::vector<Graph_Step> schedule;
+  std::vector<f32> pool;
+  std::vector<f32 *> buffers;
+  size_t output_node, output_port;
+  size_t buffer_count;
+  bool compiled;
+};
+
+// Per voice: osc -> saturate -> low pass -> envelope -> amp, with the mod
+// matrix feeding pitch, cutoff and the amp's gain and pan. The osc count and
+// waveforms come from the preset and are fixed in the chain
+bool build_voice_graph(Graph &graph, const Preset &preset, i32 channels);
+// Master bus: delay
+bool build_master_graph(Graph &graph, i32 channels, u32 flags);
+
+#endif
@@ -1,181 +1,298 @@
-#ifndef WINDOW_HPP
-#define WINDOW_HPP
-#include "define.hpp"
-#include <SDL3/SDL_render.h>
-#include <SDL3/SDL_video.h>
-#include <SDL3_ttf/SDL_ttf.h>
-
-#include <array>
-#include <string>
-#include <vector>
-
-class Synth;
-class Window;
-class Renderer;
-
-struct Mouse_Event {
-  i32 x = 0, y = 0;
-};
-
-struct Key_Event {
-  SDL_Keycode keycode = 0;
-  SDL_Keycode keymod = 0;
-};
-
-struct Event_Command {
-  enum Type {
-    mouse_down,
-    mouse_up,
-    mouse_motion,
-    keydown,
-    quit,
-  } type;
-
-  Mouse_Event mouse;
-  Key_Event key;
-};
-
-struct Modify_Request {
-  const SYNTH_PARAMETER index;
-  enum Method : size_t { REQ_DEC, REQ_INC } method;
-
-  Modify_Request(SYNTH_PARAMETER _index, Method _method)
-      : index(_index), method(_method) {}
-};
-
-struct Rect {
-  i32 x = 0, y = 0, w = 32, h = 16;
-  bool point_in_rect(i32 _x, i32 _y) const;
-};
-
-struct Generic_Param {
-  std::string param_name;
-  const f32 *max = NULL;
-  const f32 *min = NULL;
-  const f32 *value = NULL;
-};
-
-struct Generic_Item {
-  Generic_Param data;
-  Rect rect;
-};
-
-enum Glyph_Extra_Params : size_t {
-  COLOUR_BASE,
-  COLOUR_COUNT,
-};
-
-enum Generic_Render_Data : size_t {
-  ENVELOPE_DATA,
-  SHAPING_DATA,
-  GENERIC_DATA_SIZE
-};
-
-enum Glyph_Table_Dims : u8 {
-  ASCII_START = 32,
-  ASCII_SIZE = 128,
-};
-
-struct Glyph_Entry {
-  Glyph_Entry(void);
-  SDL_Texture *texture;
-  i32 width, height;
-  u8 c;
-};
-
-class Glyphs {
-public:
-  Glyphs(std::string _file_path, f32 font_size);
-  ~Glyphs(void);
-
-  bool open(void);
-  void close(void);
-  void find_line_skip(void);
-  bool table_allocate(Renderer &renderer);
-  void table_deallocate(void);
-  i32 get_line_skip(void) const { return line_skip; }
-  i32 get_string_width(const std::string &str) const;
-  const Glyph_Entry *get_glyph_at(u8 c, size_t colour_index) const;
-
-private:
-  SDL_Surface *create_glyph_surface(const char *str, const SDL_Color &col);
-  std::array<SDL_Color, COLOUR_COUNT> colours;
-  std::array<std::array<Glyph_Entry, ASCII_SIZE>, COLOUR_COUNT> glyph_table;
-  std::string file_path;
-  f32 font_size;
-  TTF_Font *font;
-  i32 line_skip;
-};
-
-class Renderer {
-public:
-  Renderer(const i32 &_window_width, const i32 &_window_height);
-  ~Renderer(void);
-
-  void destroy_renderer(void);
-  bool create_renderer(SDL_Window *w);
-  SDL_Texture *create_texture(SDL_Surface *surf);
-  void clear(void);
-  void clear_colour(u8 r, u8 g, u8 b, u8 a);
-  void present(void);
-
-  void render_param_list(const std::array<ParamF32, S_PARAM_COUNT> &items,
-                         const Glyphs &g) const;
-  void render_rect_i(i32 x, i32 y, i32 w, i32 h) const;
-  i32 render_string(const Glyphs &g, const std::string &str, const i32 &y,
-                    const i32 &start_x) const;
-  void render_char(const Glyph_Entry *glyph, const i32 &y, const i32 &x) const;
-  void set_viewport(const SDL_Rect &viewport);
-  SDL_Renderer *get_renderer(void) { return r; }
-
-private:
-  SDL_Renderer *r;
-  const i32 &window_width;
-  const i32 &window_height;
-};
-
-class Events {
-public:
-  Events(void) = default;
-  std::vector<Event_Command> read_event(void);
-  void run_events(std::vector<Event_Command> &commands, Window &_win);
-  std::vector<Modify_Request> &get_requests(void) { return requests; }
-  void clear_requests(void) { requests.clear(); }
-  void emit_inc_param(void);
-  void emit_dec_param(void);
-  void up(void);
-  void down(void);
-
-private:
-  SYNTH_PARAMETER cursor;
-  std::vector<Modify_Request> requests;
-};
-
-class Window {
-public:
-  Window(size_t _window_flags, i32 _width, i32 _height);
-  ~Window(void);
-  void destroy_window(void);
-  bool create_window(void);
-  void update_size(void);
-  SDL_Window *get_window(void) { return w; }
-  Renderer &get_render_class(void) { return rend; }
-  Events &get_event_class(void) { return events; }
-
-  void _run_events(std::vector<Event_Command> &commands);
-  void hide_window(void);
-  void show_window(void);
-
-  bool get_quit(void) { return quit; }
-  void set_quit(bool val) { quit = val; }
-
-private:
-  size_t flags;
-  SDL_Window *w;
-  i32 width, height;
-  Renderer rend;
-  Events events;
-  bool quit = false;
-};
-
-#endif
+#ifndef WINDOW_HPP
+#define WINDOW_HPP
+#include "analyzer.hpp"
+#include "define.hpp"
+#include "telemetry.hpp"
+#include <SDL3/SDL_render.h>
+#include <SDL3/SDL_video.h>
+#include <SDL3_ttf/SDL_ttf.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+class Synth;
+class Window;
+class Renderer;
+
+struct Mouse_Event {
+  i32 x = 0, y = 0;
+};
+
+struct Key_Event {
+  SDL_Keycode keycode = 0;
+  SDL_Keycode keymod = 0;
+};
+
+struct Event_Command {
+  enum Type {
+    mouse_down,
+    mouse_up,
+    mouse_motion,
+    keydown,
+    audio_format_changed,
+    window_exposed,
+    quit,
+  } type;
+
+  Mouse_Event mouse;
+  Key_Event key;
+  // audio_format_changed only, which device it was
+  u32 device = 0;
+};
+
+// What needs redrawing, the loop sleeps until one of these is set
+enum UI_DIRTY : u32 {
+  DIRTY_NONE = 0,
+  DIRTY_WINDOW = 1 << 0,
+  DIRTY_PARAMS = 1 << 1,
+  DIRTY_CURSOR = 1 << 2,
+  DIRTY_METERS = 1 << 3,
+};
+
+// What fills the window above the voice meter
+enum UI_VIEW : u8 {
+  VIEW_PARAMS,
+  VIEW_ANALYZER,
+  VIEW_VOICES,
+};
+
+struct Modify_Request {
+  const SYNTH_PARAMETER index;
+  enum Method : size_t { REQ_DEC, REQ_INC } method;
+
+  Modify_Request(SYNTH_PARAMETER _index, Method _method)
+      : index(_index), method(_method) {}
+};
+
+struct Rect {
+  i32 x = 0, y = 0, w = 32, h = 16;
+  bool point_in_rect(i32 _x, i32 _y) const;
+};
+
+struct Generic_Param {
+  std::string param_name;
+  const f32 *max = NULL;
+  const f32 *min = NULL;
+  const f32 *value = NULL;
+};
+
+struct Generic_Item {
+  Generic_Param data;
+  Rect rect;
+};
+
+enum Glyph_Extra_Params : size_t {
+  COLOUR_BASE,
+  COLOUR_LIGHT,
+  COLOUR_COUNT,
+};
+
+enum Generic_Render_Data : size_t {
+  ENVELOPE_DATA,
+  SHAPING_DATA,
+  GENERIC_DATA_SIZE
+};
+
+enum Glyph_Table_Dims : u8 {
+  ASCII_START = 32,
+  ASCII_SIZE = 128,
+};
+
+enum Glyph_Atlas_Dims : i32 {
+  ATLAS_WIDTH = 512,
+  ATLAS_PADDING = 1,
+};
+
+enum Glyph_Cache_Params : u32 {
+  GLYPH_CACHE_MAGIC = 0x43475347, // "SGGC"
+  // Bump when the file layout or the way the atlas is packed changes
+  GLYPH_CACHE_VERSION = 1,
+};
+
+// src is the glyph's spot in the atlas, in pixels
+struct Glyph_Entry {
+  Glyph_Entry(void);
+  SDL_FRect src;
+  i32 width, height;
+  u8 c;
+};
+
+// A string's quads, only rebuilt when the text or colour changes and only
+// shifted when it moves
+struct Text_Layout {
+  std::string text;
+  i32 x = 0, y = 0, width = 0;
+  size_t colour = COLOUR_BASE;
+  bool valid = false;
+  std::vector<SDL_Vertex> vertices;
+  std::vector<int> indices;
+};
+
+class Glyphs {
+public:
+  Glyphs(std::string _file_path, f32 font_size);
+  ~Glyphs(void);
+
+  // The atlas from the cache file when it matches this font, otherwise
+  // rasterized and cached for next time
+  bool load(Renderer &renderer);
+  bool open(void);
+  void close(void);
+  void find_line_skip(void);
+  bool table_allocate(Renderer &renderer);
+  void table_deallocate(void);
+  i32 get_line_skip(void) const { return line_skip; }
+  i32 get_string_width(const std::string &str) const;
+  const Glyph_Entry *get_glyph_at(u8 c) const;
+  SDL_Texture *get_atlas(void) const { return atlas; }
+  const SDL_Color &get_colour(size_t colour_index) const;
+  bool layout_string(Text_Layout &layout, const std::string &str, i32 x, i32 y,
+                     size_t colour_index) const;
+
+private:
+  SDL_Surface *create_glyph_surface(const char *str, const SDL_Color &col);
+  u64 find_cache_key(void) const;
+  bool load_cache(Renderer &renderer);
+  void store_cache(const SDL_Surface *sheet) const;
+  // Glyphs are rendered white once, colours are applied per vertex when drawn
+  std::array<SDL_Color, COLOUR_COUNT> colours;
+  std::array<Glyph_Entry, ASCII_SIZE> glyph_table;
+  SDL_Texture *atlas;
+  i32 atlas_width, atlas_height;
+  std::string file_path;
+  f32 font_size;
+  TTF_Font *font;
+  i32 line_skip;
+  // Empty when there's nowhere to keep it
+  std::string cache_path;
+  u64 cache_key;
+};
+
+class Renderer {
+public:
+  Renderer(const i32 &_window_width, const i32 &_window_height);
+  ~Renderer(void);
+
+  void destroy_renderer(void);
+  bool create_renderer(SDL_Window *w);
+  SDL_Texture *create_texture(SDL_Surface *surf);
+  void clear(void);
+  void clear_colour(u8 r, u8 g, u8 b, u8 a);
+  void present(void);
+
+  void render_param_list(const std::array<ParamF32, S_PARAM_COUNT> &items,
+                         const Glyphs &g, size_t cursor);
+  bool param_list_changed(
+      const std::array<ParamF32, S_PARAM_COUNT> &items) const;
+  void render_voice_meter(size_t active, size_t total);
+  void render_scope(const Analyzer &an, const SDL_FRect &area);
+  void render_spectrum(const Analyzer &an, const SDL_FRect &area);
+  void render_voice_grid(const Voice_Monitor &mon, const Glyphs &g,
+                         const SDL_FRect &area);
+  size_t get_meter_value(void) const { return meter_value; }
+  bool set_vsync(bool on);
+  void render_rect_i(i32 x, i32 y, i32 w, i32 h) const;
+  i32 render_string(const Glyphs &g, const std::string &str, const i32 &y,
+                    const i32 &start_x);
+  void render_layout(const Glyphs &g, const Text_Layout &layout) const;
+  void set_viewport(const SDL_Rect &viewport);
+  SDL_Renderer *get_renderer(void) { return r; }
+
+private:
+  SDL_Renderer *r;
+  const i32 &window_width;
+  const i32 &window_height;
+  Text_Layout scratch;
+  std::array<Text_Layout, S_PARAM_COUNT> param_layouts;
+  std::array<SDL_FRect, S_PARAM_COUNT> param_rects;
+  std::array<f32, S_PARAM_COUNT> drawn_values;
+  size_t meter_value;
+  std::array<SDL_FPoint, SCOPE_SPAN> scope_points;
+  std::array<SDL_FRect, SPECTRUM_BANDS> band_rects, peak_rects;
+  std::array<Text_Layout, VOICES> voice_layouts;
+  std::array<SDL_FRect, VOICES> level_rects, cost_rects;
+};
+
+class Events {
+public:
+  Events(void) = default;
+  std::vector<Event_Command> read_event(i32 timeout_ms);
+  void run_events(std::vector<Event_Command> &commands, Window &_win);
+  std::vector<Modify_Request> &get_requests(void) { return requests; }
+  void clear_requests(void) { requests.clear(); }
+  void emit_inc_param(void);
+  void emit_dec_param(void);
+  void up(void);
+  void down(void);
+  SYNTH_PARAMETER get_cursor(void) const { return cursor; }
+
+private:
+  void push_event(const SDL_Event &event,
+                  std::vector<Event_Command> &commands) const;
+  SYNTH_PARAMETER cursor = S_ATTACK;
+  std::vector<Modify_Request> requests;
+};
+
+class Window {
+public:
+  Window(size_t _window_flags, i32 _width, i32 _height);
+  ~Window(void);
+  void destroy_window(void);
+  bool create_window(void);
+  void update_size(void);
+  SDL_Window *get_window(void) { return w; }
+  i32 get_width(void) const { return width; }
+  i32 get_height(void) const { return height; }
+  Renderer &get_render_class(void) { return rend; }
+  Events &get_event_class(void) { return events; }
+
+  void _run_events(std::vector<Event_Command> &commands);
+  void hide_window(void);
+  void show_window(void);
+
+  bool get_quit(void) { return quit; }
+  void set_quit(bool val) { quit = val; }
+  // The device whose format changed, 0 when none did
+  u32 get_audio_changed(void) { return audio_changed; }
+  void set_audio_changed(u32 val) { audio_changed = val; }
+  bool get_save_patch(void) { return save_patch; }
+  void set_save_patch(bool val) { save_patch = val; }
+  bool get_arp_mode_next(void) { return arp_mode_next; }
+  void set_arp_mode_next(bool val) { arp_mode_next = val; }
+  bool get_arp_rate_next(void) { return arp_rate_next; }
+  void set_arp_rate_next(bool val) { arp_rate_next = val; }
+  u8 get_view(void) const { return view; }
+  void toggle_view(u8 val) {
+    view = view == val ? static_cast<u8>(VIEW_PARAMS) : val;
+  }
+  bool get_dump_voices(void) { return dump_voices; }
+  void set_dump_voices(bool val) { dump_voices = val; }
+  bool get_export_trace(void) { return export_trace; }
+  void set_export_trace(bool val) { export_trace = val; }
+  bool get_toggle_record(void) { return toggle_record; }
+  void set_toggle_record(bool val) { toggle_record = val; }
+  u32 get_dirty(void) const { return dirty; }
+  void mark_dirty(u32 val) { dirty |= val; }
+  void clear_dirty(void) { dirty = DIRTY_NONE; }
+
+private:
+  size_t flags;
+  SDL_Window *w;
+  i32 width, height;
+  Renderer rend;
+  Events events;
+  bool quit = false;
+  u32 audio_changed = 0;
+  bool save_patch = false;
+  bool arp_mode_next = false;
+  bool arp_rate_next = false;
+  bool dump_voices = false;
+  bool export_trace = false;
+  bool toggle_record = false;
+  u8 view = VIEW_PARAMS;
+  // Everything needs drawing once the window first shows
+  u32 dirty = DIRTY_WINDOW;
+};
+
+#endif
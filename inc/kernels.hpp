@@ -0,0 +1,72 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+#include "define.hpp"
+#include "synth.hpp"
+
+// Every waveform gets its own instantiation so the per sample loop never
+// branches on it. They live in a header so the osc node can inline them, the
+// count and channel specializations live with the graph nodes.
+
+template <size_t WF>
+inline f32 wave(const Generator &gen, f32 inc, const f32 *phase, f32 duty) {
+  if constexpr (WF == SAW) {
+    return gen.poly_saw(inc, phase);
+  } else if constexpr (WF == SQUARE || WF == PULSE) {
+    return gen.poly_square(inc, phase, duty);
+  } else if constexpr (WF == SINE) {
+    return gen.sine(phase);
+  } else {
+    return gen.triangle(phase);
+  }
+}
+
+template <size_t WF>
+inline void render_osc(const Generator &gen, Oscillator &osc, size_t voice_iter,
+                       const f32 *freq, f32 duty, f32 *sum, size_t frames,
+                       f32 inv_rate) {
+  f32 *phase = osc.get_phase_at(voice_iter);
+  if (!phase) {
+    return;
+  }
+
+  const f32 detune = osc.get_detune();
+  f32 p = *phase;
+  for (size_t n = 0; n < frames; n++) {
+    const f32 inc = freq[n] * detune * inv_rate;
+    p += inc;
+    if (p >= 1.0f) {
+      p -= 1.0f;
+    }
+    sum[n] += wave<WF>(gen, inc, &p, duty);
+  }
+  *phase = p;
+  osc.increment_time_at(inv_rate * (f32)frames, voice_iter);
+}
+
+// Once per osc per block, each case is the whole block of one waveform
+inline void render_osc_as(size_t waveform, const Generator &gen,
+                          Oscillator &osc, size_t voice_iter, const f32 *freq,
+                          f32 duty, f32 *sum, size_t frames, f32 inv_rate) {
+  switch (waveform) {
+  default:
+    render_osc<SAW>(gen, osc, voice_iter, freq, duty, sum, frames, inv_rate);
+    break;
+  case SINE:
+    render_osc<SINE>(gen, osc, voice_iter, freq, duty, sum, frames, inv_rate);
+    break;
+  case SQUARE:
+    render_osc<SQUARE>(gen, osc, voice_iter, freq, duty, sum, frames,
+                       inv_rate);
+    break;
+  case TRIANGLE:
+    render_osc<TRIANGLE>(gen, osc, voice_iter, freq, duty, sum, frames,
+                         inv_rate);
+    break;
+  case PULSE:
+    render_osc<PULSE>(gen, osc, voice_iter, freq, duty, sum, frames,
+                      inv_rate);
+    break;
+  }
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+#include "define.hpp"
+
+#include <vector>
+
+enum LATENCY_CONSTANTS : size_t {
+  LATENCY_NOTES_DEFAULT = 50,
+};
+
+// poll_ms 0 sleeps until the ingest thread wakes the loop, like main does.
+// Otherwise the loop polls at that period, 8 is the old 120 FPS loop
+struct Latency_Config {
+  i32 device_frames;
+  i32 poll_ms;
+};
+
+// All in ms. render is note injected to its first loud sample coming out of
+// the callback, output adds what SDL and the device still had queued
+struct Latency_Stats {
+  size_t count;
+  size_t missed;
+  f32 min, p50, p99, max;
+  f32 output;
+};
+
+// Needs SDL audio and events up, no window or MIDI hardware. Notes go in
+// through a loopback MIDI device so they take the same ingest, merge, wake
+// and queue path as a keyboard, onsets are caught on the audio thread
+bool measure_latency(const Latency_Config &config, size_t notes,
+                     Latency_Stats &stats);
+// Every buffer size in frames (all of them if empty) against both poll
+// strategies, printed as a table
+bool latency_sweep(const std::vector<i32> &frames, size_t notes);
+
+#endif
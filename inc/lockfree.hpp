@@ -0,0 +1,159 @@
+#ifndef LOCKFREE_HPP
+#define LOCKFREE_HPP
+#include "define.hpp"
+
+#include <array>
+#include <atomic>
+#include <type_traits>
+
+// Keeps the two ends of a queue off each other's cache line
+const size_t CACHE_LINE = 64;
+
+// One writer, one reader, the writer never waits and the reader always gets
+// the newest published value
+template <typename T> class Triple_Buffer {
+public:
+  Triple_Buffer(void) : slots(), back(0), middle(1), front(2) {}
+
+  // writer side
+  T &get_back(void) { return slots[back]; }
+  void publish(void) {
+    back = middle.exchange(back | DIRTY, std::memory_order_acq_rel) & INDEX;
+  }
+
+  // reader side, true when a newer value was swapped in
+  bool pending(void) const {
+    return middle.load(std::memory_order_acquire) & DIRTY;
+  }
+  bool acquire(void) {
+    if (!(middle.load(std::memory_order_acquire) & DIRTY)) {
+      return false;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+  const T &get_front(void) const { return slots[front]; }
+  // Only while the reader is known to be stopped
+  T &get_front(void) { return slots[front]; }
+  // Published but not acquired yet, null when there's none. Only while the
+  // reader is stopped and from the writer's thread
+  T *get_pending(void) {
+    const u8 m = middle.load(std::memory_order_acquire);
+    return (m & DIRTY) ? &slots[m & INDEX] : nullptr;
+  }
+
+private:
+  enum : u8 { INDEX = 0x3, DIRTY = 0x4 };
+  std::array<T, 3> slots;
+  u8 back;
+  std::atomic<u8> middle;
+  u8 front;
+};
+
+// One writer, one reader, fixed capacity. N has to be a power of two, a full
+// ring refuses the push instead of waiting
+template <typename T, size_t N> class Spsc_Ring {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "ring size must be a power of 2");
+
+public:
+  Spsc_Ring(void) : slots(), head(0), tail(0) {}
+
+  // writer side
+  bool push(const T &value) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= N) {
+      return false;
+    }
+    slots[h & (N - 1)] = value;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Copies as many as fit, returns how many went in
+  size_t push_n(const T *values, size_t count) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    const size_t space = N - (h - tail.load(std::memory_order_acquire));
+    const size_t n = count < space ? count : space;
+    for (size_t i = 0; i < n; i++) {
+      slots[(h + i) & (N - 1)] = values[i];
+    }
+    head.store(h + n, std::memory_order_release);
+    return n;
+  }
+
+  // reader side, peek is null when empty
+  const T *peek(void) const {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &slots[t & (N - 1)];
+  }
+  bool pop(T &value) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = slots[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t pop_n(T *values, size_t max) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    const size_t avail = head.load(std::memory_order_acquire) - t;
+    const size_t n = max < avail ? max : avail;
+    for (size_t i = 0; i < n; i++) {
+      values[i] = slots[(t + i) & (N - 1)];
+    }
+    tail.store(t + n, std::memory_order_release);
+    return n;
+  }
+
+  size_t size(void) const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+  size_t capacity(void) const { return N; }
+
+private:
+  std::array<T, N> slots;
+  alignas(CACHE_LINE) std::atomic<size_t> head;
+  alignas(CACHE_LINE) std::atomic<size_t> tail;
+};
+
+// One writer that never waits, readers copy and retry if the writer lapped
+// them. Odd sequence means a write is in flight into the other slot, so a
+// reader only loses its copy once the writer comes back around to its slot.
+// T has to be trivially copyable
+template <typename T> class Seqlock {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "seqlock values are copied racily");
+
+public:
+  Seqlock(void) : slots(), seq(0) {}
+
+  // writer side
+  void write(const T &value) {
+    const u32 s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slots[((s >> 1) + 1) & 1] = value;
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+  // reader side, false if the copy may be torn
+  bool read(T &value) const {
+    const u32 before = seq.load(std::memory_order_acquire);
+    value = slots[(before >> 1) & 1];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const u32 after = seq.load(std::memory_order_relaxed);
+    return after - before < ((before & 1) ? 2u : 3u);
+  }
+
+private:
+  std::array<T, 2> slots;
+  std::atomic<u32> seq;
+};
+
+#endif
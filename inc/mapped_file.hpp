@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+#include "define.hpp"
+
+#include <string>
+
+// Read only view of a whole file. Nothing is read until a page is touched,
+// so opening a big file costs the same as a small one
+class Mapped_File {
+public:
+  Mapped_File(void);
+  ~Mapped_File(void);
+  Mapped_File(const Mapped_File &) = delete;
+  Mapped_File &operator=(const Mapped_File &) = delete;
+
+  // False when missing or empty
+  bool open(const std::string &path);
+  void close(void);
+  const u8 *data(void) const { return base; }
+  size_t size(void) const { return length; }
+  bool is_open(void) const { return base != nullptr; }
+
+private:
+  const u8 *base;
+  size_t length;
+#ifdef _WIN32
+  void *file, *mapping;
+#else
+  int fd;
+#endif
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef MIDI_INPUT_HPP
+#define MIDI_INPUT_HPP
+#include "define.hpp"
+#include "lockfree.hpp"
+#include "synth.hpp"
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <portmidi.h>
+
+enum MIDI_INPUT_CONSTANTS : size_t {
+  MIDI_DEVICE_MAX = 8,
+  DEVICE_RING_SIZE = 1024,
+  MERGED_RING_SIZE = 2048,
+  CHANNEL_KEEP = 0, // remap channels are 1 - 16, 0 leaves the device alone
+  MIDI_CHANNELS = 16,
+  MIDI_KEYS = 128,
+};
+
+struct Midi_Device_Stats {
+  std::atomic<u64> received{0};
+  // pending ring was full
+  std::atomic<u64> dropped{0};
+  // PortMidi's own buffer overflowed before we read it
+  std::atomic<u64> overflows{0};
+  // Came back after an unplug or wasn't there at open
+  std::atomic<u64> reconnects{0};
+};
+
+struct Midi_Device {
+  Midi_Device(const char *name, u32 _channel, bool _loopback)
+      : controller(name), channel(_channel), pending(), stats(),
+        opened(false), lost(false), held(), held_notes(0),
+        loopback(_loopback) {}
+  Controller controller;
+  u32 channel;
+  Spsc_Ring<PmEvent, DEVICE_RING_SIZE> pending;
+  Midi_Device_Stats stats;
+  // Only changes while the ingest thread is kept off PortMidi
+  bool opened;
+  // The stream errored, ingest stops reading it until the watcher reopens it
+  std::atomic<bool> lost;
+  // Notes on per channel as read, after the remap. Ingest thread, or the
+  // watcher while it holds PortMidi. The count is for the watcher to read
+  std::array<std::bitset<MIDI_KEYS>, MIDI_CHANNELS> held;
+  std::atomic<u32> held_notes;
+  // No PortMidi stream, whoever injects writes pending directly
+  bool loopback;
+};
+
+// Called from the ingest thread whenever a round merged something
+typedef void (*Midi_Notify)(void *userdata);
+
+// Every device is read on one ingest thread into its own pending ring, then
+// k-way merged by timestamp into a single ring the main loop drains. Only
+// events stamped before the round started are merged, anything newer waits a
+// round so a slower device can't end up out of order.
+//
+// PortMidi only enumerates at Pm_Initialize, so while a named device is
+// missing a watcher thread restarts PortMidi to look for it. That closes
+// every stream, so the ingest thread is parked off PortMidi first and the
+// open devices are drained and reopened along with the new one. It never
+// restarts while a working stream has notes held, so nothing can be let go
+// in the gap, and it backs off while working streams keep paying for it. A
+// stream that errors gets note offs for whatever it was holding straight
+// away. Nothing else waits on it
+class Midi_Input {
+public:
+  Midi_Input(void);
+  ~Midi_Input(void);
+
+  bool add_device(const char *name, u32 channel);
+  // A stand-in device fed by inject(), merged like any other. Returns its
+  // index for inject(), SIZE_MAX if there's no room
+  size_t add_loopback(void);
+  // One injecting thread per loopback, stamp events with Pt_Time()
+  bool inject(size_t device, const PmEvent &event);
+  // Before open(), lets a blocked main loop wake up for new input
+  void set_notify(Midi_Notify fn, void *userdata);
+  // After Pm_Initialize. False when nothing opened yet, named devices that
+  // weren't there are still watched for
+  bool open(void);
+  void close(void);
+
+  // consumer side, returns how many events were written
+  size_t read(PmEvent *events, size_t max);
+
+  size_t get_device_count(void) const { return devices.size(); }
+  u64 get_merge_dropped(void) const { return merge_dropped.load(); }
+  void print_stats(void) const;
+
+private:
+  size_t open_devices(bool print);
+  void ingest_loop(void);
+  void watch_loop(void);
+  bool rescan(size_t &found);
+  void poll_device(Midi_Device &dev);
+  void release_held(Midi_Device &dev);
+  size_t merge(PmTimestamp watermark);
+
+  std::vector<std::unique_ptr<Midi_Device>> devices;
+  Spsc_Ring<PmEvent, MERGED_RING_SIZE> merged;
+  std::atomic<u64> merge_dropped;
+  std::atomic<bool> running;
+  // The watcher holds PortMidi while rescanning is set and polling is clear
+  std::atomic<bool> rescanning, polling;
+  std::thread ingest, watcher;
+  Midi_Notify notify;
+  void *notify_data;
+};
+
+#endif
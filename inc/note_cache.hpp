@@ -0,0 +1,129 @@
+#ifndef NOTE_CACHE_HPP
+#define NOTE_CACHE_HPP
+#include "define.hpp"
+#include "lockfree.hpp"
+#include "preset.hpp"
+#include "synth.hpp"
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+enum NOTE_CACHE_CONSTANTS : size_t {
+  NOTE_CACHE_SLOTS = 64,
+  NOTE_CACHE_MS_DEFAULT = 100,
+  NOTE_CACHE_MS_MAX = 500,
+  NOTE_CACHE_REQUESTS = 64,
+  // Patches are big, a burst of edits past this just misses for a while
+  NOTE_CACHE_PATCHES = 4,
+  // Velocity layers are shared by every note in a band
+  NOTE_CACHE_VELOCITY_BANDS = 8,
+};
+
+enum NOTE_CACHE_STATE : u8 { NOTE_EMPTY, NOTE_RENDERING, NOTE_READY };
+
+// Everything a voice carries between blocks, one per BLOCK_FRAMES of a note
+struct Note_Snapshot {
+  Voice voice;
+  std::array<f32, MAX_OSC_COUNT> phases;
+};
+
+// Everything but samples and snapshots is the audio thread's, the worker only
+// fills those while the state is RENDERING
+struct Note_Entry {
+  std::atomic<u8> state{NOTE_EMPTY};
+  u32 key = 0;
+  f32 layer = 0.0f; // the band's velocity, or -1 when the note doesn't read it
+  u64 generation = 0;
+  size_t frames = 0;
+  u64 last_used = 0;
+  u32 users = 0;
+  std::vector<f32> samples;
+  std::vector<Note_Snapshot> snapshots;
+};
+
+struct Note_Request {
+  u32 slot;
+  u32 key;
+  f32 layer;
+  u64 generation;
+};
+
+struct Note_Patch {
+  u64 generation;
+  i32 sample_rate;
+  i32 channels;
+  Preset preset;
+};
+
+struct Note_Binding {
+  bool active;
+  u32 slot;
+  size_t pos;
+  f32 scale;
+};
+
+// Pre-renders the first ms of each key (and velocity, when a route reads it)
+// on a worker thread with its own synth, so a note on a static patch starts
+// by copying samples instead of running the chain. A patch is static when
+// nothing live moves it: every matrix route is either silent right now or
+// only reads the envelope and velocity. Start phases are fixed while a cache
+// is attached so the cached and live renders are the same note.
+//
+// Leaving the cache early, on note off or anything that changes the sound,
+// restores the voice from the snapshot of the block it's in and re-renders
+// the few frames since, so the live chain carries on exactly where the cache
+// stopped. Slots are a fixed pool, the least recently used idle one goes
+// when a new key needs room.
+class Note_Cache {
+public:
+  Note_Cache(void);
+  ~Note_Cache(void);
+  Note_Cache(const Note_Cache &) = delete;
+  Note_Cache &operator=(const Note_Cache &) = delete;
+
+  // Before it's attached to a synth, allocates every slot up front
+  bool start(size_t ms, i32 sample_rate_max);
+  // After it's detached
+  void stop(void);
+  u64 get_hits(void) const { return hits.load(); }
+  u64 get_misses(void) const { return misses.load(); }
+
+  // audio thread, or any thread while the audio thread is held off
+  void invalidate(void) { generation++; }
+  void note_on(Synth &syn, size_t voice, f32 velocity);
+  bool playing(size_t voice) const { return bindings[voice].active; }
+  // Copies up to frames of the note into out, returns how many
+  size_t play(Synth &syn, size_t voice, f32 *out, size_t frames);
+  void leave(Synth &syn, size_t voice);
+  void leave_all(Synth &syn);
+
+private:
+  bool cacheable(const Synth &syn, bool &by_velocity) const;
+  size_t find(u32 key, f32 layer, bool &pending) const;
+  size_t claim(void);
+  bool request(const Synth &syn, size_t slot);
+  void unbind(size_t voice);
+  void restore(Synth &syn, size_t voice, const Note_Snapshot &snap,
+               size_t frames);
+
+  // worker
+  void work_loop(void);
+  void render(Synth &wsyn, Graph &graph, Note_Entry &entry, u32 key,
+              f32 layer);
+
+  std::array<Note_Entry, NOTE_CACHE_SLOTS> entries;
+  std::array<Note_Binding, VOICES> bindings;
+  Spsc_Ring<Note_Request, NOTE_CACHE_REQUESTS> requests;
+  Spsc_Ring<Note_Patch, NOTE_CACHE_PATCHES> patches;
+  std::array<f32, GRAPH_BUFFER_STRIDE> scratch;
+
+  std::atomic<bool> running;
+  std::thread worker;
+  size_t ms;
+  u64 generation, sent_generation, clock;
+  std::atomic<u64> hits, misses;
+};
+
+#endif
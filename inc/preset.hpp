@@ -0,0 +1,98 @@
+#ifndef PRESET_HPP
+#define PRESET_HPP
+#include "define.hpp"
+#include "mapped_file.hpp"
+
+#include <string>
+
+enum PRESET_CONSTANTS : u32 {
+  PRESET_MAGIC = 0x42534753, // "SGSB"
+  PRESET_VERSION = 1,
+  PRESET_NAME_MAX = 32,
+  PRESET_PARAM_SLOTS = 32,
+  PRESET_COUNT_MAX = 128,
+  PRESET_ARP_STEPS = 16,
+  PRESET_MOD_SLOTS = 8,
+};
+
+// Everything below is the on disk layout (little endian), append into the
+// reserved space and bump PRESET_VERSION, never reorder
+struct Preset_Osc {
+  i32 waveform;
+  f32 detune;
+  f32 duty;
+  u32 reserved;
+};
+
+// velocity 0 is a rest
+struct Preset_Step {
+  i8 offset;
+  u8 velocity;
+};
+
+// source and via are MOD_SOURCE, dest is MOD_DEST
+struct Preset_Mod {
+  u8 source;
+  u8 via;
+  u8 dest;
+  u8 reserved;
+  f32 amount;
+};
+
+struct Preset {
+  char name[PRESET_NAME_MAX];
+  // Indexed by SYNTH_PARAMETER, param_count lets older banks load after new
+  // params are added
+  f32 params[PRESET_PARAM_SLOTS];
+  u32 param_count;
+  u32 osc_count;
+  Preset_Osc oscs[MAX_OSC_COUNT];
+  f32 delay_time;
+  f32 delay_feedback;
+  u32 flags;
+  // Zeroed in older banks, which loads as arp off with the defaults
+  u8 arp_mode;
+  u8 arp_rate;
+  u8 arp_gate; // percent of a step, 0 picks the default
+  u8 arp_steps; // 0 keeps the built in pattern
+  Preset_Step arp_pattern[PRESET_ARP_STEPS];
+  // Zeroed in older banks, mod_count 0 loads the default routes
+  u8 mod_count;
+  u8 mod_rate; // frames per control tick, 0 picks the default
+  u8 reserved_mod[2];
+  Preset_Mod mods[PRESET_MOD_SLOTS];
+  u8 reserved[132];
+};
+
+struct Preset_Header {
+  u32 magic;
+  u32 version;
+  u32 count;
+  u32 record_size;
+  u8 reserved[48];
+};
+
+static_assert(sizeof(Preset) == 512, "Preset layout changed");
+static_assert(sizeof(Preset_Header) == 64, "Preset_Header layout changed");
+
+// Read only mapping of the bank file, records are copied out before they get
+// anywhere near the audio thread so a page fault never lands there
+class Preset_Bank {
+public:
+  Preset_Bank(std::string _file_path);
+  ~Preset_Bank(void);
+
+  bool open(void);
+  void close(void);
+  bool store(u32 program, const Preset &preset);
+
+  u32 get_count(void) const;
+  const Preset *get_preset_at(u32 program) const;
+  bool is_open(void) const { return map.is_open(); }
+
+private:
+  std::string file_path;
+  Mapped_File map;
+};
+
+#endif
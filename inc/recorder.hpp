@@ -0,0 +1,72 @@
+#ifndef RECORDER_HPP
+#define RECORDER_HPP
+#include "define.hpp"
+#include "lockfree.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+enum RECORDER_CONSTANTS : u32 {
+  // Samples, about 10s of stereo at 48k before blocks start dropping
+  RECORD_RING_SIZE = 1 << 20,
+  // Frames per write, a multiple of 4096 so any frame size lands aligned
+  RECORD_CHUNK_FRAMES = 32768,
+  RECORD_BITS = 32,
+};
+
+typedef Spsc_Ring<f32, RECORD_RING_SIZE> Record_Ring;
+
+// Master output to a wav while playing. The audio thread only copies a block
+// into the ring, or counts it dropped if there's no room for all of it. A
+// writer thread owns the file and writes whole chunks, O_DIRECT where the
+// filesystem takes it. The header is rewritten on stop, and turns RF64 if
+// the take went past 4GB
+class Recorder {
+public:
+  Recorder(void);
+  ~Recorder(void);
+  Recorder(const Recorder &) = delete;
+  Recorder &operator=(const Recorder &) = delete;
+
+  // Not on the audio thread. The take stays in the format it started in,
+  // blocks in any other count as dropped
+  bool start(const std::string &_path, i32 sample_rate, i32 channels);
+  void stop(void);
+  bool is_recording(void) const { return armed.load(); }
+  u64 get_dropped(void) const { return dropped.load(); }
+
+  // audio thread
+  void block(const f32 *samples, size_t frames, i32 sample_rate,
+             i32 channels);
+
+private:
+  bool open_file(void);
+  bool write_at(u64 offset, const u8 *bytes, size_t size);
+  void close_file(void);
+  void write_loop(void);
+  void drain(bool final);
+
+  std::unique_ptr<Record_Ring> ring;
+  std::atomic<bool> running, armed, busy;
+  std::atomic<u64> dropped;
+  std::thread writer;
+
+  // set before armed, read by both sides after
+  std::string path;
+  i32 take_rate, take_channels;
+
+  // writer side
+  f32 *staging;
+  u8 *encoded;
+  u64 data_bytes;
+  bool direct, failed;
+#ifdef _WIN32
+  void *file;
+#else
+  int fd;
+#endif
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef RENDER_AHEAD_HPP
+#define RENDER_AHEAD_HPP
+#include "define.hpp"
+#include "lockfree.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+class Audio_Sys;
+
+enum RENDER_AHEAD_CONSTANTS : u32 {
+  // Samples, 16 blocks of 4096 stereo frames
+  AHEAD_RING_SIZE = 1 << 17,
+  AHEAD_BLOCK_RING_SIZE = 64,
+  AHEAD_BLOCKS_DEFAULT = 2,
+  AHEAD_BLOCKS_MAX = 16,
+  // Device didn't say, render in these
+  AHEAD_BLOCK_FRAMES = 256,
+};
+
+struct Ahead_Block {
+  u32 frames;
+  u32 sounding;
+};
+
+// A producer thread keeps depth blocks rendered ahead of the device and the
+// callback only copies them out. Costs depth blocks of latency, buys a
+// block that runs long without an underrun. The depth follows the lowest
+// the queue got at a callback: under half a block of slack and it grows a
+// block, a whole window with two or more spare and it gives one back, never
+// under what it was asked for
+class Render_Ahead {
+public:
+  Render_Ahead(size_t _depth_min);
+  ~Render_Ahead(void);
+  Render_Ahead(const Render_Ahead &) = delete;
+  Render_Ahead &operator=(const Render_Ahead &) = delete;
+
+  // Only while the callback can't run, whatever was queued is thrown out
+  bool start(Audio_Sys *_audio, size_t _block_frames, size_t _channels);
+  void stop(void);
+
+  // audio thread, zero fills whatever isn't there yet. False when all of it
+  // was silent
+  bool pull(f32 *out, size_t frames);
+
+  size_t get_depth(void) const { return depth.load(); }
+  size_t get_block_frames(void) const { return block_frames; }
+  size_t get_queued_frames(void) const;
+  u64 get_underruns(void) const { return underruns.load(); }
+
+private:
+  void produce_loop(void);
+  void adapt(u64 now);
+
+  Audio_Sys *audio;
+  Spsc_Ring<f32, AHEAD_RING_SIZE> samples;
+  Spsc_Ring<Ahead_Block, AHEAD_BLOCK_RING_SIZE> blocks;
+  std::atomic<bool> running;
+  std::atomic<size_t> depth;
+  std::atomic<size_t> low_water;
+  std::atomic<u64> underruns;
+  std::thread producer;
+  size_t depth_min, depth_max, block_frames, channels;
+  u64 poll_ns;
+
+  // producer only
+  std::vector<f32> block;
+  u64 window_start, seen_underruns;
+
+  // audio thread only
+  size_t current_left;
+  bool current_sounding;
+};
+
+#endif
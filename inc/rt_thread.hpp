@@ -0,0 +1,52 @@
+#ifndef RT_THREAD_HPP
+#define RT_THREAD_HPP
+#include "define.hpp"
+
+#include <atomic>
+#include <vector>
+
+enum RT_CONSTANTS : size_t {
+  RT_THREAD_MAX = 32,
+  RT_LINE_MAX = 96,
+  // Touched at the top of a realtime thread so its stack is already there
+  RT_STACK_PREFAULT = 64 * 1024,
+};
+
+enum RT_ROLE : u8 {
+  // On the callback's critical path, gets priority and a core
+  RT_AUDIO,
+  // Spins waiting on the audio thread, so it only goes FIFO when pinned.
+  // Spinning at FIFO anywhere the scheduler likes starves everything else
+  RT_LANE,
+  // Renders off the critical path, just the denormal flags
+  RT_WORKER,
+};
+
+struct Rt_Config {
+  // SCHED_FIFO, nice as a fallback, and memory locking
+  bool realtime = true;
+  // Realtime threads are pinned round robin over these, empty leaves it to
+  // the scheduler
+  std::vector<u32> cpus;
+};
+
+// Main thread, before anything below runs
+void rt_setup(const Rt_Config &config);
+// Main thread, once the DSP buffers are allocated so they're locked too
+void rt_lock_memory(void);
+// Top of every thread that runs DSP, anything after the first call on a
+// thread is a no-op. Never prints, the result waits for rt_report
+void rt_enter_thread(const char *name, RT_ROLE role);
+// Flush to zero and denormals are zero on the calling thread. The one pole
+// and delay tails decay through denormals otherwise
+bool rt_denormals_off(void);
+// Main thread, prints threads that entered since the last call
+void rt_report(void);
+
+// Sleeps while word still holds seen, until rt_wake_all on it. Can return
+// early, so callers check again. A futex on linux, WaitOnAddress on windows,
+// a short nap anywhere else
+void rt_wait(std::atomic<u32> &word, u32 seen);
+void rt_wake_all(std::atomic<u32> &word);
+
+#endif
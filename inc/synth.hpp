@@ -1,323 +1,630 @@
-#ifndef AUDIO_HPP
-#define AUDIO_HPP
-#include "define.hpp"
-
-#include <array>
-#include <vector>
-
-#include <portmidi.h>
-
-#define CENTS_TO_OCTAVE 1.0f / 1200.0f
-#define ONE_SEMITONE_CENTS 100.0f
-#define TWO_SEMITONE_CENTS 200.0f
-
-f32 create_vibrato(f32 sine, f32 cents);
-void lerp_f32(const f32 *target, f32 *val, const f32 alpha);
-
-// hz = 1.0f / time
-f32 time_to_hz(f32 time);
-// 2PI * HZ
-f32 hz_to_rad_per_sec(f32 hz);
-// HZ / 2PI
-f32 rad_per_sec_to_hz(f32 rad);
-
-f32 note_to_time(f32 tempo, i32 beat_count);
-
-struct Midi_Input_Msg {
-  Midi_Input_Msg(void) : status(0), msg1(0), msg2(0) {}
-  Midi_Input_Msg(u32 _status, u32 _msg1, u32 _msg2)
-      : status(_status), msg1(_msg1), msg2(_msg2) {}
-  u32 status;
-  u32 msg1, msg2;
-};
-
-struct Keyboard_Command {
-  enum Type : i32 {
-    pitch_bend,
-    note_on,
-    note_off,
-    mod_wheel,
-    vol_knob,
-  } type;
-
-  Midi_Input_Msg input;
-};
-
-class Controller {
-public:
-  Controller(const char *name_arg);
-  ~Controller(void) = default;
-
-  bool open(void);
-  bool close(void);
-  void list_available_controllers(void);
-  void get_midi_device_by_name(void);
-  bool open_stream(i32 bufsize);
-  bool close_stream(void);
-  i32 read_input(void);
-  void clear_msg_buf(void);
-  const PmEvent *get_event_at(i32 pos) const;
-  const std::array<PmEvent, INPUT_BUFFER_MAX> &get_input_buffer(void) const {
-    return input_buffer;
-  }
-  Midi_Input_Msg parse_event(PmEvent event);
-
-private:
-  std::string input_name;
-  i32 input_id;
-  PortMidiStream *stream;
-  std::array<PmEvent, INPUT_BUFFER_MAX> input_buffer;
-};
-
-enum ENV_STATE : size_t { ATK, DEC, REL, SUS, OFF };
-
-class Lfo {
-public:
-  Lfo(void) : active(true), phase(0.0f) {}
-  void increment(f32 rate, i32 sample_rate);
-  void set_active(bool val) { active = val; }
-  bool get_active_state(void) { return active; }
-  f32 lfo_sine(void);
-
-private:
-  bool active;
-  f32 phase;
-};
-
-class Delay {
-public:
-  Delay(i32 sample_rate, f32 delay_time_s, f32 _feedback);
-  void delay_write(f32 sample);
-  f32 delay_read(void);
-  void increment(size_t read_inc, size_t write_inc);
-  void rebuild(i32 sample_rate, f32 delay_time_s);
-
-private:
-  std::vector<f32> buffer;
-  size_t read, write;
-  size_t start, end;
-  f32 feedback;
-  Lfo lfo;
-};
-
-class Amp_Modulator {
-public:
-  Amp_Modulator(void) : lfo() {}
-  Lfo &get_lfo(void) { return lfo; }
-
-private:
-  Lfo lfo;
-};
-
-class Freq_Modulator {
-public:
-  Freq_Modulator(void) : lfo() {}
-  f32 create_vibrato(f32 sine, f32 cents) const;
-  Lfo &get_lfo(void) { return lfo; }
-
-private:
-  Lfo lfo;
-};
-
-class LPF {
-public:
-  LPF(void);
-  void reset(void);
-  f32 alpha(f32 cutoff, i32 sample_rate);
-
-  std::array<f32, CHANNEL_MAX> &get_array(void) { return low; }
-  const std::array<f32, CHANNEL_MAX> &get_array(void) const { return low; }
-  const f32 *get_value_at(size_t pos) const;
-  f32 *get_value_at(size_t pos);
-
-private:
-  std::array<f32, CHANNEL_MAX> low;
-};
-
-class Oscillator {
-public:
-  Oscillator(void);
-  void reset(size_t voice_index);
-
-  f32 phase_clamp(f32 phase_val, f32 max);
-  void increment_phase_at(f32 inc, f32 max, size_t pos);
-  void increment_time_at(f32 dt, size_t pos);
-
-  std::array<f32, CHANNEL_MAX> *get_sample_array_at(size_t pos);
-  const f32 *get_sample_at(const std::array<f32, CHANNEL_MAX> *buf,
-                           size_t pos) const;
-  void set_sample_at(std::array<f32, CHANNEL_MAX> *buf, size_t pos, f32 value);
-
-  const f32 *get_inc_at(size_t pos) const;
-  const f32 *get_phase_at(size_t pos) const;
-  const f32 *get_time_at(size_t pos) const;
-
-  f32 get_detune(void) const { return detune; }
-  f32 get_duty(void) const { return duty; }
-  i32 get_waveform(void) const { return waveform; }
-
-  void set_detune(f32 val) { detune = val; }
-  void set_duty(f32 val) { duty = val; }
-  void set_waveform(i32 val) { waveform = val; }
-
-private:
-  f32 detune = 1.0f, detune_min = 0.9f, detune_max = 1.1f;
-  f32 duty = 0.5f, duty_min = 0.1f, duty_max = 1.0f;
-  i32 waveform = SAW;
-
-  std::array<std::array<f32, CHANNEL_MAX>, VOICES> gen;
-  std::array<f32, VOICES> phase;
-  std::array<f32, VOICES> time;
-};
-
-class Voice {
-public:
-  Voice(void);
-  LPF &get_lpf(void) { return lpf; }
-
-  u32 get_key(void) const { return midi_key; }
-  i32 get_active_count(void) const { return active_oscillators; }
-  u8 get_env_state(void) const { return env_state; }
-
-  f32 get_envelope(void) const { return envelope; }
-  f32 get_freq(void) const { return freq; }
-
-  std::array<f32, CHANNEL_MAX> &get_sum_array(void) { return voice_sums; }
-  std::array<f32, CHANNEL_MAX> &get_clipped_array(void) { return clipped_sums; }
-  std::array<f32, CHANNEL_MAX> &get_out_array(void) { return voice_out; }
-  std::array<f32, CHANNEL_MAX> &get_filtered_array(void) {
-    return filtered_sums;
-  }
-
-  void add_sum_at(size_t pos, const f32 *sample);
-
-  void set_clipped_at(size_t pos, const f32 *val);
-  void set_filtered_at(size_t pos, const f32 *val);
-  void set_out_at(size_t pos, const f32 *val);
-
-  void set_clipped_at(size_t pos, f32 val);
-  void set_filtered_at(size_t pos, f32 val);
-  void set_out_at(size_t pos, f32 val);
-
-  const f32 *get_sum_at(size_t pos) const;
-  const f32 *get_clipped_at(size_t pos) const;
-  const f32 *get_filtered_at(size_t pos) const;
-  const f32 *get_out_at(size_t pos) const;
-
-  bool done(void) const;
-  bool releasing(void) const;
-
-  void zero_voice_sums(void);
-  void set_key(u32 key) { midi_key = key; }
-  void set_freq(f32 val) { freq = val; }
-  void set_active_count(i32 val) { active_oscillators = val; }
-  void set_envelope(f32 val) { envelope = val; }
-  void set_env_state(u8 state) { env_state = state; }
-  f32 get_env_alpha(f32 dt, f32 adsr_stage_value);
-  void adsr(f32 dt, f32 atk, f32 dec, f32 sus, f32 rel);
-
-  Lfo &get_vibrato_lfo(void) { return vibrato; }
-  Lfo &get_trem_lfo(void) { return tremolo; }
-
-  void set_vol_mult(f32 val) { volume_multiplier = val; }
-  f32 get_vol_mult(void) { return volume_multiplier; }
-
-private:
-  i32 active_oscillators;
-  u32 midi_key;
-  u8 env_state;
-  f32 freq;
-  f32 envelope;
-  f32 volume_multiplier;
-  LPF lpf;
-  Lfo vibrato, tremolo;
-
-  std::array<f32, CHANNEL_MAX> voice_sums;
-  std::array<f32, CHANNEL_MAX> clipped_sums;
-  std::array<f32, CHANNEL_MAX> filtered_sums;
-  std::array<f32, CHANNEL_MAX> voice_out;
-};
-
-class Generator {
-public:
-  Generator(void) = default;
-  f32 polyblep(f32 inc, f32 phase) const;
-  f32 poly_square(f32 inc, const f32 *phase, f32 duty) const;
-  f32 poly_saw(f32 inc, const f32 *phase) const;
-  f32 square(const f32 *phase, f32 duty) const;
-  f32 sawtooth(const f32 *phase) const;
-
-private:
-};
-
-class Synth {
-public:
-  Synth(void);
-
-  f32 get_dt(void) { return 1.0f / static_cast<f32>(sample_rate); }
-  Delay &get_delay(void) { return delay; }
-  Generator &get_generator(void) { return generator; }
-
-  std::array<f32, CHANNEL_MAX> &get_sum_array(void) { return loop_sums; }
-  std::array<Voice, VOICES> &get_voices(void) { return voices; }
-  const std::array<Voice, VOICES> &get_voices(void) const { return voices; }
-
-  std::vector<Oscillator> &get_oscillators(void) { return oscs; }
-  Oscillator *get_osc_at(size_t pos);
-
-  void zero_loop_sums(void);
-  void add_sum_at(size_t pos, const f32 *sum);
-  f32 get_sum_at(size_t pos) const;
-
-  void loop_voicings_off(u32 midi_key);
-  void loop_voicings_on(u32 midi_key, f32 norm_velocity);
-
-  f32 clamp_param_f32(f32 min, f32 max, f32 value);
-  const ParamF32 *get_param(SYNTH_PARAMETER location) const;
-  ParamF32 *get_param(SYNTH_PARAMETER location);
-  void set_param(SYNTH_PARAMETER param, f32 value);
-  void inc_param(SYNTH_PARAMETER param);
-  void dec_param(SYNTH_PARAMETER param);
-  std::array<ParamF32, S_PARAM_COUNT> init_params(void);
-  const std::array<ParamF32, S_PARAM_COUNT> &get_param_list(void) const {
-    return params_f32;
-  }
-
-  f32 calculate_pitch_bend(f32 cents, f32 normalized_event) const;
-  f32 map_vibrato_depth(f32 normalized_event) const;
-
-  std::vector<Keyboard_Command> read_event(Controller &cont);
-  void run_events(std::vector<Keyboard_Command> &commands);
-
-  const f32 &get_vibrato_rate(void) const { return vibrato_rate; }
-  const f32 &get_vibrato_depth(void) const { return vibrato_depth; }
-  const f32 &get_pitch_bend(void) const { return pitch_bend; }
-  void set_pitch_bend(f32 val) { pitch_bend = val; }
-  void set_vibrato_depth(f32 val) { vibrato_depth = val; }
-  const f32 &get_trem_rate(void) const { return tremolo_rate; }
-
-  const i32 &get_channels(void) const { return channels; }
-  const i32 &get_sample_rate(void) const { return sample_rate; }
-
-  f32 exp_hard_clip(const f32 *sample, f32 gain, f32 mix) const;
-  f32 polynomial_soft_clip(const f32 *sample, f32 gain) const;
-
-private:
-  std::array<ParamF32, S_PARAM_COUNT> params_f32;
-  std::array<f32, D_COUNT> note_durations;
-
-  i32 channels = 2, channel_max = 2;
-  i32 sample_rate = 48000, sample_rate_max = 96000;
-  f32 vibrato_rate = 5.0f, vibrato_rate_max = 15.0f;
-  f32 vibrato_depth = 0.0f, vibrato_max = 50.0f;
-  f32 pitch_bend = 1.0f;
-  f32 tremolo_rate = 2.0f, trem_rate_max = 8.0f;
-
-  std::vector<Oscillator> oscs;
-  std::array<Voice, VOICES> voices;
-  Generator generator;
-  Delay delay;
-  std::array<f32, CHANNEL_MAX> loop_sums;
-};
-
-#endif
+#ifndef AUDIO_HPP
+#define AUDIO_HPP
+#include "define.hpp"
+#include "graph.hpp"
+#include "lockfree.hpp"
+#include "preset.hpp"
+#include "util.hpp"
+
+#include <array>
+#include <vector>
+
+#include <portmidi.h>
+
+#define CENTS_TO_OCTAVE 1.0f / 1200.0f
+#define ONE_SEMITONE_CENTS 100.0f
+#define TWO_SEMITONE_CENTS 200.0f
+
+void lerp_f32(const f32 *target, f32 *val, const f32 alpha);
+
+// hz = 1.0f / time
+f32 time_to_hz(f32 time);
+// 2PI * HZ
+f32 hz_to_rad_per_sec(f32 hz);
+// HZ / 2PI
+f32 rad_per_sec_to_hz(f32 rad);
+
+f32 note_to_time(f32 tempo, f32 note_time);
+
+struct Midi_Input_Msg {
+  Midi_Input_Msg(void) : status(0), msg1(0), msg2(0) {}
+  Midi_Input_Msg(u32 _status, u32 _msg1, u32 _msg2)
+      : status(_status), msg1(_msg1), msg2(_msg2) {}
+  u32 status;
+  u32 msg1, msg2;
+};
+
+struct Keyboard_Command {
+  enum Type : i32 {
+    pitch_bend,
+    note_on,
+    note_off,
+    mod_wheel,
+    vol_knob,
+    program_change,
+    arp_next_mode,
+    arp_next_rate,
+    // UI edits, msg1 is the SYNTH_PARAMETER
+    param_inc,
+    param_dec,
+  } type;
+
+  Midi_Input_Msg input;
+};
+
+class Controller {
+public:
+  Controller(const char *name_arg);
+  ~Controller(void) = default;
+
+  bool open(void);
+  // Skips the lookup, for when the caller already walked the device list
+  bool open(i32 id);
+  bool close(void);
+  const std::string &get_name(void) const { return input_name; }
+  void list_available_controllers(void);
+  void get_midi_device_by_name(void);
+  bool open_stream(i32 bufsize);
+  bool close_stream(void);
+  i32 read_input(void);
+  void clear_msg_buf(void);
+  const PmEvent *get_event_at(i32 pos) const;
+  const std::array<PmEvent, INPUT_BUFFER_MAX> &get_input_buffer(void) const {
+    return input_buffer;
+  }
+  Midi_Input_Msg parse_event(PmEvent event);
+
+private:
+  std::string input_name;
+  i32 input_id;
+  PortMidiStream *stream;
+  std::array<PmEvent, INPUT_BUFFER_MAX> input_buffer;
+};
+
+class Midi_Input;
+class Note_Cache;
+class Session_Capture;
+
+enum ENV_STATE : size_t { ATK, DEC, REL, SUS, OFF };
+
+class Lfo {
+public:
+  Lfo(void) : active(true), phase(0.0f) {}
+  void increment(f32 rate, i32 sample_rate, size_t frames);
+  void set_active(bool val) { active = val; }
+  bool get_active_state(void) { return active; }
+  f32 lfo_sine(void);
+
+private:
+  bool active;
+  f32 phase;
+};
+
+// NONE reads as 1, so as a via it leaves the slot unscaled and as a source
+// it's a fixed offset
+enum MOD_SOURCE : u8 {
+  MOD_SRC_NONE,
+  MOD_SRC_LFO_1, // the vibrato LFO
+  MOD_SRC_LFO_2, // the tremolo LFO
+  MOD_SRC_ENV,
+  MOD_SRC_VELOCITY,
+  MOD_SRC_MOD_WHEEL,
+  MOD_SRC_PITCH_BEND,
+  MOD_SRC_COUNT,
+};
+
+// Amounts are in cents for pitch, octaves for cutoff, a fraction of the
+// tremolo depth param for gain (output level, not the saturation drive), an
+// offset for duty and -1 left to 1 right for pan
+enum MOD_DEST : u8 {
+  MOD_DST_NONE,
+  MOD_DST_PITCH,
+  MOD_DST_CUTOFF,
+  MOD_DST_GAIN,
+  MOD_DST_DUTY,
+  MOD_DST_PAN,
+  MOD_DST_COUNT,
+};
+
+// Control ports out of the mod node. Ramped ones move every frame between
+// ticks, held ones only change on a tick
+enum MOD_OUTPUT : size_t {
+  MOD_OUT_PITCH,  // frequency ratio, ramped
+  MOD_OUT_CUTOFF, // Hz, held
+  MOD_OUT_GAIN_L, // gain and pan, ramped
+  MOD_OUT_GAIN_R,
+  MOD_OUT_COUNT,
+};
+
+enum MOD_CONSTANTS : size_t {
+  MOD_SLOTS = PRESET_MOD_SLOTS,
+  MOD_RATE_MIN = 16,
+  MOD_RATE_MAX = 64,
+  MOD_RATE_DEFAULT = 32,
+};
+
+struct Mod_Slot {
+  u8 source, via, dest;
+  f32 amount;
+};
+
+// Each slot adds source * via * amount to its destination. Only the first
+// slot_count slots are walked
+class Mod_Matrix {
+public:
+  Mod_Matrix(void);
+  void set_defaults(void);
+  void load(const Preset &preset);
+  void store(Preset &preset) const;
+  void evaluate(const std::array<f32, MOD_SRC_COUNT> &sources,
+                std::array<f32, MOD_DST_COUNT> &sums) const;
+
+  size_t get_rate(void) const { return rate; }
+  void set_rate(size_t val);
+  size_t get_slot_count(void) const { return slot_count; }
+  const Mod_Slot &get_slot_at(size_t pos) const { return slots[pos]; }
+  bool set_slot_at(size_t pos, const Mod_Slot &slot);
+
+private:
+  std::array<Mod_Slot, MOD_SLOTS> slots;
+  size_t slot_count;
+  size_t rate;
+};
+
+// Per voice, the ramps between control ticks
+struct Mod_State {
+  std::array<f32, MOD_OUT_COUNT> current, step;
+  f32 duty;
+  size_t countdown;
+  bool primed;
+};
+
+class Delay {
+public:
+  Delay(i32 sample_rate, f32 delay_time_s, f32 _feedback);
+  void delay_write(f32 sample);
+  f32 delay_read(void);
+  void increment(size_t read_inc, size_t write_inc);
+  void rebuild(i32 sample_rate, f32 delay_time_s);
+  void set_time(i32 sample_rate, f32 delay_time_s);
+  f32 get_time(void) const { return time; }
+  f32 get_feedback(void) const { return feedback; }
+  void set_feedback(f32 val) { feedback = val; }
+  bool is_idle(void) const { return idle; }
+  void track_tail(f32 peak, size_t samples, f32 threshold);
+
+private:
+  std::vector<f32> buffer;
+  size_t read, write;
+  size_t start, end;
+  f32 feedback;
+  f32 time;
+  // Samples written in a row under the silence threshold
+  size_t quiet;
+  bool idle;
+  Lfo lfo;
+};
+
+class Amp_Modulator {
+public:
+  Amp_Modulator(void) : lfo() {}
+  Lfo &get_lfo(void) { return lfo; }
+
+private:
+  Lfo lfo;
+};
+
+class Freq_Modulator {
+public:
+  Freq_Modulator(void) : lfo() {}
+  f32 create_vibrato(f32 sine, f32 cents) const;
+  Lfo &get_lfo(void) { return lfo; }
+
+private:
+  Lfo lfo;
+};
+
+class LPF {
+public:
+  LPF(void);
+  void reset(void);
+  f32 alpha(f32 cutoff, i32 sample_rate);
+
+  std::array<f32, CHANNEL_MAX> &get_array(void) { return low; }
+  const std::array<f32, CHANNEL_MAX> &get_array(void) const { return low; }
+  const f32 *get_value_at(size_t pos) const;
+  f32 *get_value_at(size_t pos);
+
+private:
+  std::array<f32, CHANNEL_MAX> low;
+};
+
+class Oscillator {
+public:
+  Oscillator(void);
+  void reset(size_t voice_index, f32 start_phase);
+
+  f32 phase_clamp(f32 phase_val, f32 max);
+  void increment_phase_at(f32 inc, f32 max, size_t pos);
+  void increment_time_at(f32 dt, size_t pos);
+
+  std::array<f32, CHANNEL_MAX> *get_sample_array_at(size_t pos);
+  const f32 *get_sample_at(const std::array<f32, CHANNEL_MAX> *buf,
+                           size_t pos) const;
+  void set_sample_at(std::array<f32, CHANNEL_MAX> *buf, size_t pos, f32 value);
+
+  const f32 *get_inc_at(size_t pos) const;
+  const f32 *get_phase_at(size_t pos) const;
+  f32 *get_phase_at(size_t pos);
+  const f32 *get_time_at(size_t pos) const;
+
+  f32 get_detune(void) const { return detune; }
+  f32 get_duty(void) const { return duty; }
+  i32 get_waveform(void) const { return waveform; }
+
+  void set_detune(f32 val) { detune = val; }
+  void set_duty(f32 val) { duty = val; }
+  void set_waveform(i32 val) { waveform = val; }
+
+private:
+  f32 detune = 1.0f, detune_min = 0.9f, detune_max = 1.1f;
+  f32 duty = 0.5f, duty_min = 0.1f, duty_max = 1.0f;
+  i32 waveform = SAW;
+
+  std::array<std::array<f32, CHANNEL_MAX>, VOICES> gen;
+  std::array<f32, VOICES> phase;
+  std::array<f32, VOICES> time;
+};
+
+class Voice {
+public:
+  Voice(void);
+  LPF &get_lpf(void) { return lpf; }
+
+  u32 get_key(void) const { return midi_key; }
+  i32 get_active_count(void) const { return active_oscillators; }
+  u8 get_env_state(void) const { return env_state; }
+
+  f32 get_envelope(void) const { return envelope; }
+  f32 get_freq(void) const { return freq; }
+
+  std::array<f32, CHANNEL_MAX> &get_sum_array(void) { return voice_sums; }
+  std::array<f32, CHANNEL_MAX> &get_clipped_array(void) { return clipped_sums; }
+  std::array<f32, CHANNEL_MAX> &get_out_array(void) { return voice_out; }
+  std::array<f32, CHANNEL_MAX> &get_filtered_array(void) {
+    return filtered_sums;
+  }
+
+  void add_sum_at(size_t pos, const f32 *sample);
+
+  void set_clipped_at(size_t pos, const f32 *val);
+  void set_filtered_at(size_t pos, const f32 *val);
+  void set_out_at(size_t pos, const f32 *val);
+
+  void set_clipped_at(size_t pos, f32 val);
+  void set_filtered_at(size_t pos, f32 val);
+  void set_out_at(size_t pos, f32 val);
+
+  const f32 *get_sum_at(size_t pos) const;
+  const f32 *get_clipped_at(size_t pos) const;
+  const f32 *get_filtered_at(size_t pos) const;
+  const f32 *get_out_at(size_t pos) const;
+
+  bool done(void) const;
+  bool releasing(void) const;
+
+  void zero_voice_sums(void);
+  void retire(void);
+  void set_key(u32 key) { midi_key = key; }
+  void set_freq(f32 val) { freq = val; }
+  void set_active_count(i32 val) { active_oscillators = val; }
+  void set_envelope(f32 val) { envelope = val; }
+  void set_env_state(u8 state) { env_state = state; }
+  f32 get_env_alpha(f32 dt, f32 adsr_stage_value);
+  void adsr(f32 dt, f32 atk, f32 dec, f32 sus, f32 rel);
+
+  Lfo &get_vibrato_lfo(void) { return vibrato; }
+  Lfo &get_trem_lfo(void) { return tremolo; }
+  Mod_State &get_mod_state(void) { return mod; }
+  // The next control tick starts fresh instead of ramping from the last note
+  void reset_mod(void) {
+    mod.primed = false;
+    mod.countdown = 0;
+  }
+
+  void set_vol_mult(f32 val) { volume_multiplier = val; }
+  f32 get_vol_mult(void) { return volume_multiplier; }
+
+private:
+  i32 active_oscillators;
+  u32 midi_key;
+  u8 env_state;
+  f32 freq;
+  f32 envelope;
+  f32 volume_multiplier;
+  LPF lpf;
+  Lfo vibrato, tremolo;
+  Mod_State mod;
+
+  std::array<f32, CHANNEL_MAX> voice_sums;
+  std::array<f32, CHANNEL_MAX> clipped_sums;
+  std::array<f32, CHANNEL_MAX> filtered_sums;
+  std::array<f32, CHANNEL_MAX> voice_out;
+};
+
+class Generator {
+public:
+  Generator(void) = default;
+  f32 polyblep(f32 inc, f32 phase) const;
+  f32 poly_square(f32 inc, const f32 *phase, f32 duty) const;
+  f32 poly_saw(f32 inc, const f32 *phase) const;
+  f32 square(const f32 *phase, f32 duty) const;
+  f32 sawtooth(const f32 *phase) const;
+  f32 sine(const f32 *phase) const;
+  f32 triangle(const f32 *phase) const;
+
+private:
+};
+
+enum PATCH_FADE : u8 { FADE_NONE, FADE_OUT, FADE_IN };
+
+class Synth;
+
+enum ARP_MODE : u8 {
+  ARP_OFF,
+  ARP_UP,
+  ARP_DOWN,
+  ARP_UP_DOWN,
+  ARP_PATTERN,
+  ARP_MODE_COUNT
+};
+
+enum ARP_CONSTANTS : size_t {
+  ARP_HELD_MAX = 16,
+  ARP_STEPS_MAX = PRESET_ARP_STEPS,
+  // Commands queued to the audio thread between blocks
+  EVENT_QUEUE_MAX = 256,
+};
+
+// Runs on the audio clock. Held keys (or the pattern transposed to the lowest
+// held key) are stepped at the BPM / note duration, the render loop splits its
+// blocks at frames_until_event() so every note lands on its exact sample.
+class Arpeggiator {
+public:
+  Arpeggiator(void);
+
+  void set_mode(u8 val);
+  u8 get_mode(void) const { return mode; }
+  bool enabled(void) const { return mode != ARP_OFF; }
+  bool idle(void) const {
+    return !running && (mode == ARP_OFF || held_count == 0);
+  }
+  void set_rate(size_t duration);
+  size_t get_rate(void) const { return rate; }
+  void set_gate(f32 val);
+  f32 get_gate(void) const { return gate; }
+  void set_pattern(const Preset_Step *steps, size_t count);
+  const std::array<Preset_Step, ARP_STEPS_MAX> &get_pattern(void) const {
+    return pattern;
+  }
+  size_t get_pattern_length(void) const { return pattern_len; }
+
+  void press(u32 key, u32 velocity);
+  void release(u32 key);
+  void stop(Synth *syn);
+
+  size_t frames_until_event(size_t max) const;
+  void fire(Synth *syn);
+  void advance(size_t frames);
+
+private:
+  bool next_note(u32 &key, u32 &velocity);
+
+  std::array<u8, ARP_HELD_MAX> held_keys, held_velocity;
+  size_t held_count;
+  std::array<Preset_Step, ARP_STEPS_MAX> pattern;
+  size_t pattern_len;
+
+  u8 mode;
+  size_t rate;
+  f32 gate;
+
+  bool running;
+  size_t step;
+  i32 sounding;
+  // Samples left, fractional so long runs at any BPM never drift
+  double until_on, until_off;
+};
+
+// Rebuilt whenever the patch changes, the kernels themselves are picked when
+// the voice chain is built
+struct Render_Plan {
+  f32 osc_scale;
+};
+
+Render_Plan make_render_plan(const std::vector<Oscillator> &oscs);
+
+// Published by the audio thread once per callback
+struct Voice_Telemetry {
+  u32 key;
+  i32 active;
+  u8 stage;
+  f32 level;
+  u64 cycles; // spent in the voice chain this callback
+};
+
+struct Voice_Snapshot {
+  u64 block;
+  std::array<Voice_Telemetry, VOICES> voices;
+};
+
+// A patch plus the chains compiled for it, built off the audio thread
+struct Program {
+  Preset preset;
+  Graph voice_graph;
+  Graph master_graph;
+};
+
+class Synth {
+public:
+  Synth(void);
+
+  f32 get_dt(void) { return 1.0f / static_cast<f32>(sample_rate); }
+  Delay &get_delay(void) { return delay; }
+  Generator &get_generator(void) { return generator; }
+
+  std::array<f32, CHANNEL_MAX> &get_sum_array(void) { return loop_sums; }
+  std::array<Voice, VOICES> &get_voices(void) { return voices; }
+  const std::array<Voice, VOICES> &get_voices(void) const { return voices; }
+
+  std::vector<Oscillator> &get_oscillators(void) { return oscs; }
+  Oscillator *get_osc_at(size_t pos);
+
+  void zero_loop_sums(void);
+  void add_sum_at(size_t pos, const f32 *sum);
+  f32 get_sum_at(size_t pos) const;
+
+  void loop_voicings_off(u32 midi_key);
+  void loop_voicings_on(u32 midi_key, f32 norm_velocity);
+  // Resets voice i to the top of a note, loop_voicings_on picks the voice
+  void start_voice(size_t i, u32 midi_key, f32 norm_velocity);
+  void all_notes_off(void);
+  size_t get_sounding_voices(void) const;
+
+  f32 clamp_param_f32(f32 min, f32 max, f32 value);
+  const ParamF32 *get_param(SYNTH_PARAMETER location) const;
+  ParamF32 *get_param(SYNTH_PARAMETER location);
+  void set_param(SYNTH_PARAMETER param, f32 value);
+  void inc_param(SYNTH_PARAMETER param);
+  void dec_param(SYNTH_PARAMETER param);
+  void step_param(SYNTH_PARAMETER param, f32 step);
+  std::array<ParamF32, S_PARAM_COUNT> init_params(void);
+  const std::array<ParamF32, S_PARAM_COUNT> &get_param_list(void) const {
+    return params_f32;
+  }
+
+  std::vector<Keyboard_Command> read_event(Midi_Input &input);
+  void parse_command(const PmEvent &ev,
+                     std::vector<Keyboard_Command> &commands) const;
+  void run_events(std::vector<Keyboard_Command> &commands);
+  void run_event(const Keyboard_Command &command);
+  bool queue_events(std::vector<Keyboard_Command> &commands);
+  void drain_events(void);
+
+  Arpeggiator &get_arp(void) { return arp; }
+
+  void begin_telemetry(void);
+  void add_voice_cycles(size_t voice, u64 cycles) {
+    telemetry_scratch.voices[voice].cycles += cycles;
+  }
+  void publish_telemetry(void);
+  bool read_telemetry(Voice_Snapshot &snapshot) const;
+  f32 get_note_duration(size_t duration) const;
+
+  const f32 &get_vibrato_rate(void) const { return vibrato_rate; }
+  const f32 &get_trem_rate(void) const { return tremolo_rate; }
+  // Normalized controller positions, the matrix decides what they do
+  f32 get_mod_wheel(void) const { return mod_wheel; }
+  // Linear peak, voices and effects below it for a block count as silent
+  f32 get_silence_threshold(void) const { return silence_threshold; }
+  void set_silence_db(f32 db);
+  bool is_silent(void) const;
+  f32 get_bend(void) const { return bend; }
+  const Mod_Matrix &get_matrix(void) const { return matrix; }
+  Mod_Matrix &get_matrix(void) { return matrix; }
+
+  const i32 &get_channels(void) const { return channels; }
+  const i32 &get_sample_rate(void) const { return sample_rate; }
+  const i32 &get_sample_rate_max(void) const { return sample_rate_max; }
+  bool set_output_format(i32 rate, i32 chans);
+
+  void set_bank(const Preset_Bank *_bank) { bank = _bank; }
+  const Preset_Bank *get_bank(void) const { return bank; }
+  // Start phases come from here, fix it to make renders repeatable
+  void set_seed(u32 seed) { rng.set_seed(seed); }
+  // Every note starts its oscs on the same phases instead, the note cache
+  // needs a key to sound the same each time it's played
+  void set_fixed_phase(bool val) { fixed_phase = val; }
+  u32 get_program(void) const { return program; }
+  bool load_program(u32 _program);
+  bool publish_patch(const Preset &preset);
+  // Only while nothing renders, no fade, it's just the patch it starts on
+  bool set_patch(const Preset &preset);
+  // Reads the live patch, only on the audio thread or while nothing renders
+  void store_patch(Preset &preset) const;
+  // Off the audio thread. The audio thread copies the patch out at its next
+  // block, take_patch is true once that copy is there
+  void request_patch(void) { patch_requested.store(true); }
+  bool take_patch(Preset &preset);
+  // audio thread, between blocks
+  void serve_patch(void);
+  void apply_patch(const Preset &preset);
+  void update_patch(void);
+  f32 next_fade_gain(void);
+
+  // Set before the audio device opens and cleared after it closes
+  Session_Capture *get_capture(void) { return capture; }
+  void set_capture(Session_Capture *_capture) { capture = _capture; }
+  // Same, and set_fixed_phase goes with it
+  Note_Cache *get_note_cache(void) { return note_cache; }
+  void set_note_cache(Note_Cache *_cache) { note_cache = _cache; }
+
+  const Render_Plan &get_plan(void) const { return plan; }
+  void rebuild_plan(void) { plan = make_render_plan(oscs); }
+  bool build_program(Program &prog, const Preset &preset) const;
+  Program &get_active_program(void) { return *active; }
+  const Program &get_active_program(void) const { return *active; }
+  std::array<f32, GRAPH_BUFFER_STRIDE> &get_voice_block(void) {
+    return voice_block;
+  }
+  std::array<f32, GRAPH_BUFFER_STRIDE> &get_mix_block(void) {
+    return mix_block;
+  }
+
+  f32 exp_hard_clip(const f32 *sample, f32 gain, f32 mix) const;
+  f32 polynomial_soft_clip(const f32 *sample, f32 gain) const;
+
+private:
+  std::array<ParamF32, S_PARAM_COUNT> params_f32;
+  std::array<f32, D_COUNT> note_durations;
+
+  i32 channels = 2, channel_max = 2;
+  i32 sample_rate = 48000, sample_rate_max = 96000;
+  f32 vibrato_rate = 5.0f, vibrato_rate_max = 15.0f;
+  f32 mod_wheel = 0.0f, bend = 0.0f;
+  f32 silence_threshold = 0.0f;
+  f32 tremolo_rate = 2.0f, trem_rate_max = 8.0f;
+
+  std::vector<Oscillator> oscs;
+  std::array<Voice, VOICES> voices;
+  Generator generator;
+  Delay delay;
+  std::array<f32, CHANNEL_MAX> loop_sums;
+
+  // Filled by whoever reads MIDI, picked up by the audio thread between blocks
+  Triple_Buffer<Program> programs;
+  Program *active;
+  std::atomic<bool> patch_requested;
+  Triple_Buffer<Preset> patch_snapshots;
+  const Preset_Bank *bank;
+  u32 program;
+  u32 chain_flags;
+  u8 fade_state;
+  size_t fade_pos, fade_len;
+  Render_Plan plan;
+  std::array<f32, GRAPH_BUFFER_STRIDE> voice_block, mix_block;
+
+  // Written by the main thread, drained by the audio thread each block
+  Spsc_Ring<Keyboard_Command, EVENT_QUEUE_MAX> event_queue;
+  Arpeggiator arp;
+  Rng rng;
+  bool fixed_phase;
+  Mod_Matrix matrix;
+
+  Voice_Snapshot telemetry_scratch;
+  Seqlock<Voice_Snapshot> telemetry;
+  Session_Capture *capture;
+  Note_Cache *note_cache;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+#include "define.hpp"
+#include "synth.hpp"
+
+#include <ostream>
+#include <vector>
+
+enum TELEMETRY_CONSTANTS : size_t {
+  VOICE_HISTORY = 256,
+};
+
+// UI thread only. Samples the synth's voice snapshot every loop pass and
+// keeps the last VOICE_HISTORY distinct ones for dumping. A voice whose
+// active count went negative has lost a note off somewhere
+class Voice_Monitor {
+public:
+  Voice_Monitor(void);
+
+  bool pull(const Synth &syn);
+  void dump(std::ostream &out) const;
+
+  const Voice_Snapshot &get_latest(void) const { return latest; }
+  u64 get_peak_cycles(void) const;
+  bool is_suspect(size_t voice) const;
+
+private:
+  std::vector<Voice_Snapshot> history;
+  size_t write_pos, count;
+  Voice_Snapshot latest;
+};
+
+const char *get_stage_name(u8 stage);
+
+#endif
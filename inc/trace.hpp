@@ -0,0 +1,83 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+#include "define.hpp"
+
+#include <iostream>
+#include <string>
+
+// Build with -DSGSA_TRACE (make trace) to get spans, without it every macro
+// below is empty and nothing here is compiled in.
+//
+// Each thread writes spans into its own ring and never waits, a full ring
+// drops. The main loop collects them into a bounded history per thread and
+// exports the lot as Chrome trace event JSON, which Perfetto also opens.
+
+#ifdef SGSA_TRACE
+
+enum TRACE_CONSTANTS : size_t {
+  TRACE_THREAD_MAX = 8,
+  TRACE_RING_SIZE = 16384,
+  // Per thread, about 15s of a busy audio thread
+  TRACE_HISTORY = 1 << 19,
+  TRACE_NAME_MAX = 32,
+};
+
+// A counter when dur is TRACE_COUNTER, arg is its value
+const u32 TRACE_COUNTER = 0xFFFFFFFFu;
+
+struct Trace_Event {
+  const char *name; // always a literal, only the pointer is kept
+  u64 start;        // ns since the first span
+  u32 dur;
+  u32 arg;
+};
+
+u64 trace_now(void);
+// Names the calling thread, the first call from a thread claims its ring
+void trace_thread_name(const char *name);
+void trace_span(const char *name, u64 start, u64 end, u32 arg);
+void trace_counter(const char *name, u32 value);
+// Main thread only
+void trace_collect(void);
+bool trace_export(const std::string &path);
+
+class Trace_Scope {
+public:
+  Trace_Scope(const char *_name, u32 _arg)
+      : name(_name), arg(_arg), start(trace_now()) {}
+  ~Trace_Scope(void) { trace_span(name, start, trace_now(), arg); }
+  Trace_Scope(const Trace_Scope &) = delete;
+  Trace_Scope &operator=(const Trace_Scope &) = delete;
+
+private:
+  const char *name;
+  u32 arg;
+  u64 start;
+};
+
+#define TRACE_JOIN_(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN_(a, b)
+#define TRACE_SCOPE(name)                                                      \
+  Trace_Scope TRACE_JOIN(trace_scope_, __LINE__)(name, 0)
+#define TRACE_SCOPE_ARG(name, arg)                                             \
+  Trace_Scope TRACE_JOIN(trace_scope_, __LINE__)(name, static_cast<u32>(arg))
+#define TRACE_COUNT(name, value) trace_counter(name, static_cast<u32>(value))
+#define TRACE_THREAD(name) trace_thread_name(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_ARG(name, arg)
+#define TRACE_COUNT(name, value)
+#define TRACE_THREAD(name)
+
+static inline void trace_collect(void) {}
+static inline bool trace_export(const std::string &path) {
+  (void)path;
+  std::cerr << "Built without SGSA_TRACE, nothing to export" << std::endl;
+  return false;
+}
+
+#endif
+
+#endif
@@ -1,18 +1,54 @@
-#ifndef UTIL_HPP
-#define UTIL_HPP
-#include "define.hpp"
-
-#define ARR_LEN(arr) sizeof(arr) / sizeof(arr[0])
-
-f32 midi_to_freq(i32 n);
-f32 normalize_msg_bipolar(u32 value);
-f32 normalize_msg(u32 value);
-
-void copy_char_buffer(const char *src, char *dst, size_t len);
-f32 rand_f32_range(f32 min, f32 max);
-u8 toggle_bit(u8 original, u8 pos);
-u8 clear_bit(u8 original, u8 pos);
-u8 set_bit(u8 original, u8 pos);
-bool check_bit(u8 original, u8 mask, u8 want);
-
-#endif
+#ifndef UTIL_HPP
+#define UTIL_HPP
+#include "define.hpp"
+
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define ARR_LEN(arr) sizeof(arr) / sizeof(arr[0])
+
+f32 midi_to_freq(i32 n);
+f32 normalize_msg_bipolar(u32 value);
+f32 normalize_msg(u32 value);
+
+void copy_char_buffer(const char *src, char *dst, size_t len);
+u8 toggle_bit(u8 original, u8 pos);
+u8 clear_bit(u8 original, u8 pos);
+u8 set_bit(u8 original, u8 pos);
+bool check_bit(u8 original, u8 mask, u8 want);
+
+// xorshift32, the same seed always gives the same sequence so renders can be
+// compared run to run. Cheap enough for the audio thread, unlike rand()
+class Rng {
+public:
+  Rng(u32 seed) : state(0) { set_seed(seed); }
+  void set_seed(u32 seed) { state = seed != 0 ? seed : 0x9E3779B9u; }
+  u32 next(void);
+  f32 range(f32 min, f32 max);
+
+private:
+  u32 state;
+};
+
+// Monotonic wall clock, comparable across threads
+static inline u64 now_ns(void) {
+  return static_cast<u64>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Timestamp counter where there is one, nanoseconds otherwise. Only good for
+// comparing against other readings on the same machine
+static inline u64 read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<u64>(
+      std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef WAV_HPP
+#define WAV_HPP
+#include "define.hpp"
+
+#include <string>
+#include <vector>
+
+enum WAV_CONSTANTS : u32 {
+  WAV_PCM = 1,
+  WAV_FLOAT = 3,
+  WAV_HEADER_SIZE = 44,
+  // Streamed files put their data on a page so every write stays aligned
+  WAV_STREAM_HEADER_SIZE = 4096,
+};
+
+// 16 or 24 bit PCM, 32 is float. Anything else is refused
+bool wav_bits_valid(u32 bits);
+// The canonical 44 byte header, data_size in bytes
+void wav_header(u8 *out, u32 channels, u32 sample_rate, u32 bits,
+                u32 data_size);
+// Interleaved samples to little endian bytes at bits, PCM is clamped to
+// full scale and rounded
+void wav_encode(const f32 *samples, size_t count, u32 bits,
+                std::vector<u8> &out);
+// Same, into count * bits / 8 bytes the caller owns
+void wav_encode(const f32 *samples, size_t count, u32 bits, u8 *out);
+// The header of a file written as it plays, WAV_STREAM_HEADER_SIZE bytes. A
+// JUNK chunk holds the ds64 chunk's place, so once data_size is past what 32
+// bits can hold the same header becomes RF64 in place
+void wav_stream_header(u8 *out, u32 channels, u32 sample_rate, u32 bits,
+                       u64 data_size);
+bool write_wav(const std::string &path, const f32 *samples, size_t frames,
+               u32 channels, u32 sample_rate, u32 bits);
+
+#endif
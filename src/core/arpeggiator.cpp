@@ -0,0 +1,192 @@
+#include "../../inc/synth.hpp"
+#include "../../inc/util.hpp"
+#include <algorithm>
+#include <cmath>
+
+const f32 ARP_GATE_DEFAULT = 0.5f;
+const f32 ARP_GATE_MIN = 0.05f;
+const f32 ARP_GATE_MAX = 1.0f;
+const i32 MIDI_KEY_MAX = 127;
+
+// Root, octave, fifth, octave, root, rest, seventh, fifth
+static const Preset_Step DEFAULT_PATTERN[] = {
+    {0, 100}, {12, 80}, {7, 90}, {12, 80},
+    {0, 100}, {0, 0},   {10, 90}, {7, 80},
+};
+
+Arpeggiator::Arpeggiator(void)
+    : held_keys(), held_velocity(), held_count(0), pattern(), pattern_len(0),
+      mode(ARP_OFF), rate(D_SIXTEENTH), gate(ARP_GATE_DEFAULT), running(false),
+      step(0), sounding(-1), until_on(0.0), until_off(0.0) {
+  set_pattern(DEFAULT_PATTERN, ARR_LEN(DEFAULT_PATTERN));
+}
+
+void Arpeggiator::set_mode(u8 val) { mode = val % ARP_MODE_COUNT; }
+
+void Arpeggiator::set_rate(size_t duration) {
+  rate = duration < D_COUNT ? duration : D_SIXTEENTH;
+}
+
+void Arpeggiator::set_gate(f32 val) {
+  gate = std::clamp(val, ARP_GATE_MIN, ARP_GATE_MAX);
+}
+
+void Arpeggiator::set_pattern(const Preset_Step *steps, size_t count) {
+  pattern_len = std::min<size_t>(count, ARP_STEPS_MAX);
+  for (size_t i = 0; i < pattern_len; i++) {
+    pattern[i] = steps[i];
+  }
+  step = 0;
+}
+
+// Held keys stay sorted low to high so the up / down orders are just indices
+void Arpeggiator::press(u32 key, u32 velocity) {
+  size_t pos = 0;
+  while (pos < held_count && held_keys[pos] < key) {
+    pos++;
+  }
+  if (pos < held_count && held_keys[pos] == key) {
+    held_velocity[pos] = static_cast<u8>(velocity);
+    return;
+  }
+  if (held_count >= ARP_HELD_MAX) {
+    return;
+  }
+  for (size_t i = held_count; i > pos; i--) {
+    held_keys[i] = held_keys[i - 1];
+    held_velocity[i] = held_velocity[i - 1];
+  }
+  held_keys[pos] = static_cast<u8>(key);
+  held_velocity[pos] = static_cast<u8>(velocity);
+  held_count++;
+}
+
+void Arpeggiator::release(u32 key) {
+  for (size_t pos = 0; pos < held_count; pos++) {
+    if (held_keys[pos] != key) {
+      continue;
+    }
+    for (size_t i = pos + 1; i < held_count; i++) {
+      held_keys[i - 1] = held_keys[i];
+      held_velocity[i - 1] = held_velocity[i];
+    }
+    held_count--;
+    return;
+  }
+}
+
+void Arpeggiator::stop(Synth *syn) {
+  if (sounding >= 0) {
+    syn->loop_voicings_off(static_cast<u32>(sounding));
+  }
+  sounding = -1;
+  running = false;
+  step = 0;
+}
+
+// False on a rest
+bool Arpeggiator::next_note(u32 &key, u32 &velocity) {
+  const size_t s = step++;
+  size_t index = 0;
+  switch (mode) {
+  default:
+  case ARP_UP: {
+    index = s % held_count;
+  } break;
+
+  case ARP_DOWN: {
+    index = held_count - 1 - s % held_count;
+  } break;
+
+  case ARP_UP_DOWN: {
+    // Ends aren't repeated, 3 keys go 0 1 2 1 0 1 2...
+    const size_t period = held_count > 1 ? 2 * held_count - 2 : 1;
+    const size_t pos = s % period;
+    index = pos < held_count ? pos : period - pos;
+  } break;
+
+  case ARP_PATTERN: {
+    if (pattern_len == 0) {
+      return false;
+    }
+    const Preset_Step &ps = pattern[s % pattern_len];
+    if (ps.velocity == 0) {
+      return false;
+    }
+    key = static_cast<u32>(
+        std::clamp<i32>(held_keys[0] + ps.offset, 0, MIDI_KEY_MAX));
+    velocity = ps.velocity;
+    return true;
+  }
+  }
+
+  key = held_keys[index];
+  velocity = held_velocity[index];
+  return true;
+}
+
+// Called at the top of every sub block, plays whatever is due on this sample
+void Arpeggiator::fire(Synth *syn) {
+  if (mode == ARP_OFF || held_count == 0) {
+    if (running) {
+      stop(syn);
+    }
+    return;
+  }
+  if (!running) {
+    running = true;
+    step = 0;
+    until_on = 0.0;
+    until_off = 0.0;
+  }
+
+  if (sounding >= 0 && until_off <= 0.0) {
+    syn->loop_voicings_off(static_cast<u32>(sounding));
+    sounding = -1;
+  }
+  if (until_on > 0.0) {
+    return;
+  }
+
+  // Full gate runs into the next step
+  if (sounding >= 0) {
+    syn->loop_voicings_off(static_cast<u32>(sounding));
+    sounding = -1;
+  }
+
+  // BPM is picked up per step so tempo changes land on the next note
+  const f32 bpm = syn->get_param_list()[S_BPM].value;
+  const double len = static_cast<double>(note_to_time(
+                         bpm, syn->get_note_duration(rate))) *
+                     static_cast<double>(syn->get_sample_rate());
+
+  u32 key = 0, velocity = 0;
+  if (next_note(key, velocity)) {
+    syn->loop_voicings_on(key, normalize_msg(velocity));
+    sounding = static_cast<i32>(key);
+  }
+  until_off = until_on + len * static_cast<double>(gate);
+  until_on += len;
+}
+
+size_t Arpeggiator::frames_until_event(size_t max) const {
+  if (!running) {
+    return max;
+  }
+  double next = until_on;
+  if (sounding >= 0 && until_off < next) {
+    next = until_off;
+  }
+  if (next <= 1.0) {
+    return 1;
+  }
+  const size_t frames = static_cast<size_t>(ceil(next));
+  return std::clamp<size_t>(frames, 1, max);
+}
+
+void Arpeggiator::advance(size_t frames) {
+  if (running) {
+    until_on -= static_cast<double>(frames);
+    until_off -= static_cast<double>(frames);
+  }
+}
@@ -1,307 +1,590 @@
-#include "../../inc/audio_sys.hpp"
-#include "../../inc/synth.hpp"
-
-// Wanna split this file up /clean it up at some point its kinda messy
-
-#include <cmath>
-#include <iostream>
-
-static bool stream_feed(SDL_AudioStream *stream, const f32 samples[], i32 len);
-static void generate_loop(Synth *syn, size_t count, f32 *sample_buffer);
-static void delay_loop(Synth *syn, size_t count, f32 *sample_buffer);
-static void voice_loop(Synth *syn);
-static void osc_loop(Synth *syn, const size_t &voice_iter, Voice &v,
-                     const f32 &vibrato);
-static f32 lfo_vibrato(Synth *syn, Voice &v);
-static f32 lfo_tremolo(Synth *syn, Voice &v);
-
-const i32 CHUNK_MAX = 128;
-const f32 DELAY_MIX = 0.2f;
-const f32 SAMPLE_MIX = 0.8f;
-
-void stream_get(void *data, SDL_AudioStream *stream, i32 add, i32 total) {
-  Synth *syn = static_cast<Synth *>(data);
-  if (!syn)
-    return;
-  // Additional is consumed immediately
-  (void)total;
-  size_t sample_count = (u32)add / sizeof(f32);
-  while (sample_count > 0) {
-    f32 samples[CHUNK_MAX];
-    memset(samples, 0, sizeof(f32) * CHUNK_MAX);
-    const size_t actual_samples = SDL_min(sample_count, SDL_arraysize(samples));
-    generate_loop(syn, actual_samples, samples);
-    delay_loop(syn, actual_samples, samples);
-    stream_feed(stream, samples, (i32)actual_samples * (i32)sizeof(f32));
-    sample_count -= actual_samples;
-  }
-  return;
-}
-
-static void delay_loop(Synth *syn, size_t count, f32 *sample_buffer) {
-  for (size_t i = 0; i < count; i++) {
-    f32 delayed = syn->get_delay().delay_read();
-    const f32 mixed = SAMPLE_MIX * sample_buffer[i] +
-                      DELAY_MIX * tanhf(sample_buffer[i] + delayed);
-    sample_buffer[i] = mixed;
-    syn->get_delay().delay_write(sample_buffer[i]);
-  }
-}
-
-static f32 lfo_vibrato(Synth *syn, Voice &v) {
-  Lfo &lfo_vibrato = v.get_vibrato_lfo();
-  const f32 &vibrato_rate = syn->get_vibrato_rate();
-  const f32 &depth = syn->get_vibrato_depth();
-  const i32 &sample_rate = syn->get_sample_rate();
-  lfo_vibrato.increment(vibrato_rate, sample_rate);
-  return create_vibrato(lfo_vibrato.lfo_sine(), depth);
-}
-
-static f32 lfo_tremolo(Synth *syn, Voice &v) {
-  Lfo &lfo_tremolo = v.get_trem_lfo();
-  const f32 &trem_rate = syn->get_trem_rate();
-  const f32 &depth = syn->get_param_list()[S_TREMOLO_DEPTH].value;
-  const i32 &sample_rate = syn->get_sample_rate();
-  lfo_tremolo.increment(trem_rate, sample_rate);
-  return 1.0f + (lfo_tremolo.lfo_sine() * depth);
-}
-
-static void osc_loop(Synth *syn, const size_t &voice_iter, Voice &v,
-                     const f32 &vibrato) {
-  for (size_t o = 0; o < syn->get_oscillators().size(); o++) {
-    Oscillator *osc = syn->get_osc_at(o);
-    if (!osc) {
-      continue;
-    }
-
-    const f32 freq =
-        v.get_freq() * osc->get_detune() * syn->get_pitch_bend() * vibrato;
-    const f32 dt = 1.0f / (f32)syn->get_sample_rate();
-    const f32 inc = freq / (f32)syn->get_sample_rate();
-
-    osc->increment_time_at(dt, voice_iter);
-    osc->increment_phase_at(inc, 1.0f, voice_iter);
-
-    for (size_t c = 0; c < (size_t)syn->get_channels(); c++) {
-      f32 sample = 0.0f;
-      switch (osc->get_waveform()) {
-      case SAW: {
-        sample =
-            syn->get_generator().poly_saw(inc, osc->get_phase_at(voice_iter));
-      } break;
-      case SQUARE: {
-        sample = syn->get_generator().poly_square(
-            inc, osc->get_phase_at(voice_iter), osc->get_duty());
-      } break;
-      }
-      osc->set_sample_at(osc->get_sample_array_at(voice_iter), c, sample);
-      v.add_sum_at(c,
-                   osc->get_sample_at(osc->get_sample_array_at(voice_iter), c));
-    }
-  }
-}
-
-static void voice_loop(Synth *syn) {
-  syn->zero_loop_sums();
-  const std::array<ParamF32, S_PARAM_COUNT> &param_list = syn->get_param_list();
-
-  for (size_t i = 0; i < VOICES; i++) {
-    Voice &v = syn->get_voices()[i];
-    if (v.get_active_count() <= 0 && !v.releasing()) {
-      continue;
-    }
-
-    v.zero_voice_sums();
-    const f32 trem = lfo_tremolo(syn, v);
-    const f32 vibrato = lfo_vibrato(syn, v);
-
-    osc_loop(syn, i, v, vibrato);
-    // saturate (make optional at some point)
-    for (size_t c = 0; c < (size_t)syn->get_channels(); c++) {
-      const f32 clipped =
-          syn->polynomial_soft_clip(v.get_sum_at(c), param_list[S_GAIN].value);
-      v.set_clipped_at(c, &clipped);
-    }
-    // filter
-    const f32 filter_alpha =
-        v.get_lpf().alpha(param_list[S_LOW_PASS].value, syn->get_sample_rate());
-    for (size_t c = 0; c < (size_t)syn->get_channels(); c++) {
-      lerp_f32(v.get_clipped_at(c), v.get_lpf().get_value_at(c), filter_alpha);
-      v.set_filtered_at(c, v.get_lpf().get_value_at(c));
-    }
-
-    const f32 &attack = param_list[S_ATTACK].value;
-    const f32 &decay = param_list[S_DECAY].value;
-    const f32 &sustain = param_list[S_SUSTAIN].value;
-    const f32 &release = param_list[S_RELEASE].value;
-
-    v.adsr(syn->get_dt(), attack, decay, sustain, release);
-
-    // Apply amplitude scalars and scale per OSC
-    for (size_t c = 0; c < (size_t)syn->get_channels(); c++) {
-      const f32 *sample = v.get_filtered_at(c);
-      if (!sample) {
-        continue;
-      }
-      const f32 mixed = *sample * trem * v.get_vol_mult() * v.get_envelope();
-      const f32 scaled =
-          mixed * (1.0f / sqrtf((f32)syn->get_oscillators().size()));
-      v.set_out_at(c, &scaled);
-    }
-
-    // Add scaled sum of osc and scale per VOICE
-    for (size_t c = 0; c < (size_t)syn->get_channels(); c++) {
-      const f32 *sample = v.get_out_at(c);
-      if (!sample) {
-        continue;
-      }
-      const f32 scaled =
-          (*sample / sqrtf((f32)VOICES)) * param_list[S_VOLUME].value;
-      syn->add_sum_at(c, &scaled);
-    }
-  }
-}
-
-static void generate_loop(Synth *syn, size_t count, f32 *sample_buffer) {
-  const size_t channels = static_cast<size_t>(syn->get_channels());
-  const size_t N = static_cast<size_t>(count / channels);
-  for (size_t n = 0; n < N; n++) {
-    voice_loop(syn);
-    for (size_t c = 0; c < channels; c++) {
-      sample_buffer[n * channels + c] = syn->get_sum_at(c);
-    }
-  }
-}
-
-static bool stream_feed(SDL_AudioStream *stream, const f32 samples[], i32 len) {
-  return SDL_PutAudioStreamData(stream, samples, len);
-}
-
-Audio_Sys::Audio_Sys(i32 chan, i32 sample_rate)
-    : dev(0), stream(NULL), internal({SDL_AUDIO_F32, chan, sample_rate}),
-      output({SDL_AUDIO_F32, 0, 0}) {}
-
-bool Audio_Sys::open(void *userdata) {
-  if (!(open_audio_device() && create_audio_stream())) {
-    return false;
-  }
-
-  if (!(set_audio_callback(userdata) && bind_stream())) {
-    return false;
-  }
-  return true;
-}
-
-void Audio_Sys::close(void) {
-  pause();
-  clear();
-  unbind_stream();
-  destroy_audio_stream();
-  close_audio_device();
-}
-
-void Audio_Sys::clear(void) {
-  if (!SDL_ClearAudioStream(stream)) {
-    std::cerr << "Failed to clear stream: " << SDL_GetError() << std::endl;
-  }
-}
-
-bool Audio_Sys::set_audio_callback(void *userdata) {
-  if (!SDL_SetAudioStreamGetCallback(stream, stream_get, userdata)) {
-    std::cerr << "Failed to set callback: " << SDL_GetError() << std::endl;
-    return false;
-  }
-  return true;
-}
-
-bool Audio_Sys::bind_stream(void) {
-  if (!(stream && dev)) {
-    std::cerr << "Invalid parameters" << std::endl;
-    return false;
-  }
-
-  if (!SDL_BindAudioStream(dev, stream)) {
-    std::cerr << SDL_GetError() << std::endl;
-    return false;
-  }
-
-  return true;
-}
-
-bool Audio_Sys::unbind_stream(void) {
-  if (!stream) {
-    std::cerr << "Invalid parameters" << std::endl;
-    return false;
-  }
-
-  SDL_UnbindAudioStream(stream);
-  return true;
-}
-
-bool Audio_Sys::open_audio_device(void) {
-  dev = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
-  if (!dev) {
-    std::cerr << SDL_GetError() << std::endl;
-    return false;
-  }
-  SDL_GetAudioDeviceFormat(dev, &output, NULL);
-  const char *name = SDL_GetAudioDeviceName(dev);
-  std::cout << "Device name: " << name << std::endl;
-  std::cout << "Channels: " << output.channels << " Samplerate: " << output.freq
-            << std::endl;
-  return true;
-}
-
-bool Audio_Sys::create_audio_stream(void) {
-  stream = SDL_CreateAudioStream(&internal, &output);
-  if (!stream) {
-    std::cerr << SDL_GetError() << std::endl;
-    return false;
-  }
-  return true;
-}
-
-bool Audio_Sys::close_audio_device(void) {
-  if (!dev) {
-    std::cerr << "Invalid parameter" << std::endl;
-    return false;
-  }
-  SDL_CloseAudioDevice(dev);
-  return true;
-}
-
-bool Audio_Sys::destroy_audio_stream(void) {
-  if (!stream) {
-    std::cerr << "Invalid parameter" << std::endl;
-    return false;
-  }
-  return true;
-}
-
-bool Audio_Sys::resume(void) {
-  if (!dev) {
-    std::cerr << "Invalid parameter" << std::endl;
-    return false;
-  }
-
-  if (!SDL_PauseAudioDevice(dev)) {
-    std::cerr << SDL_GetError() << std::endl;
-    return false;
-  }
-
-  return true;
-}
-
-bool Audio_Sys::pause(void) {
-  if (!dev) {
-    std::cerr << "Invalid parameter" << std::endl;
-    return false;
-  }
-
-  if (!SDL_ResumeAudioDevice(dev)) {
-    std::cerr << SDL_GetError() << std::endl;
-    return false;
-  }
-
-  return true;
-}
+#include "../../inc/audio_sys.hpp"
+#include "../../inc/capture.hpp"
+#include "../../inc/ensemble.hpp"
+#include "../../inc/note_cache.hpp"
+#include "../../inc/recorder.hpp"
+#include "../../inc/render_ahead.hpp"
+#include "../../inc/rt_thread.hpp"
+#include "../../inc/synth.hpp"
+#include "../../inc/trace.hpp"
+#include "../../inc/util.hpp"
+
+// Wanna split this file up /clean it up at some point its kinda messy
+
+#include <cmath>
+#include <iostream>
+
+static bool stream_feed(SDL_AudioStream *stream, const void *samples, i32 len);
+static void generate_loop(Synth *syn, size_t count, f32 *sample_buffer);
+static void voice_loop(Synth *syn, Node_Ctx &ctx, f32 *mix);
+
+void stream_get(void *data, SDL_AudioStream *stream, i32 add, i32 total) {
+  Audio_Sys *audio = static_cast<Audio_Sys *>(data);
+  if (!audio || !audio->get_synth() || add <= 0)
+    return;
+  // Additional is consumed immediately
+  (void)total;
+  TRACE_THREAD("audio");
+  rt_enter_thread("audio", RT_AUDIO);
+  TRACE_SCOPE_ARG("callback", add);
+  const u64 callback_ns = now_ns();
+  Synth *syn = audio->get_synth();
+  Render_Ahead *ahead = audio->get_render_ahead();
+  Recorder *recorder = audio->get_recorder();
+  f32 *buffer = audio->get_render_buffer();
+  const size_t channels = static_cast<size_t>(syn->get_channels());
+  const size_t frames_max = audio->get_render_capacity() / channels;
+  const size_t frame_size = audio->get_frame_size();
+
+  // Normally one pass, SDL only asks for more than the device period when
+  // the stream is starved
+  size_t frame_count = ((u32)add + frame_size - 1) / frame_size;
+  size_t rendered = 0;
+  while (frame_count > 0) {
+    const size_t frames = SDL_min(frame_count, frames_max);
+    const bool sounding = ahead ? ahead->pull(buffer, frames)
+                                : audio->render(buffer, frames);
+    audio->tap_block(buffer, frames);
+    if (recorder) {
+      recorder->block(buffer, frames, syn->get_sample_rate(),
+                      syn->get_channels());
+    }
+    if (sounding) {
+      audio->detect_onset(buffer, frames, rendered, callback_ns);
+    }
+    const void *samples = sounding ? audio->output_stage(buffer, frames)
+                                   : audio->silent_stage(buffer, frames);
+    {
+      TRACE_SCOPE("stream_feed");
+      stream_feed(stream, samples, (i32)(frames * frame_size));
+    }
+    frame_count -= frames;
+    rendered += frames;
+  }
+}
+
+bool Audio_Sys::render(f32 *out, size_t frames) {
+  return ensemble ? ensemble->render(out, frames)
+                  : render_block(syn, out, frames);
+}
+
+// False when the synth was silent and out was just zeroed
+bool render_block(Synth *syn, f32 *out, size_t frames) {
+  Session_Capture *capture = syn->get_capture();
+  if (capture) {
+    capture->block(frames, syn->get_sample_rate(), syn->get_channels());
+  }
+  {
+    TRACE_SCOPE("drain_events");
+    syn->drain_events();
+  }
+  syn->update_patch();
+  syn->serve_patch();
+  syn->begin_telemetry();
+  const size_t count = frames * static_cast<size_t>(syn->get_channels());
+  const bool silent = syn->is_silent();
+  if (silent) {
+    memset(out, 0, count * sizeof(f32));
+  } else {
+    TRACE_COUNT("voices", syn->get_sounding_voices());
+    TRACE_SCOPE_ARG("generate_loop", frames);
+    generate_loop(syn, count, out);
+  }
+  syn->publish_telemetry();
+  return !silent;
+}
+
+// Each sounding voice runs the program's voice chain and sums into the mix. A
+// released voice is retired once a whole block of it is under the threshold.
+// A cached note copies what it can and the chain picks up the rest
+static void voice_loop(Synth *syn, Node_Ctx &ctx, f32 *mix) {
+  Graph &graph = syn->get_active_program().voice_graph;
+  Note_Cache *cache = syn->get_note_cache();
+  f32 *voice_block = syn->get_voice_block().data();
+  const size_t count = ctx.frames * ctx.channels;
+  const f32 threshold = syn->get_silence_threshold();
+  for (size_t i = 0; i < VOICES; i++) {
+    Voice &v = syn->get_voices()[i];
+    if (v.get_active_count() <= 0 && !v.releasing()) {
+      continue;
+    }
+    ctx.voice = &v;
+    ctx.voice_iter = i;
+    TRACE_SCOPE_ARG("voice", i);
+    const u64 start = read_cycles();
+    size_t cached = 0;
+    if (cache && cache->playing(i)) {
+      cached = cache->play(*syn, i, voice_block, ctx.frames);
+    }
+    if (cached < ctx.frames) {
+      Node_Ctx live = ctx;
+      live.frames = ctx.frames - cached;
+      graph.run(live, nullptr, voice_block + cached * ctx.channels);
+    }
+    syn->add_voice_cycles(i, read_cycles() - start);
+    f32 peak = 0.0f;
+    for (size_t s = 0; s < count; s++) {
+      mix[s] += voice_block[s];
+      peak = SDL_max(peak, fabsf(voice_block[s]));
+    }
+    if (v.releasing() && peak < threshold) {
+      v.retire();
+    }
+  }
+  ctx.voice = nullptr;
+}
+
+// A block at a time, voices into the mix then the master chain into the output.
+// Blocks are cut short at arp events so notes start on their exact sample
+static void generate_loop(Synth *syn, size_t count, f32 *sample_buffer) {
+  const size_t channels = static_cast<size_t>(syn->get_channels());
+  const size_t N = static_cast<size_t>(count / channels);
+  f32 *mix = syn->get_mix_block().data();
+  Arpeggiator &arp = syn->get_arp();
+  for (size_t n = 0; n < N;) {
+    arp.fire(syn);
+    const size_t frames = arp.frames_until_event(
+        SDL_min(static_cast<size_t>(BLOCK_FRAMES), N - n));
+    Node_Ctx ctx = {syn, nullptr, 0, frames, channels};
+    memset(mix, 0, frames * channels * sizeof(f32));
+    voice_loop(syn, ctx, mix);
+
+    for (size_t f = 0; f < frames; f++) {
+      const f32 fade = syn->next_fade_gain();
+      for (size_t c = 0; c < channels; c++) {
+        mix[f * channels + c] *= fade;
+      }
+    }
+    // Fetched after the fade, the program can swap at the bottom of it
+    {
+      TRACE_SCOPE("master");
+      syn->get_active_program().master_graph.run(ctx, mix,
+                                                 sample_buffer + n * channels);
+    }
+    arp.advance(frames);
+    n += frames;
+  }
+}
+
+// Downmixed to mono a block at a time on the stack
+void Audio_Sys::tap_block(const f32 *samples, size_t frames) {
+  if (!tap_enabled.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // What was rendered, the device layout only exists after output_stage
+  const size_t channels = static_cast<size_t>(syn->get_channels());
+  const f32 norm = 1.0f / static_cast<f32>(channels);
+  std::array<f32, BLOCK_FRAMES> mono;
+  for (size_t n = 0; n < frames; n += BLOCK_FRAMES) {
+    const size_t count = SDL_min(static_cast<size_t>(BLOCK_FRAMES), frames - n);
+    for (size_t f = 0; f < count; f++) {
+      f32 sum = 0.0f;
+      for (size_t c = 0; c < channels; c++) {
+        sum += samples[(n + f) * channels + c];
+      }
+      mono[f] = sum * norm;
+    }
+    const size_t written = tap.push_n(mono.data(), count);
+    if (written < count) {
+      tap_dropped.fetch_add(count - written, std::memory_order_relaxed);
+    }
+  }
+}
+
+void Audio_Sys::arm_onset(f32 threshold) {
+  onset_threshold = threshold;
+  onset_ns.store(0, std::memory_order_relaxed);
+  onset_armed.store(true, std::memory_order_release);
+}
+
+bool Audio_Sys::get_onset(u64 &ns) const {
+  if (onset_armed.load(std::memory_order_acquire)) {
+    return false;
+  }
+  ns = onset_ns.load(std::memory_order_relaxed);
+  return ns != 0;
+}
+
+void Audio_Sys::detect_onset(const f32 *samples, size_t frames, size_t offset,
+                             u64 callback_ns) {
+  if (!onset_armed.load(std::memory_order_acquire)) {
+    return;
+  }
+  const size_t channels = static_cast<size_t>(syn->get_channels());
+  for (size_t n = 0; n < frames; n++) {
+    for (size_t c = 0; c < channels; c++) {
+      if (fabsf(samples[n * channels + c]) >= onset_threshold) {
+        const u64 due = (u64)(offset + n) * 1000000000ull /
+                        static_cast<u64>(internal.freq);
+        onset_ns.store(callback_ns + due, std::memory_order_relaxed);
+        onset_armed.store(false, std::memory_order_release);
+        return;
+      }
+    }
+  }
+}
+
+static bool stream_feed(SDL_AudioStream *stream, const void *samples, i32 len) {
+  return SDL_PutAudioStreamData(stream, samples, len);
+}
+
+Audio_Sys::Audio_Sys(i32 chan, i32 sample_rate, i32 _device_frames)
+    : dev(0), stream(NULL), internal({SDL_AUDIO_F32, chan, sample_rate}),
+      output({SDL_AUDIO_F32, 0, 0}), requested_frames(_device_frames),
+      device_frames(0), syn(nullptr), ensemble(nullptr), recorder(nullptr),
+      ahead(nullptr), render_buffer(nullptr), render_capacity(0), expand_buffer(nullptr),
+      convert_buffer(nullptr), dither(0x5EED), tap(), tap_enabled(false),
+      tap_dropped(0), onset_armed(false), onset_ns(0), onset_threshold(1.0f) {}
+
+Audio_Sys::~Audio_Sys(void) {
+  free_render_buffer();
+  free_output_buffers();
+}
+
+bool Audio_Sys::open(Synth *_syn) {
+  syn = _syn;
+  if (!allocate_render_buffer()) {
+    return false;
+  }
+
+  request_device_frames();
+  if (!open_audio_device()) {
+    return false;
+  }
+
+  adopt_device_format();
+  if (!(allocate_output_buffers() && create_audio_stream())) {
+    return false;
+  }
+
+  // Filling before the callback is set, so the first one has blocks waiting
+  start_render_ahead();
+  if (!(set_audio_callback() && bind_stream())) {
+    return false;
+  }
+  return true;
+}
+
+void Audio_Sys::close(void) {
+  pause();
+  clear();
+  unbind_stream();
+  if (ahead) {
+    ahead->stop();
+  }
+  destroy_audio_stream();
+  close_audio_device();
+  free_render_buffer();
+  free_output_buffers();
+}
+
+// Render at whatever the device runs at so SDL never has to resample or
+// convert, if the synth can't run at that rate SDL does it like before
+void Audio_Sys::adopt_device_format(void) {
+  const bool adopted = syn->set_output_format(output.freq, output.channels);
+  if (ensemble) {
+    ensemble->match_format();
+  }
+  if (!adopted) {
+    std::cerr << "Device rate " << output.freq << " is above "
+              << syn->get_sample_rate_max() << ", SDL will resample"
+              << std::endl;
+    internal = {SDL_AUDIO_F32, syn->get_channels(), syn->get_sample_rate()};
+    return;
+  }
+
+  switch (output.format) {
+  default: {
+    internal.format = SDL_AUDIO_F32;
+  } break;
+  case SDL_AUDIO_S16:
+  case SDL_AUDIO_S32:
+  case SDL_AUDIO_F32: {
+    internal.format = output.format;
+  } break;
+  }
+  internal.channels = output.channels;
+  internal.freq = output.freq;
+}
+
+// A block per device period, falls back to rendering in the callback if
+// the thread won't start
+void Audio_Sys::start_render_ahead(void) {
+  if (!ahead) {
+    return;
+  }
+  const size_t frames = device_frames > 0
+                            ? static_cast<size_t>(device_frames)
+                            : static_cast<size_t>(AHEAD_BLOCK_FRAMES);
+  if (!ahead->start(this, frames, static_cast<size_t>(syn->get_channels()))) {
+    std::cerr << "Failed to start render ahead, rendering in the callback"
+              << std::endl;
+    ahead = nullptr;
+  }
+}
+
+// As many frames as stream_get renders in one go, which is more than
+// RENDER_FRAMES_MAX when the synth renders fewer than CHANNEL_MAX channels
+bool Audio_Sys::allocate_output_buffers(void) {
+  free_output_buffers();
+  const size_t frames_max =
+      render_capacity / static_cast<size_t>(syn->get_channels());
+  const size_t bytes =
+      frames_max * static_cast<size_t>(internal.channels) * sizeof(f32);
+  expand_buffer = static_cast<f32 *>(SDL_aligned_alloc(SIMD_ALIGN, bytes));
+  convert_buffer = SDL_aligned_alloc(SIMD_ALIGN, bytes);
+  if (!(expand_buffer && convert_buffer)) {
+    std::cerr << "Failed to allocate output buffers: " << SDL_GetError()
+              << std::endl;
+    free_output_buffers();
+    return false;
+  }
+  // Faulted in now rather than by the first callback
+  memset(expand_buffer, 0, bytes);
+  memset(convert_buffer, 0, bytes);
+  return true;
+}
+
+void Audio_Sys::free_output_buffers(void) {
+  if (expand_buffer) {
+    SDL_aligned_free(expand_buffer);
+  }
+  if (convert_buffer) {
+    SDL_aligned_free(convert_buffer);
+  }
+  expand_buffer = nullptr;
+  convert_buffer = nullptr;
+}
+
+// Zero is all bits clear in every output format, so silence skips the
+// conversion. Dither still runs so the noise floor doesn't drop out
+const void *Audio_Sys::silent_stage(const f32 *zeros, size_t frames) {
+  if (dither.get_active_state()) {
+    return output_stage(zeros, frames);
+  }
+  memset(convert_buffer, 0, frames * get_frame_size());
+  return convert_buffer;
+}
+
+// Only touches the samples when the device layout differs from the render
+const void *Audio_Sys::output_stage(const f32 *samples, size_t frames) {
+  const size_t render_chan = static_cast<size_t>(syn->get_channels());
+  const size_t out_chan = static_cast<size_t>(internal.channels);
+  const f32 *src = samples;
+  if (out_chan != render_chan) {
+    expand_channels(samples, expand_buffer, frames, render_chan, out_chan);
+    src = expand_buffer;
+  }
+
+  const size_t count = frames * out_chan;
+  switch (internal.format) {
+  default:
+    return src;
+  case SDL_AUDIO_S16: {
+    convert_f32_to_s16(src, static_cast<i16 *>(convert_buffer), count, dither);
+  } break;
+  case SDL_AUDIO_S32: {
+    convert_f32_to_s32(src, static_cast<i32 *>(convert_buffer), count);
+  } break;
+  }
+  return convert_buffer;
+}
+
+// Device format changed under us, the stream lock keeps the callback out
+// while the rate dependent state is rebuilt
+bool Audio_Sys::reconfigure(void) {
+  if (!(dev && stream)) {
+    std::cerr << "Invalid parameters" << std::endl;
+    return false;
+  }
+
+  if (!SDL_LockAudioStream(stream)) {
+    std::cerr << "Failed to lock stream: " << SDL_GetError() << std::endl;
+    return false;
+  }
+
+  // The producer renders on the synth being changed
+  if (ahead) {
+    ahead->stop();
+  }
+  SDL_GetAudioDeviceFormat(dev, &output, &device_frames);
+  adopt_device_format();
+  bool ok = allocate_output_buffers();
+  if (ok && !SDL_SetAudioStreamFormat(stream, &internal, NULL)) {
+    std::cerr << "Failed to set stream format: " << SDL_GetError()
+              << std::endl;
+    ok = false;
+  }
+  start_render_ahead();
+  SDL_UnlockAudioStream(stream);
+
+  std::cout << "Device format changed, Channels: " << output.channels
+            << " Samplerate: " << output.freq << std::endl;
+  return ok;
+}
+
+bool Audio_Sys::allocate_render_buffer(void) {
+  free_render_buffer();
+  const size_t capacity = RENDER_FRAMES_MAX * CHANNEL_MAX;
+  void *tmp = SDL_aligned_alloc(SIMD_ALIGN, capacity * sizeof(f32));
+  if (!tmp) {
+    std::cerr << "Failed to allocate render buffer: " << SDL_GetError()
+              << std::endl;
+    return false;
+  }
+  render_buffer = static_cast<f32 *>(tmp);
+  render_capacity = capacity;
+  memset(render_buffer, 0, capacity * sizeof(f32));
+  return true;
+}
+
+void Audio_Sys::free_render_buffer(void) {
+  if (render_buffer) {
+    SDL_aligned_free(render_buffer);
+  }
+  render_buffer = nullptr;
+  render_capacity = 0;
+}
+
+// Has to be set before the device is opened, 0 leaves it up to SDL
+void Audio_Sys::request_device_frames(void) {
+  if (requested_frames <= 0) {
+    return;
+  }
+  const std::string frames = std::to_string(requested_frames);
+  if (!SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES, frames.c_str())) {
+    std::cerr << "Failed to request device frames: " << SDL_GetError()
+              << std::endl;
+  }
+}
+
+// Device period plus whatever is still sitting in the stream, and the
+// render ahead queue when there is one
+f32 Audio_Sys::get_latency_ms(void) const {
+  if (!(stream && output.freq > 0)) {
+    return 0.0f;
+  }
+  const i32 queued = SDL_GetAudioStreamQueued(stream);
+  const i32 frame_size =
+      static_cast<i32>(SDL_AUDIO_BYTESIZE(internal.format)) * internal.channels;
+  i32 queued_frames = queued > 0 ? queued / frame_size : 0;
+  if (ahead) {
+    queued_frames += static_cast<i32>(ahead->get_depth() *
+                                      ahead->get_block_frames());
+  }
+  return static_cast<f32>(device_frames + queued_frames) * 1000.0f /
+         static_cast<f32>(output.freq);
+}
+
+void Audio_Sys::clear(void) {
+  if (!SDL_ClearAudioStream(stream)) {
+    std::cerr << "Failed to clear stream: " << SDL_GetError() << std::endl;
+  }
+}
+
+bool Audio_Sys::set_audio_callback(void) {
+  if (!SDL_SetAudioStreamGetCallback(stream, stream_get, this)) {
+    std::cerr << "Failed to set callback: " << SDL_GetError() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Audio_Sys::bind_stream(void) {
+  if (!(stream && dev)) {
+    std::cerr << "Invalid parameters" << std::endl;
+    return false;
+  }
+
+  if (!SDL_BindAudioStream(dev, stream)) {
+    std::cerr << SDL_GetError() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool Audio_Sys::unbind_stream(void) {
+  if (!stream) {
+    std::cerr << "Invalid parameters" << std::endl;
+    return false;
+  }
+
+  SDL_UnbindAudioStream(stream);
+  return true;
+}
+
+bool Audio_Sys::open_audio_device(void) {
+  dev = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
+  if (!dev) {
+    std::cerr << SDL_GetError() << std::endl;
+    return false;
+  }
+  SDL_GetAudioDeviceFormat(dev, &output, &device_frames);
+  const char *name = SDL_GetAudioDeviceName(dev);
+  std::cout << "Device name: " << name << std::endl;
+  std::cout << "Channels: " << output.channels << " Samplerate: " << output.freq
+            << std::endl;
+  std::cout << "Device frames: " << device_frames
+            << " (requested: " << requested_frames << ") Latency: "
+            << static_cast<f32>(device_frames) * 1000.0f /
+                   static_cast<f32>(output.freq)
+            << "ms" << std::endl;
+  return true;
+}
+
+bool Audio_Sys::create_audio_stream(void) {
+  stream = SDL_CreateAudioStream(&internal, &output);
+  if (!stream) {
+    std::cerr << SDL_GetError() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Audio_Sys::close_audio_device(void) {
+  if (!dev) {
+    std::cerr << "Invalid parameter" << std::endl;
+    return false;
+  }
+  SDL_CloseAudioDevice(dev);
+  return true;
+}
+
+bool Audio_Sys::destroy_audio_stream(void) {
+  if (!stream) {
+    std::cerr << "Invalid parameter" << std::endl;
+    return false;
+  }
+  SDL_DestroyAudioStream(stream);
+  stream = NULL;
+  return true;
+}
+
+bool Audio_Sys::resume(void) {
+  if (!dev) {
+    std::cerr << "Invalid parameter" << std::endl;
+    return false;
+  }
+
+  if (!SDL_PauseAudioDevice(dev)) {
+    std::cerr << SDL_GetError() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool Audio_Sys::pause(void) {
+  if (!dev) {
+    std::cerr << "Invalid parameter" << std::endl;
+    return false;
+  }
+
+  if (!SDL_ResumeAudioDevice(dev)) {
+    std::cerr << SDL_GetError() << std::endl;
+    return false;
+  }
+
+  return true;
+}
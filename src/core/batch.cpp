@@ -0,0 +1,255 @@
+#include "../../inc/batch.hpp"
+#include "../../inc/audio_sys.hpp"
+#include "../../inc/rt_thread.hpp"
+#include "../../inc/synth.hpp"
+#include "../../inc/util.hpp"
+#include "../../inc/wav.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+const u32 BATCH_ROUND_ROBIN_MAX = 64;
+const size_t BATCH_NAME_MAX = 48;
+
+struct Batch_Job {
+  u32 key;
+  u32 velocity;
+  u32 round_robin;
+};
+
+struct Batch_Result {
+  bool ok;
+  size_t frames;
+  u32 sample_rate;
+  f32 peak;
+  char file[BATCH_NAME_MAX];
+};
+
+static bool parse_u32(const char *&at, u32 &value) {
+  char *end = nullptr;
+  const unsigned long parsed = strtoul(at, &end, 10);
+  if (end == at || parsed > 0xFFFF) {
+    return false;
+  }
+  value = static_cast<u32>(parsed);
+  at = end;
+  return true;
+}
+
+bool parse_batch_list(const char *arg, std::vector<u32> &out) {
+  out.clear();
+  const char *at = arg;
+  u32 first = 0, last = 0, step = 1;
+  if (!parse_u32(at, first)) {
+    return false;
+  }
+  if (*at == '-') {
+    at++;
+    if (!parse_u32(at, last) || last < first) {
+      return false;
+    }
+    if (*at == ':') {
+      at++;
+      if (!parse_u32(at, step) || step == 0) {
+        return false;
+      }
+    }
+    for (u32 v = first; v <= last; v += step) {
+      out.push_back(v);
+    }
+    return *at == '\0';
+  }
+
+  out.push_back(first);
+  while (*at == ',') {
+    at++;
+    u32 value = 0;
+    if (!parse_u32(at, value)) {
+      return false;
+    }
+    out.push_back(value);
+  }
+  return *at == '\0';
+}
+
+// The same path a live note takes, cut into blocks so the release lands on
+// its frame and the tail can stop as soon as the synth goes quiet
+static bool render_note(const Preset &preset, const Batch_Grid &grid,
+                        const Batch_Job &job, std::vector<f32> &out,
+                        u32 &channels, u32 &sample_rate) {
+  Synth syn;
+  syn.set_seed(BATCH_SEED + job.round_robin);
+  syn.set_silence_db(grid.trim_db);
+  if (!syn.set_patch(preset)) {
+    return false;
+  }
+  channels = static_cast<u32>(syn.get_channels());
+  sample_rate = static_cast<u32>(syn.get_sample_rate());
+  const size_t hold = static_cast<size_t>(grid.hold_s * (f32)sample_rate);
+  const size_t tail = static_cast<size_t>(grid.tail_s * (f32)sample_rate);
+  out.clear();
+  out.reserve((hold + tail) * channels);
+
+  std::vector<Keyboard_Command> commands = {
+      {Keyboard_Command::note_on,
+       Midi_Input_Msg(NOTE_ON, job.key, job.velocity)}};
+  syn.queue_events(commands);
+  size_t pos = 0;
+  while (pos < hold) {
+    const size_t chunk = std::min<size_t>(BATCH_BLOCK, hold - pos);
+    out.resize((pos + chunk) * channels);
+    render_block(&syn, out.data() + pos * channels, chunk);
+    pos += chunk;
+  }
+
+  commands = {{Keyboard_Command::note_off,
+               Midi_Input_Msg(NOTE_OFF, job.key, 0)}};
+  syn.queue_events(commands);
+  while (pos < hold + tail) {
+    const size_t chunk = std::min<size_t>(BATCH_BLOCK, hold + tail - pos);
+    out.resize((pos + chunk) * channels);
+    if (!render_block(&syn, out.data() + pos * channels, chunk)) {
+      out.resize(pos * channels);
+      break;
+    }
+    pos += chunk;
+  }
+  return true;
+}
+
+// Drops everything after the last sample at or over the threshold
+static size_t trim_tail(const std::vector<f32> &samples, u32 channels,
+                        f32 threshold, f32 &peak) {
+  peak = 0.0f;
+  size_t last = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    const f32 level = fabsf(samples[i]);
+    peak = std::max(peak, level);
+    if (level >= threshold) {
+      last = i / channels + 1;
+    }
+  }
+  return last;
+}
+
+static void run_jobs(const Preset &preset, const Batch_Grid &grid,
+                     const std::string &dir, const std::vector<Batch_Job> &jobs,
+                     std::vector<Batch_Result> &results,
+                     std::atomic<size_t> &next) {
+  rt_denormals_off();
+  const f32 threshold = powf(10.0f, grid.trim_db / 20.0f);
+  std::vector<f32> samples;
+  for (size_t i = next.fetch_add(1); i < jobs.size(); i = next.fetch_add(1)) {
+    const Batch_Job &job = jobs[i];
+    Batch_Result &result = results[i];
+    snprintf(result.file, sizeof(result.file), "k%03u_v%03u_rr%u.wav", job.key,
+             job.velocity, job.round_robin + 1);
+    u32 channels = 0;
+    if (!render_note(preset, grid, job, samples, channels,
+                     result.sample_rate)) {
+      continue;
+    }
+    result.frames = trim_tail(samples, channels, threshold, result.peak);
+    result.ok = write_wav(dir + "/" + result.file, samples.data(),
+                          result.frames, channels, result.sample_rate,
+                          grid.bits);
+  }
+}
+
+static bool write_manifest(const std::string &path, const Preset &preset,
+                           const std::vector<Batch_Job> &jobs,
+                           const std::vector<Batch_Result> &results) {
+  std::ofstream out(path, std::ios::out | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Failed to open manifest for writing: " << path << std::endl;
+    return false;
+  }
+  char name[sizeof(preset.name) + 1];
+  memcpy(name, preset.name, sizeof(preset.name));
+  name[sizeof(preset.name)] = '\0';
+  out << "# " << name << "\n";
+  out << "file,key,velocity,round_robin,sample_rate,frames,seconds,peak_db\n";
+  for (size_t i = 0; i < jobs.size(); i++) {
+    const Batch_Result &r = results[i];
+    if (!r.ok) {
+      continue;
+    }
+    char row[160];
+    snprintf(row, sizeof(row), "%s,%u,%u,%u,%u,%zu,%.4f,%.2f\n", r.file,
+             jobs[i].key, jobs[i].velocity, jobs[i].round_robin + 1,
+             r.sample_rate, r.frames, (double)r.frames / (double)r.sample_rate,
+             r.peak > 0.0f ? 20.0 * log10((double)r.peak) : -999.0);
+    out << row;
+  }
+  if (!out.good()) {
+    std::cerr << "Failed to write manifest: " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool batch_render(const Preset &preset, const Batch_Grid &grid,
+                  const std::string &dir, size_t threads) {
+  if (grid.keys.empty() || grid.velocities.empty() || grid.round_robins == 0 ||
+      grid.round_robins > BATCH_ROUND_ROBIN_MAX || grid.hold_s <= 0.0f ||
+      grid.tail_s < 0.0f || !wav_bits_valid(grid.bits)) {
+    std::cerr << "Batch grid is empty or out of range" << std::endl;
+    return false;
+  }
+
+  std::vector<Batch_Job> jobs;
+  for (size_t k = 0; k < grid.keys.size(); k++) {
+    for (size_t v = 0; v < grid.velocities.size(); v++) {
+      for (u32 r = 0; r < grid.round_robins; r++) {
+        jobs.push_back({std::min<u32>(grid.keys[k], 127),
+                        std::clamp<u32>(grid.velocities[v], 1, 127), r});
+      }
+    }
+  }
+  std::vector<Batch_Result> results(jobs.size());
+  // One note per file, the arp would turn it into a run
+  Preset patch = preset;
+  patch.arp_mode = ARP_OFF;
+
+  if (threads == 0) {
+    threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+  threads = std::min(threads, jobs.size());
+  std::atomic<size_t> next(0);
+  const u64 start = now_ns();
+  std::vector<std::thread> pool;
+  for (size_t t = 1; t < threads; t++) {
+    pool.emplace_back(run_jobs, std::cref(patch), std::cref(grid),
+                      std::cref(dir), std::cref(jobs), std::ref(results),
+                      std::ref(next));
+  }
+  run_jobs(patch, grid, dir, jobs, results, next);
+  for (size_t t = 0; t < pool.size(); t++) {
+    pool[t].join();
+  }
+  const f32 took = (f32)(now_ns() - start) / 1e9f;
+
+  size_t written = 0;
+  f32 audio_s = 0.0f;
+  for (size_t i = 0; i < results.size(); i++) {
+    if (results[i].ok) {
+      written++;
+      audio_s += (f32)results[i].frames / (f32)results[i].sample_rate;
+    }
+  }
+  const bool listed =
+      write_manifest(dir + "/manifest.csv", preset, jobs, results);
+  std::cout << "Rendered " << written << "/" << jobs.size() << " notes, "
+            << audio_s << "s of audio in " << took << "s on " << threads
+            << " threads (" << (took > 0.0f ? audio_s / took : 0.0f)
+            << "x realtime)" << std::endl;
+  return listed && written == jobs.size();
+}
@@ -0,0 +1,269 @@
+#include "../../inc/capture.hpp"
+#include "../../inc/audio_sys.hpp"
+#include "../../inc/util.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+const std::chrono::milliseconds CAPTURE_PERIOD(5);
+
+Session_Capture::Session_Capture(void)
+    : records(), patches(), file(), dropped(0), running(false), writer(),
+      blocks(0), position(0), fade_block(0), start_ns(0), last_rate(0),
+      last_channels(0) {}
+
+Session_Capture::~Session_Capture(void) { close(); }
+
+bool Session_Capture::open(const std::string &path, u32 seed, i32 sample_rate,
+                           i32 channels, f32 silence_db, u32 flags) {
+  if (running.load()) {
+    return false;
+  }
+  file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open capture for writing: " << path << std::endl;
+    return false;
+  }
+  Capture_Header header = {CAPTURE_MAGIC, CAPTURE_VERSION, seed, sample_rate,
+                           channels,      silence_db,      flags, 0};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  if (!file.good()) {
+    std::cerr << "Failed to write capture: " << path << std::endl;
+    file.close();
+    return false;
+  }
+
+  blocks = 0;
+  position = 0;
+  fade_block = 0;
+  start_ns = now_ns();
+  last_rate = sample_rate;
+  last_channels = channels;
+  dropped.store(0);
+  running.store(true);
+  writer = std::thread(&Session_Capture::write_loop, this);
+  return true;
+}
+
+void Session_Capture::close(void) {
+  if (!running.exchange(false)) {
+    return;
+  }
+  if (writer.joinable()) {
+    writer.join();
+  }
+  // Whatever the last round missed, then the trailer
+  flush();
+  const Capture_Record end = {CAP_END, 0, 0, 0, 0, dropped.load()};
+  file.write(reinterpret_cast<const char *>(&end), sizeof(end));
+  file.close();
+  if (dropped.load() > 0) {
+    std::cerr << "Capture dropped " << dropped.load()
+              << " records, it won't replay past the first" << std::endl;
+  }
+}
+
+void Session_Capture::push(const Capture_Record &record) {
+  if (dropped.load(std::memory_order_relaxed) > 0 || !records.push(record)) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// Top of render_block, before the queue drains
+void Session_Capture::block(size_t frames, i32 sample_rate, i32 channels) {
+  if (sample_rate != last_rate || channels != last_channels) {
+    push({CAP_FORMAT, static_cast<u8>(channels), 0, 0,
+          static_cast<u32>(sample_rate), blocks});
+    last_rate = sample_rate;
+    last_channels = channels;
+  }
+  push({CAP_BLOCK, 0, 0, 0, static_cast<u32>(frames), now_ns() - start_ns});
+  blocks++;
+  position += frames;
+}
+
+void Session_Capture::command(const Keyboard_Command &command) {
+  push({CAP_COMMAND, static_cast<u8>(command.type),
+        static_cast<u8>(command.input.msg1), static_cast<u8>(command.input.msg2),
+        command.input.status, position});
+}
+
+// The pending program is only readable once it swaps in, so remember when
+// the fade started and log the patch itself at the swap
+void Session_Capture::patch_pending(void) { fade_block = blocks - 1; }
+
+void Session_Capture::patch(const Preset &preset) {
+  if (dropped.load(std::memory_order_relaxed) > 0 || !patches.push(preset)) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  push({CAP_PATCH, 0, 0, 0, 0, fade_block});
+}
+
+void Session_Capture::write_loop(void) {
+  while (running.load(std::memory_order_relaxed)) {
+    flush();
+    std::this_thread::sleep_for(CAPTURE_PERIOD);
+  }
+}
+
+void Session_Capture::flush(void) {
+  Capture_Record record;
+  while (records.pop(record)) {
+    file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    if (record.type == CAP_PATCH) {
+      // Pushed ahead of its record, so it's always there
+      Preset preset;
+      patches.pop(preset);
+      file.write(reinterpret_cast<const char *>(&preset), sizeof(preset));
+    }
+  }
+}
+
+struct Replay_Patch {
+  u64 block;
+  Preset preset;
+};
+
+static bool read_capture(const std::string &path, Capture_Header &header,
+                         std::vector<Capture_Record> &log,
+                         std::vector<Replay_Patch> &patches) {
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    std::cerr << "Missing capture: " << path << std::endl;
+    return false;
+  }
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!in.good() || header.magic != CAPTURE_MAGIC ||
+      header.version != CAPTURE_VERSION) {
+    std::cerr << "Not a capture: " << path << std::endl;
+    return false;
+  }
+
+  Capture_Record record;
+  while (in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+    if (record.type == CAP_END) {
+      if (record.stamp > 0) {
+        std::cerr << "Capture dropped " << record.stamp
+                  << " records, replaying what came before" << std::endl;
+      }
+      return true;
+    }
+    if (record.type == CAP_PATCH) {
+      Replay_Patch patch;
+      patch.block = record.stamp;
+      if (!in.read(reinterpret_cast<char *>(&patch.preset),
+                   sizeof(patch.preset))) {
+        break;
+      }
+      patches.push_back(patch);
+      continue;
+    }
+    log.push_back(record);
+  }
+  // No trailer, the session crashed or is still running
+  std::cerr << "Capture is truncated, replaying what's there" << std::endl;
+  return true;
+}
+
+bool replay_session(const std::string &path, const char *out_path) {
+  Capture_Header header;
+  std::vector<Capture_Record> log;
+  std::vector<Replay_Patch> patches;
+  if (!read_capture(path, header, log, patches)) {
+    return false;
+  }
+
+  Synth syn;
+  syn.set_seed(header.seed);
+  syn.set_silence_db(header.silence_db);
+  syn.set_fixed_phase((header.flags & CAPTURE_FIXED_PHASE) != 0);
+  if (!syn.set_output_format(header.sample_rate, header.channels)) {
+    std::cerr << "Capture has an unusable format" << std::endl;
+    return false;
+  }
+
+  std::ofstream out;
+  if (out_path) {
+    out.open(out_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      std::cerr << "Failed to open replay output: " << out_path << std::endl;
+      return false;
+    }
+  }
+
+  std::vector<f32> buffer;
+  std::vector<Keyboard_Command> due;
+  size_t next_patch = 0;
+  u64 block = 0, frames_total = 0, render_ns = 0;
+  u64 worst_ns = 0, worst_block = 0, late_blocks = 0;
+  u64 last_stamp = 0, worst_gap = 0, worst_gap_block = 0;
+  for (size_t i = 0; i < log.size(); i++) {
+    const Capture_Record &rec = log[i];
+    if (rec.type == CAP_FORMAT) {
+      syn.set_output_format(static_cast<i32>(rec.value), rec.kind);
+      continue;
+    }
+    if (rec.type != CAP_BLOCK) {
+      continue;
+    }
+
+    // Commands logged after a block were drained at its top
+    due.clear();
+    for (size_t c = i + 1; c < log.size() && log[c].type == CAP_COMMAND; c++) {
+      const Capture_Record &cmd = log[c];
+      due.push_back({static_cast<Keyboard_Command::Type>(cmd.kind),
+                     Midi_Input_Msg(cmd.value, cmd.data1, cmd.data2)});
+    }
+    syn.queue_events(due);
+    // Published just ahead of the block that saw it pending
+    while (next_patch < patches.size() && patches[next_patch].block <= block) {
+      syn.publish_patch(patches[next_patch++].preset);
+    }
+
+    const size_t frames = rec.value;
+    const size_t channels = static_cast<size_t>(syn.get_channels());
+    buffer.resize(frames * channels);
+    const u64 start = now_ns();
+    render_block(&syn, buffer.data(), frames);
+    const u64 took = now_ns() - start;
+
+    const u64 budget =
+        frames * 1000000000ull / static_cast<u64>(syn.get_sample_rate());
+    render_ns += took;
+    late_blocks += took > budget ? 1 : 0;
+    if (took > worst_ns) {
+      worst_ns = took;
+      worst_block = block;
+    }
+    // Live callbacks further apart than a period are where it glitched
+    if (block > 0 && rec.stamp - last_stamp > worst_gap) {
+      worst_gap = rec.stamp - last_stamp;
+      worst_gap_block = block;
+    }
+    last_stamp = rec.stamp;
+
+    if (out.is_open()) {
+      out.write(reinterpret_cast<const char *>(buffer.data()),
+                static_cast<std::streamsize>(buffer.size() * sizeof(f32)));
+    }
+    frames_total += frames;
+    block++;
+  }
+
+  if (block == 0) {
+    std::cerr << "Capture has no blocks" << std::endl;
+    return false;
+  }
+  std::cout << "Replayed " << block << " blocks, "
+            << (f32)frames_total / (f32)syn.get_sample_rate() << "s of audio in "
+            << (f32)render_ns / 1e6f << "ms" << std::endl;
+  std::cout << "Mean block " << (f32)render_ns / (f32)block / 1e3f
+            << "us, worst " << (f32)worst_ns / 1e3f << "us at block "
+            << worst_block << ", " << late_blocks << " over budget"
+            << std::endl;
+  std::cout << "Widest live callback gap " << (f32)worst_gap / 1e3f
+            << "us before block " << worst_gap_block << std::endl;
+  return true;
+}
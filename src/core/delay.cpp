@@ -1,25 +1,64 @@
-#include "../../inc/Synth.hpp"
-
-Delay::Delay(i32 sample_rate, f32 delay_time_s, f32 _feedback)
-    : buffer((size_t)((f32)sample_rate * delay_time_s), 0.0f), read(0),
-      write(0), start(0), end(buffer.size()), feedback(_feedback) {}
-
-void Delay::delay_write(f32 sample) {
-  buffer[write] = sample;
-  write = (write + 1) % end;
-}
-
-f32 Delay::delay_read(void) {
-  f32 out = buffer[read];
-  read = (read + 1) % end;
-  return out;
-}
-
-void Delay::rebuild(i32 sample_rate, f32 delay_time_s) {
-  const f32 sample_rate_f32 = static_cast<f32>(sample_rate);
-  std::vector<f32> tmp(static_cast<size_t>(sample_rate_f32 * delay_time_s));
-  read = 0;
-  write = 0;
-  buffer = tmp;
-  end = tmp.size();
-}
+#include "../../inc/synth.hpp"
+
+#include <algorithm>
+
+// Buffer is sized for the longest delay up front so changing the time at
+// runtime never allocates
+const f32 DELAY_CAPACITY_S = 3.0f;
+
+static size_t delay_capacity(i32 sample_rate, f32 delay_time_s) {
+  const f32 longest = std::max(delay_time_s, DELAY_CAPACITY_S);
+  return static_cast<size_t>(static_cast<f32>(sample_rate) * longest);
+}
+
+Delay::Delay(i32 sample_rate, f32 delay_time_s, f32 _feedback)
+    : buffer(delay_capacity(sample_rate, delay_time_s), 0.0f), read(0),
+      write(0), start(0), end(0), feedback(_feedback), time(delay_time_s),
+      quiet(0), idle(true) {
+  set_time(sample_rate, delay_time_s);
+}
+
+void Delay::delay_write(f32 sample) {
+  buffer[write] = sample;
+  write = (write + 1) % end;
+}
+
+f32 Delay::delay_read(void) {
+  f32 out = buffer[read];
+  read = (read + 1) % end;
+  return out;
+}
+
+void Delay::set_time(i32 sample_rate, f32 delay_time_s) {
+  const f32 sample_rate_f32 = static_cast<f32>(sample_rate);
+  const size_t len = static_cast<size_t>(sample_rate_f32 * delay_time_s);
+  end = std::clamp(len, static_cast<size_t>(1), buffer.size());
+  std::fill(buffer.begin(), buffer.begin() + static_cast<long>(end), 0.0f);
+  read = 0;
+  write = 0;
+  time = delay_time_s;
+  quiet = 0;
+  idle = true;
+}
+
+// Once a whole line has been written under the threshold nothing audible can
+// come back out, clear it and let the node skip until input shows up
+void Delay::track_tail(f32 peak, size_t samples, f32 threshold) {
+  idle = false;
+  if (peak >= threshold) {
+    quiet = 0;
+    return;
+  }
+  quiet += samples;
+  if (quiet >= end) {
+    std::fill(buffer.begin(), buffer.begin() + static_cast<long>(end), 0.0f);
+    quiet = 0;
+    idle = true;
+  }
+}
+
+void Delay::rebuild(i32 sample_rate, f32 delay_time_s) {
+  std::vector<f32> tmp(delay_capacity(sample_rate, delay_time_s));
+  buffer = tmp;
+  set_time(sample_rate, delay_time_s);
+}
@@ -0,0 +1,233 @@
+#include "../../inc/ensemble.hpp"
+#include "../../inc/audio_sys.hpp"
+#include "../../inc/midi_input.hpp"
+#include "../../inc/rt_thread.hpp"
+#include "../../inc/trace.hpp"
+#include "../../inc/util.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+// Lanes spin for this part of a period after a job, then park
+const u64 ENSEMBLE_SPIN_DIVISOR = 8;
+// The join spins this long for lanes finishing alongside lane 0
+const u64 ENSEMBLE_JOIN_SPIN_NS = 20000;
+
+Ensemble::Ensemble(Synth &_main)
+    : main_part(_main), parts(1, &_main), owned(), assignment(1), lanes(),
+      buffers(), sounding(), routed(), running(false), epoch(0), pending(0),
+      parked(0), joining(false), spin_ns(0), job_out(nullptr), job_frames(0) {
+  assignment[0].push_back(0);
+}
+
+Ensemble::~Ensemble(void) { stop(); }
+
+bool Ensemble::start(size_t count, u32 seed, f32 silence_db) {
+  if (running.load() || count == 0 || count > ENSEMBLE_PARTS_MAX) {
+    return false;
+  }
+  parts.assign(1, &main_part);
+  owned.clear();
+  buffers.assign(count, std::vector<f32>());
+  for (size_t p = 1; p < count; p++) {
+    std::unique_ptr<Synth> part = std::make_unique<Synth>();
+    part->set_seed(seed + static_cast<u32>(p));
+    part->set_silence_db(silence_db);
+    part->set_bank(main_part.get_bank());
+    if (!part->set_output_format(main_part.get_sample_rate(),
+                                 main_part.get_channels())) {
+      rollback();
+      return false;
+    }
+    part->load_program(0);
+    buffers[p].assign(RENDER_FRAMES_MAX * CHANNEL_MAX, 0.0f);
+    parts.push_back(part.get());
+    owned.push_back(std::move(part));
+  }
+
+  // One lane per core at most, the audio thread is one of them
+  const size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  assignment.assign(std::min(count, cores), std::vector<size_t>());
+  for (size_t p = 0; p < count; p++) {
+    assignment[p % assignment.size()].push_back(p);
+  }
+  if (assignment.size() == 1) {
+    return true;
+  }
+
+  running.store(true);
+  const u32 seen = epoch.load();
+  for (size_t l = 1; l < assignment.size(); l++) {
+    lanes.emplace_back(&Ensemble::lane_loop, this, l, seen);
+  }
+  return true;
+}
+
+// Back to the main synth alone, as if start was never called
+void Ensemble::rollback(void) {
+  parts.assign(1, &main_part);
+  owned.clear();
+  buffers.clear();
+  assignment.assign(1, std::vector<size_t>(1, 0));
+}
+
+void Ensemble::stop(void) {
+  running.store(false);
+  epoch.fetch_add(1);
+  rt_wake_all(epoch);
+  for (size_t l = 0; l < lanes.size(); l++) {
+    if (lanes[l].joinable()) {
+      lanes[l].join();
+    }
+  }
+  lanes.clear();
+}
+
+bool Ensemble::read_event(Midi_Input &input,
+                          std::vector<Keyboard_Command> &first) {
+  if (parts.size() == 1) {
+    first = main_part.read_event(input);
+    return true;
+  }
+
+  for (size_t p = 0; p < parts.size(); p++) {
+    routed[p].clear();
+  }
+  std::array<PmEvent, INPUT_BUFFER_MAX> events;
+  size_t event_count = 0;
+  while ((event_count = input.read(events.data(), events.size())) > 0) {
+    for (size_t i = 0; i < event_count; i++) {
+      PmEvent ev = events[i];
+      const u32 status = static_cast<u32>(Pm_MessageStatus(ev.message));
+      const size_t part = status & CHANNEL_MASK;
+      if (status < CHANNEL_MESSAGE_MIN || status > CHANNEL_MESSAGE_MAX ||
+          part >= parts.size()) {
+        continue;
+      }
+      // Every part parses as if it were on channel 1
+      ev.message = Pm_Message(status & STATUS_MASK, Pm_MessageData1(ev.message),
+                              Pm_MessageData2(ev.message));
+      parts[part]->parse_command(ev, routed[part]);
+    }
+  }
+
+  first = routed[0];
+  bool queued = true;
+  for (size_t p = 1; p < parts.size(); p++) {
+    if (!routed[p].empty() && !parts[p]->queue_events(routed[p])) {
+      queued = false;
+    }
+  }
+  return queued;
+}
+
+void Ensemble::match_format(void) {
+  for (size_t p = 1; p < parts.size(); p++) {
+    parts[p]->set_output_format(main_part.get_sample_rate(),
+                                main_part.get_channels());
+  }
+}
+
+// Part 0 renders straight into the output, everything else into its buffer
+void Ensemble::render_lane(size_t lane) {
+  const std::vector<size_t> &mine = assignment[lane];
+  for (size_t i = 0; i < mine.size(); i++) {
+    const size_t p = mine[i];
+    TRACE_SCOPE_ARG("part", p);
+    f32 *dst = p == 0 ? job_out : buffers[p].data();
+    sounding[p] = render_block(parts[p], dst, job_frames);
+  }
+}
+
+void Ensemble::lane_loop(size_t lane, u32 seen) {
+  TRACE_THREAD("part lane");
+  rt_enter_thread("part lane", RT_LANE);
+  u64 last_job = now_ns();
+  while (running.load(std::memory_order_relaxed)) {
+    const u32 current = epoch.load(std::memory_order_acquire);
+    if (current == seen) {
+      if (now_ns() - last_job < spin_ns.load(std::memory_order_relaxed)) {
+        std::this_thread::yield();
+        continue;
+      }
+      // render() reads parked after the epoch moves, so either it sees us
+      // here or we see the new epoch before sleeping
+      parked.fetch_add(1);
+      if (epoch.load() == seen) {
+        rt_wait(epoch, seen);
+      }
+      parked.fetch_sub(1);
+      continue;
+    }
+    seen = current;
+    render_lane(lane);
+    if (pending.fetch_sub(1) == 1 && joining.load()) {
+      rt_wake_all(pending);
+    }
+    last_job = now_ns();
+  }
+}
+
+void Ensemble::join_lanes(void) {
+  const u64 start = now_ns();
+  u32 left = pending.load(std::memory_order_acquire);
+  while (left > 0 && now_ns() - start < ENSEMBLE_JOIN_SPIN_NS) {
+    std::this_thread::yield();
+    left = pending.load(std::memory_order_acquire);
+  }
+  if (left == 0) {
+    return;
+  }
+  // Same as the lanes' park, the last lane either sees joining or leaves
+  // pending at 0 for us to see
+  joining.store(true);
+  while ((left = pending.load()) > 0) {
+    rt_wait(pending, left);
+  }
+  joining.store(false);
+}
+
+bool Ensemble::render(f32 *out, size_t frames) {
+  if (parts.size() == 1) {
+    return render_block(&main_part, out, frames);
+  }
+
+  bool any = false;
+  const size_t channels = static_cast<size_t>(main_part.get_channels());
+  spin_ns.store(frames * 1000000000ull /
+                    static_cast<u64>(main_part.get_sample_rate()) /
+                    ENSEMBLE_SPIN_DIVISOR,
+                std::memory_order_relaxed);
+  for (size_t done = 0; done < frames;) {
+    const size_t chunk = std::min<size_t>(frames - done, RENDER_FRAMES_MAX);
+    job_out = out + done * channels;
+    job_frames = chunk;
+    if (!lanes.empty()) {
+      pending.store(static_cast<u32>(lanes.size()),
+                    std::memory_order_relaxed);
+      epoch.fetch_add(1);
+      if (parked.load() > 0) {
+        rt_wake_all(epoch);
+      }
+    }
+    render_lane(0);
+    {
+      TRACE_SCOPE("part_join");
+      join_lanes();
+    }
+
+    any = any || sounding[0];
+    for (size_t p = 1; p < parts.size(); p++) {
+      if (!sounding[p]) {
+        continue;
+      }
+      const f32 *src = buffers[p].data();
+      for (size_t s = 0; s < chunk * channels; s++) {
+        job_out[s] += src[s];
+      }
+      any = true;
+    }
+    done += chunk;
+  }
+  return any;
+}
@@ -0,0 +1,326 @@
+#include "../../inc/golden.hpp"
+#include "../../inc/audio_sys.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <fstream>
+#include <iostream>
+
+const f32 GOLDEN_FLOOR_DB = -120.0f;
+// Bands quieter than this in both renders don't count towards max_db
+const f32 GOLDEN_AUDIBLE_DB = -90.0f;
+
+static Keyboard_Command note_on(u32 key, u32 velocity) {
+  return {Keyboard_Command::note_on, Midi_Input_Msg(0x90, key, velocity)};
+}
+
+static Keyboard_Command note_off(u32 key) {
+  return {Keyboard_Command::note_off, Midi_Input_Msg(0x80, key, 0)};
+}
+
+static std::vector<Golden_Scenario> build_scenarios(void) {
+  std::vector<Golden_Scenario> list;
+
+  list.push_back({"single_note", 1.5f, 1e-4f, 0.1f,
+                  {{0.0f, note_on(60, 100)}, {0.75f, note_off(60)}},
+                  {}});
+
+  list.push_back({"chord", 2.0f, 1e-4f, 0.1f,
+                  {{0.0f, note_on(60, 100)},
+                   {0.0f, note_on(64, 90)},
+                   {0.0f, note_on(67, 80)},
+                   {0.8f, note_off(64)},
+                   {1.2f, note_off(60)},
+                   {1.2f, note_off(67)}},
+                  {}});
+
+  // More notes than voices, the last ones have to wait or steal
+  Golden_Scenario steal = {"voice_steal", 2.0f, 2e-4f, 0.25f, {}, {}};
+  for (u32 i = 0; i < VOICES + 4; i++) {
+    const f32 t = 0.02f * (f32)i;
+    steal.events.push_back({t, note_on(48 + i, 60 + i * 3)});
+    steal.events.push_back({t + 1.0f, note_off(48 + i)});
+  }
+  list.push_back(steal);
+
+  Golden_Scenario wheel = {"bend_and_wheel", 2.0f, 2e-4f, 0.25f,
+                           {{0.0f, note_on(57, 110)}}, {}};
+  for (u32 i = 0; i <= 16; i++) {
+    const f32 t = 0.1f + 0.05f * (f32)i;
+    wheel.events.push_back(
+        {t, {Keyboard_Command::pitch_bend, Midi_Input_Msg(0xE0, 0, 64 + i * 3)}});
+    wheel.events.push_back(
+        {t, {Keyboard_Command::mod_wheel, Midi_Input_Msg(0xB0, 1, i * 7)}});
+  }
+  wheel.events.push_back({1.3f, note_off(57)});
+  list.push_back(wheel);
+
+  list.push_back({"arpeggio", 2.5f, 1e-4f, 0.1f,
+                  {{0.0f, {Keyboard_Command::arp_next_mode, Midi_Input_Msg()}},
+                   {0.0f, note_on(60, 100)},
+                   {0.0f, note_on(63, 100)},
+                   {0.0f, note_on(67, 100)},
+                   {1.5f, note_off(60)},
+                   {1.5f, note_off(63)},
+                   {1.5f, note_off(67)}},
+                  {}});
+
+  // Off centre duties, so anything that stops reading the osc duty shows up
+  list.push_back({"square_and_pulse", 1.5f, 1e-4f, 0.1f,
+                  {{0.0f, note_on(55, 100)},
+                   {0.0f, note_on(62, 90)},
+                   {1.0f, note_off(55)},
+                   {1.0f, note_off(62)}},
+                  {{SQUARE, 1.0f, 0.3f, 0}, {PULSE, 1.005f, 0.8f, 0}}});
+  return list;
+}
+
+const std::vector<Golden_Scenario> &get_golden_scenarios(void) {
+  static const std::vector<Golden_Scenario> scenarios = build_scenarios();
+  return scenarios;
+}
+
+// Events go through the same queue a device would use, chunks are cut at
+// every event so they land on the exact frame
+bool render_scenario(const Golden_Scenario &scenario, std::vector<f32> &out,
+                     u32 &channels, u32 &sample_rate) {
+  Synth syn;
+  syn.set_seed(GOLDEN_SEED);
+  if (!scenario.oscs.empty()) {
+    Preset preset;
+    syn.store_patch(preset);
+    preset.osc_count = static_cast<u32>(scenario.oscs.size());
+    std::copy(scenario.oscs.begin(), scenario.oscs.end(), preset.oscs);
+    if (!syn.set_patch(preset)) {
+      std::cerr << "Golden patch failed: " << scenario.name << std::endl;
+      return false;
+    }
+  }
+  channels = static_cast<u32>(syn.get_channels());
+  sample_rate = static_cast<u32>(syn.get_sample_rate());
+
+  const size_t frames =
+      static_cast<size_t>(scenario.seconds * (f32)sample_rate);
+  out.assign(frames * channels, 0.0f);
+
+  size_t next = 0;
+  size_t pos = 0;
+  while (pos < frames) {
+    std::vector<Keyboard_Command> due;
+    while (next < scenario.events.size() &&
+           (size_t)(scenario.events[next].seconds * (f32)sample_rate) <= pos) {
+      due.push_back(scenario.events[next++].command);
+    }
+    if (!syn.queue_events(due)) {
+      std::cerr << "Golden render dropped events: " << scenario.name
+                << std::endl;
+      return false;
+    }
+
+    size_t chunk = std::min<size_t>(GOLDEN_BLOCK, frames - pos);
+    if (next < scenario.events.size()) {
+      const size_t at =
+          (size_t)(scenario.events[next].seconds * (f32)sample_rate);
+      chunk = std::min(chunk, at - pos);
+    }
+    render_block(&syn, out.data() + pos * channels, chunk);
+    pos += chunk;
+  }
+  return true;
+}
+
+static std::string golden_path(const std::string &dir, const char *name) {
+  return dir + "/" + name + ".golden";
+}
+
+static bool write_golden(const std::string &path, const std::vector<f32> &data,
+                         u32 channels, u32 sample_rate) {
+  std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Failed to open golden render for writing: " << path
+              << std::endl;
+    return false;
+  }
+  const Golden_Header header = {GOLDEN_MAGIC, GOLDEN_VERSION, channels,
+                                sample_rate, data.size() / channels};
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(data.data()),
+            static_cast<std::streamsize>(data.size() * sizeof(f32)));
+  if (!out.good()) {
+    std::cerr << "Failed to write golden render: " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static bool read_golden(const std::string &path, Golden_Header &header,
+                        std::vector<f32> &data) {
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    std::cerr << "Missing golden render: " << path << std::endl;
+    return false;
+  }
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!in.good() || header.magic != GOLDEN_MAGIC ||
+      header.version != GOLDEN_VERSION || header.channels == 0) {
+    std::cerr << "Not a golden render: " << path << std::endl;
+    return false;
+  }
+  data.assign(header.frames * header.channels, 0.0f);
+  in.read(reinterpret_cast<char *>(data.data()),
+          static_cast<std::streamsize>(data.size() * sizeof(f32)));
+  if (!in.good()) {
+    std::cerr << "Truncated golden render: " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static void fft(std::vector<std::complex<f32>> &x) {
+  const size_t n = x.size();
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      std::swap(x[i], x[j]);
+    }
+  }
+  for (size_t len = 2; len <= n; len <<= 1) {
+    const f32 angle = -2.0f * PI / (f32)len;
+    const std::complex<f32> step(cosf(angle), sinf(angle));
+    for (size_t i = 0; i < n; i += len) {
+      std::complex<f32> w(1.0f, 0.0f);
+      for (size_t k = 0; k < len / 2; k++) {
+        const std::complex<f32> u = x[i + k];
+        const std::complex<f32> v = x[i + k + len / 2] * w;
+        x[i + k] = u + v;
+        x[i + k + len / 2] = u - v;
+        w *= step;
+      }
+    }
+  }
+}
+
+// Hann windowed magnitudes of one mono downmixed window, in dB
+static void window_db(const std::vector<f32> &data, size_t start,
+                      u32 channels, std::vector<f32> &db) {
+  std::vector<std::complex<f32>> bins(GOLDEN_FFT);
+  f32 gain = 0.0f;
+  for (size_t n = 0; n < GOLDEN_FFT; n++) {
+    const f32 w =
+        0.5f - 0.5f * cosf(2.0f * PI * (f32)n / (f32)(GOLDEN_FFT - 1));
+    f32 sum = 0.0f;
+    for (size_t c = 0; c < channels; c++) {
+      sum += data[(start + n) * channels + c];
+    }
+    bins[n] = sum / (f32)channels * w;
+    gain += w;
+  }
+  fft(bins);
+  db.resize(GOLDEN_FFT / 2);
+  for (size_t b = 0; b < db.size(); b++) {
+    const f32 mag = 2.0f * std::abs(bins[b]) / gain;
+    db[b] = mag > 0.0f ? std::max(20.0f * log10f(mag), GOLDEN_FLOOR_DB)
+                       : GOLDEN_FLOOR_DB;
+  }
+}
+
+static Golden_Result compare(const std::vector<f32> &ref,
+                             const std::vector<f32> &got, u32 channels,
+                             f32 tolerance) {
+  Golden_Result result = {0.0f, 0, SIZE_MAX, 0.0f, 0};
+  const size_t count = std::min(ref.size(), got.size());
+  for (size_t i = 0; i < count; i++) {
+    const f32 diff = fabsf(ref[i] - got[i]);
+    if (diff > result.max_abs) {
+      result.max_abs = diff;
+      result.max_abs_frame = i / channels;
+    }
+    if (diff > tolerance && result.first_diverged == SIZE_MAX) {
+      result.first_diverged = i / channels;
+    }
+  }
+
+  std::vector<f32> ref_db, got_db;
+  const size_t frames = count / channels;
+  for (size_t start = 0; start + GOLDEN_FFT <= frames; start += GOLDEN_FFT) {
+    window_db(ref, start, channels, ref_db);
+    window_db(got, start, channels, got_db);
+    f32 sum = 0.0f;
+    size_t audible = 0;
+    for (size_t b = 0; b < ref_db.size(); b++) {
+      if (ref_db[b] > GOLDEN_AUDIBLE_DB || got_db[b] > GOLDEN_AUDIBLE_DB) {
+        sum += fabsf(ref_db[b] - got_db[b]);
+        audible++;
+      }
+    }
+    const f32 mean = audible > 0 ? sum / (f32)audible : 0.0f;
+    if (mean > result.max_db) {
+      result.max_db = mean;
+      result.max_db_frame = start;
+    }
+  }
+  return result;
+}
+
+bool golden_record(const std::string &dir) {
+  const std::vector<Golden_Scenario> &scenarios = get_golden_scenarios();
+  for (size_t i = 0; i < scenarios.size(); i++) {
+    std::vector<f32> data;
+    u32 channels = 0, sample_rate = 0;
+    if (!render_scenario(scenarios[i], data, channels, sample_rate) ||
+        !write_golden(golden_path(dir, scenarios[i].name), data, channels,
+                      sample_rate)) {
+      return false;
+    }
+    std::cout << "Recorded " << scenarios[i].name << ", "
+              << data.size() / channels << " frames" << std::endl;
+  }
+  return true;
+}
+
+// Keeps going after a failure so one run reports every scenario
+bool golden_check(const std::string &dir) {
+  const std::vector<Golden_Scenario> &scenarios = get_golden_scenarios();
+  size_t failed = 0;
+  for (size_t i = 0; i < scenarios.size(); i++) {
+    const Golden_Scenario &sc = scenarios[i];
+    Golden_Header header;
+    std::vector<f32> ref, got;
+    u32 channels = 0, sample_rate = 0;
+    if (!read_golden(golden_path(dir, sc.name), header, ref) ||
+        !render_scenario(sc, got, channels, sample_rate)) {
+      failed++;
+      continue;
+    }
+    if (header.channels != channels || header.sample_rate != sample_rate ||
+        ref.size() != got.size()) {
+      std::cerr << sc.name << ": FAIL, reference is " << header.channels
+                << " channels at " << header.sample_rate << "Hz, "
+                << header.frames << " frames" << std::endl;
+      failed++;
+      continue;
+    }
+
+    const Golden_Result r = compare(ref, got, channels, sc.max_abs);
+    const bool ok = r.first_diverged == SIZE_MAX && r.max_db <= sc.max_db;
+    std::cout << sc.name << ": " << (ok ? "ok" : "FAIL") << ", max abs "
+              << r.max_abs << " at " << (f32)r.max_abs_frame / (f32)sample_rate
+              << "s, spectrum " << r.max_db << "dB at "
+              << (f32)r.max_db_frame / (f32)sample_rate << "s" << std::endl;
+    if (r.first_diverged != SIZE_MAX) {
+      std::cout << "  diverges past " << sc.max_abs << " at frame "
+                << r.first_diverged << " ("
+                << (f32)r.first_diverged / (f32)sample_rate << "s)"
+                << std::endl;
+    }
+    failed += ok ? 0 : 1;
+  }
+  std::cout << scenarios.size() - failed << "/" << scenarios.size()
+            << " golden renders within tolerance" << std::endl;
+  return failed == 0;
+}
@@ -0,0 +1,204 @@
+#include "../../inc/graph.hpp"
+#include "../../inc/trace.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+const size_t LAST_USE_OUTPUT = SIZE_MAX;
+
+Graph::Graph(void)
+    : nodes(), edges(), schedule(), pool(), buffers(), output_node(SIZE_MAX),
+      output_port(0), buffer_count(0), compiled(false) {}
+
+void Graph::clear(void) {
+  nodes.clear();
+  edges.clear();
+  schedule.clear();
+  pool.clear();
+  buffers.clear();
+  output_node = SIZE_MAX;
+  output_port = 0;
+  buffer_count = 0;
+  compiled = false;
+}
+
+size_t Graph::add_node(std::unique_ptr<Node> node) {
+  compiled = false;
+  nodes.push_back(std::move(node));
+  return nodes.size() - 1;
+}
+
+bool Graph::connect(size_t from, size_t from_port, size_t to, size_t to_port) {
+  if (to >= nodes.size() || to_port >= nodes[to]->get_input_count()) {
+    std::cerr << "Invalid graph input port" << std::endl;
+    return false;
+  }
+
+  // The external input is always interleaved audio
+  const u8 from_type = from == GRAPH_INPUT
+                           ? static_cast<u8>(PORT_AUDIO)
+                           : (from < nodes.size() &&
+                                      from_port < nodes[from]->get_output_count()
+                                  ? nodes[from]->get_output_type(from_port)
+                                  : static_cast<u8>(0xFF));
+  if (from_type != nodes[to]->get_input_type(to_port)) {
+    std::cerr << "Mismatched graph port types" << std::endl;
+    return false;
+  }
+
+  for (size_t e = 0; e < edges.size(); e++) {
+    if (edges[e].to == to && edges[e].to_port == to_port) {
+      std::cerr << "Graph input port already connected" << std::endl;
+      return false;
+    }
+  }
+
+  compiled = false;
+  edges.push_back({from, from_port, to, to_port});
+  return true;
+}
+
+bool Graph::set_output(size_t node, size_t port) {
+  if (node >= nodes.size() || port >= nodes[node]->get_output_count() ||
+      nodes[node]->get_output_type(port) != PORT_AUDIO) {
+    std::cerr << "Invalid graph output" << std::endl;
+    return false;
+  }
+  compiled = false;
+  output_node = node;
+  output_port = port;
+  return true;
+}
+
+bool Graph::compile(void) {
+  compiled = false;
+  schedule.clear();
+  if (output_node >= nodes.size()) {
+    std::cerr << "Graph has no output" << std::endl;
+    return false;
+  }
+
+  // Kahn's sort, order[i] is the node run at step i
+  std::vector<size_t> pending(nodes.size(), 0), order;
+  for (size_t e = 0; e < edges.size(); e++) {
+    if (edges[e].from != GRAPH_INPUT) {
+      pending[edges[e].to]++;
+    }
+  }
+  for (size_t n = 0; n < nodes.size(); n++) {
+    if (pending[n] == 0) {
+      order.push_back(n);
+    }
+  }
+  for (size_t i = 0; i < order.size(); i++) {
+    for (size_t e = 0; e < edges.size(); e++) {
+      if (edges[e].from == order[i] && --pending[edges[e].to] == 0) {
+        order.push_back(edges[e].to);
+      }
+    }
+  }
+  if (order.size() != nodes.size()) {
+    std::cerr << "Graph has a cycle" << std::endl;
+    return false;
+  }
+
+  std::vector<size_t> step_of(nodes.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    step_of[order[i]] = i;
+  }
+
+  // Last step reading each output port, the graph output lives past the end
+  std::vector<std::array<size_t, PORT_MAX>> last_use(nodes.size());
+  for (size_t n = 0; n < nodes.size(); n++) {
+    last_use[n].fill(0);
+  }
+  for (size_t e = 0; e < edges.size(); e++) {
+    if (edges[e].from != GRAPH_INPUT) {
+      size_t &use = last_use[edges[e].from][edges[e].from_port];
+      use = std::max(use, step_of[edges[e].to]);
+    }
+  }
+  last_use[output_node][output_port] = LAST_USE_OUTPUT;
+
+  // Buffers come back to the free list once the step after their last
+  // reader starts, never during it, so a node's inputs and outputs can't alias
+  std::vector<std::array<u16, PORT_MAX>> assigned(nodes.size());
+  std::vector<u16> free_list;
+  std::vector<std::pair<u16, size_t>> live;
+  u16 next_buffer = BUFFER_POOL;
+
+  for (size_t i = 0; i < order.size(); i++) {
+    for (size_t l = 0; l < live.size();) {
+      if (live[l].second < i) {
+        free_list.push_back(live[l].first);
+        live[l] = live.back();
+        live.pop_back();
+      } else {
+        l++;
+      }
+    }
+
+    const size_t n = order[i];
+    Graph_Step step;
+    step.node = nodes[n].get();
+    step.in.fill(BUFFER_ZERO);
+    step.out.fill(BUFFER_ZERO);
+
+    for (size_t e = 0; e < edges.size(); e++) {
+      if (edges[e].to != n) {
+        continue;
+      }
+      step.in[edges[e].to_port] =
+          edges[e].from == GRAPH_INPUT
+              ? static_cast<u16>(BUFFER_IN)
+              : assigned[edges[e].from][edges[e].from_port];
+    }
+
+    for (size_t p = 0; p < nodes[n]->get_output_count(); p++) {
+      if (last_use[n][p] == LAST_USE_OUTPUT) {
+        assigned[n][p] = BUFFER_OUT;
+      } else {
+        u16 buffer = next_buffer;
+        if (!free_list.empty()) {
+          buffer = free_list.back();
+          free_list.pop_back();
+        } else {
+          next_buffer++;
+        }
+        assigned[n][p] = buffer;
+        // Unread outputs still need somewhere to go for this one step
+        live.push_back({buffer, std::max(last_use[n][p], i)});
+      }
+      step.out[p] = assigned[n][p];
+    }
+    schedule.push_back(step);
+  }
+
+  buffer_count = static_cast<size_t>(next_buffer - BUFFER_POOL);
+  pool.assign((buffer_count + 1) * GRAPH_BUFFER_STRIDE, 0.0f);
+  buffers.assign(BUFFER_POOL + buffer_count, nullptr);
+  buffers[BUFFER_ZERO] = pool.data();
+  for (size_t b = 0; b < buffer_count; b++) {
+    buffers[BUFFER_POOL + b] = pool.data() + (b + 1) * GRAPH_BUFFER_STRIDE;
+  }
+
+  compiled = true;
+  return true;
+}
+
+void Graph::run(const Node_Ctx &ctx, const f32 *input, f32 *output) {
+  buffers[BUFFER_IN] = const_cast<f32 *>(input);
+  buffers[BUFFER_OUT] = output;
+
+  std::array<const f32 *, PORT_MAX> in;
+  std::array<f32 *, PORT_MAX> out;
+  for (size_t s = 0; s < schedule.size(); s++) {
+    const Graph_Step &step = schedule[s];
+    TRACE_SCOPE_ARG(step.node->get_name(), ctx.voice_iter);
+    for (size_t p = 0; p < PORT_MAX; p++) {
+      in[p] = buffers[step.in[p]];
+      out[p] = buffers[step.out[p]];
+    }
+    step.node->process(ctx, in.data(), out.data());
+  }
+}
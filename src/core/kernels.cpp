@@ -0,0 +1,14 @@
+#include "../../inc/synth.hpp"
+#include <cmath>
+
+// The waveform kernels themselves are templates in kernels.hpp, the osc node
+// instantiates them per count. The plan only keeps what's shared per patch.
+
+// No allocation, safe to call from the audio thread
+Render_Plan make_render_plan(const std::vector<Oscillator> &oscs) {
+  Render_Plan plan;
+  const size_t osc_count = oscs.empty() ? 1 : oscs.size();
+  plan.osc_scale =
+      1.0f / sqrtf((f32)(osc_count > MAX_OSC_COUNT ? MAX_OSC_COUNT : osc_count));
+  return plan;
+}
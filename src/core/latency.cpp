@@ -0,0 +1,187 @@
+#include "../../inc/latency.hpp"
+#include "../../inc/audio_sys.hpp"
+#include "../../inc/graph.hpp"
+#include "../../inc/midi_input.hpp"
+#include "../../inc/synth.hpp"
+#include "../../inc/util.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <porttime.h>
+
+// -60dB, well clear of the silence threshold and the first samples of a note
+const f32 ONSET_THRESHOLD = 0.001f;
+const u64 ONSET_TIMEOUT_NS = 500000000ull;
+const u64 SETTLE_TIMEOUT_NS = 2000000000ull;
+const i32 PUMP_WAIT_MS = 10;
+const u32 LATENCY_SEED = 0x1A7E;
+const u32 LATENCY_KEY = 69;
+const i32 POLL_STRATEGIES[] = {0, 8};
+const i32 SWEEP_FRAMES[] = {64, 128, 256, 512, 1024};
+
+static void wake_pump(void *userdata) {
+  SDL_Event event;
+  memset(&event, 0, sizeof(event));
+  event.type = *static_cast<const u32 *>(userdata);
+  SDL_PushEvent(&event);
+}
+
+// The main loop's share of the path, wait then hand MIDI to the audio queue
+static void pump(Synth &syn, Midi_Input &midi, i32 poll_ms) {
+  if (poll_ms > 0) {
+    SDL_Delay(static_cast<u32>(poll_ms));
+  } else {
+    SDL_Event event;
+    SDL_WaitEventTimeout(&event, PUMP_WAIT_MS);
+  }
+  std::vector<Keyboard_Command> commands = syn.read_event(midi);
+  syn.queue_events(commands);
+}
+
+static bool settle(Synth &syn, Midi_Input &midi, i32 poll_ms) {
+  const u64 start = now_ns();
+  while (syn.get_sounding_voices() > 0) {
+    if (now_ns() - start > SETTLE_TIMEOUT_NS) {
+      return false;
+    }
+    pump(syn, midi, poll_ms);
+  }
+  return true;
+}
+
+static bool inject_note(Midi_Input &midi, size_t loopback, u32 status,
+                        u32 velocity) {
+  PmEvent event;
+  event.message = Pm_Message(status, LATENCY_KEY, velocity);
+  event.timestamp = Pt_Time();
+  return midi.inject(loopback, event);
+}
+
+static f32 percentile(const std::vector<f32> &sorted, f32 p) {
+  const size_t at = static_cast<size_t>(p * (f32)(sorted.size() - 1) + 0.5f);
+  return sorted[std::min(at, sorted.size() - 1)];
+}
+
+bool measure_latency(const Latency_Config &config, size_t notes,
+                     Latency_Stats &stats) {
+  memset(&stats, 0, sizeof(stats));
+  Synth syn;
+  syn.set_seed(LATENCY_SEED);
+  // Snappy envelope and no delay tail, only the path is being timed. Read
+  // before the device starts rendering on the synth
+  Preset preset;
+  syn.store_patch(preset);
+  preset.params[S_ATTACK] = 0.0f;
+  preset.params[S_RELEASE] = 0.0f;
+  preset.flags |= CHAIN_NO_DELAY;
+
+  Audio_Sys audio(syn.get_channels(), syn.get_sample_rate(),
+                  config.device_frames);
+  if (!audio.open(&syn)) {
+    return false;
+  }
+  syn.publish_patch(preset);
+
+  Midi_Input midi;
+  const size_t loopback = midi.add_loopback();
+  u32 wake_event = 0;
+  if (config.poll_ms == 0) {
+    wake_event = SDL_RegisterEvents(1);
+    if (wake_event != 0) {
+      midi.set_notify(wake_pump, &wake_event);
+    }
+  }
+  if (loopback == SIZE_MAX || !midi.open()) {
+    audio.close();
+    return false;
+  }
+
+  // Each note lands at a random point in the device period
+  Rng rng(LATENCY_SEED);
+  const f32 period_ms = (f32)audio.get_device_frames() * 1000.0f /
+                        (f32)syn.get_sample_rate();
+  std::vector<f32> samples;
+  f32 output_sum = 0.0f;
+  for (size_t i = 0; i < notes; i++) {
+    if (!settle(syn, midi, config.poll_ms)) {
+      std::cerr << "Voices never went quiet, stopping early" << std::endl;
+      break;
+    }
+    SDL_Delay(static_cast<u32>(rng.range(1.0f, 2.0f + period_ms)));
+
+    audio.arm_onset(ONSET_THRESHOLD);
+    const u64 sent = now_ns();
+    inject_note(midi, loopback, 0x90, 100);
+    u64 onset = 0;
+    while (!audio.get_onset(onset) && now_ns() - sent < ONSET_TIMEOUT_NS) {
+      pump(syn, midi, config.poll_ms);
+    }
+    // The stamp comes from the callback's start, one that began before the
+    // note was sent can put it ahead of sent. There's no latency to read off
+    // that, it counts as missed
+    if (onset >= sent) {
+      samples.push_back((f32)(onset - sent) / 1e6f);
+      output_sum += audio.get_latency_ms();
+    } else {
+      stats.missed++;
+    }
+    inject_note(midi, loopback, 0x80, 0);
+  }
+  settle(syn, midi, config.poll_ms);
+
+  midi.close();
+  audio.close();
+
+  stats.count = samples.size();
+  if (samples.empty()) {
+    return false;
+  }
+  std::sort(samples.begin(), samples.end());
+  stats.min = samples.front();
+  stats.p50 = percentile(samples, 0.5f);
+  stats.p99 = percentile(samples, 0.99f);
+  stats.max = samples.back();
+  stats.output = output_sum / (f32)samples.size();
+  return true;
+}
+
+bool latency_sweep(const std::vector<i32> &frames, size_t notes) {
+  std::vector<i32> sizes = frames;
+  if (sizes.empty()) {
+    sizes.assign(SWEEP_FRAMES, SWEEP_FRAMES + ARR_LEN(SWEEP_FRAMES));
+  }
+
+  std::cout << "frames  poll      notes  missed   min    p50    p99    max"
+               "  (ms, +output)"
+            << std::endl;
+  bool any = false;
+  for (size_t f = 0; f < sizes.size(); f++) {
+    for (size_t p = 0; p < ARR_LEN(POLL_STRATEGIES); p++) {
+      const Latency_Config config = {sizes[f], POLL_STRATEGIES[p]};
+      Latency_Stats stats;
+      if (!measure_latency(config, notes, stats)) {
+        std::cerr << "Latency run failed for " << config.device_frames
+                  << " frames" << std::endl;
+        continue;
+      }
+      char poll[16];
+      if (config.poll_ms == 0) {
+        snprintf(poll, sizeof(poll), "wake");
+      } else {
+        snprintf(poll, sizeof(poll), "%dms", config.poll_ms);
+      }
+      char row[128];
+      snprintf(row, sizeof(row),
+               "%6d  %-8s %6zu  %6zu %6.2f %6.2f %6.2f %6.2f  +%.2f",
+               config.device_frames, poll, stats.count, stats.missed,
+               (double)stats.min, (double)stats.p50, (double)stats.p99,
+               (double)stats.max, (double)stats.output);
+      std::cout << row << std::endl;
+      any = true;
+    }
+  }
+  return any;
+}
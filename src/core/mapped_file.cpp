@@ -0,0 +1,114 @@
+#include "../../inc/mapped_file.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Mapped_File::Mapped_File(void)
+    : base(nullptr), length(0),
+#ifdef _WIN32
+      file(nullptr), mapping(nullptr) {
+}
+#else
+      fd(-1) {
+}
+#endif
+
+Mapped_File::~Mapped_File(void) { close(); }
+
+#ifdef _WIN32
+bool Mapped_File::open(const std::string &path) {
+  close();
+  HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (f == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(f, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(f);
+    return false;
+  }
+
+  HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!m) {
+    CloseHandle(f);
+    return false;
+  }
+
+  void *view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+  if (!view) {
+    CloseHandle(m);
+    CloseHandle(f);
+    return false;
+  }
+
+  file = f;
+  mapping = m;
+  base = static_cast<const u8 *>(view);
+  length = static_cast<size_t>(file_size.QuadPart);
+  return true;
+}
+
+void Mapped_File::close(void) {
+  if (base) {
+    UnmapViewOfFile(base);
+  }
+  if (mapping) {
+    CloseHandle(mapping);
+  }
+  if (file) {
+    CloseHandle(file);
+  }
+  base = nullptr;
+  length = 0;
+  mapping = nullptr;
+  file = nullptr;
+}
+#else
+bool Mapped_File::open(const std::string &path) {
+  close();
+  const int f = ::open(path.c_str(), O_RDONLY);
+  if (f < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(f, &st) < 0 || st.st_size == 0) {
+    ::close(f);
+    return false;
+  }
+
+  void *view = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ,
+                    MAP_PRIVATE, f, 0);
+  if (view == MAP_FAILED) {
+    ::close(f);
+    return false;
+  }
+
+  fd = f;
+  base = static_cast<const u8 *>(view);
+  length = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+void Mapped_File::close(void) {
+  if (base) {
+    munmap(const_cast<u8 *>(base), length);
+  }
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  base = nullptr;
+  length = 0;
+  fd = -1;
+}
+#endif
@@ -0,0 +1,403 @@
+#include "../../inc/midi_input.hpp"
+#include "../../inc/trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+#include <porttime.h>
+
+const auto INGEST_PERIOD = std::chrono::milliseconds(1);
+// How often PortMidi is restarted while a named device is missing, doubling
+// up to the max while other streams are open and nothing turns up
+const auto WATCH_PERIOD = std::chrono::milliseconds(1000);
+const auto WATCH_PERIOD_MAX = std::chrono::milliseconds(32000);
+// So close() isn't held up a whole period
+const auto WATCH_STEP = std::chrono::milliseconds(50);
+
+Midi_Input::Midi_Input(void)
+    : devices(), merged(), merge_dropped(0), running(false),
+      rescanning(false), polling(false), ingest(), watcher(), notify(nullptr),
+      notify_data(nullptr) {}
+
+Midi_Input::~Midi_Input(void) { close(); }
+
+bool Midi_Input::add_device(const char *name, u32 channel) {
+  if (devices.size() >= MIDI_DEVICE_MAX || channel > MIDI_CHANNELS) {
+    std::cerr << "Can't add midi device: " << name << std::endl;
+    return false;
+  }
+  devices.push_back(std::make_unique<Midi_Device>(name, channel, false));
+  return true;
+}
+
+size_t Midi_Input::add_loopback(void) {
+  if (devices.size() >= MIDI_DEVICE_MAX) {
+    std::cerr << "Can't add midi loopback" << std::endl;
+    return SIZE_MAX;
+  }
+  devices.push_back(
+      std::make_unique<Midi_Device>("loopback", CHANNEL_KEEP, true));
+  return devices.size() - 1;
+}
+
+bool Midi_Input::inject(size_t device, const PmEvent &event) {
+  if (device >= devices.size() || !devices[device]->loopback) {
+    return false;
+  }
+  Midi_Device &dev = *devices[device];
+  if (!dev.pending.push(event)) {
+    dev.stats.dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  dev.stats.received.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void Midi_Input::set_notify(Midi_Notify fn, void *userdata) {
+  notify = fn;
+  notify_data = userdata;
+}
+
+bool Midi_Input::open(void) {
+  bool named = false;
+  bool loopback = false;
+  for (size_t i = 0; i < devices.size(); i++) {
+    named = named || !devices[i]->loopback;
+    loopback = loopback || devices[i]->loopback;
+  }
+  const size_t opened = named ? open_devices(true) : 0;
+  if (!named && !loopback) {
+    return false;
+  }
+  // Opening a stream starts the clock, a loopback on its own has to
+  if (!Pt_Started()) {
+    Pt_Start(1, nullptr, nullptr);
+  }
+
+  running.store(true);
+  ingest = std::thread(&Midi_Input::ingest_loop, this);
+  if (named) {
+    watcher = std::thread(&Midi_Input::watch_loop, this);
+  }
+  return opened > 0 || loopback;
+}
+
+void Midi_Input::close(void) {
+  if (running.exchange(false)) {
+    if (ingest.joinable()) {
+      ingest.join();
+    }
+    if (watcher.joinable()) {
+      watcher.join();
+    }
+  }
+  for (size_t i = 0; i < devices.size(); i++) {
+    if (devices[i]->opened) {
+      devices[i]->controller.close();
+      devices[i]->opened = false;
+    }
+  }
+}
+
+// One walk over PortMidi's device list finds every named device that isn't
+// open yet. Returns how many it opened
+size_t Midi_Input::open_devices(bool print) {
+  std::vector<i32> ids(devices.size(), -1);
+  const i32 count = Pm_CountDevices();
+  for (i32 i = 0; i < count; i++) {
+    const PmDeviceInfo *info = Pm_GetDeviceInfo(i);
+    if (!info) {
+      continue;
+    }
+    if (print) {
+      printf("%d: %s [%s] %s\n", i, info->name, info->interf,
+             info->input ? "input" : "output");
+    }
+    for (size_t d = 0; d < devices.size() && info->input; d++) {
+      if (ids[d] < 0 && !devices[d]->loopback &&
+          devices[d]->controller.get_name() == info->name) {
+        ids[d] = i;
+      }
+    }
+  }
+
+  size_t opened = 0;
+  for (size_t i = 0; i < devices.size(); i++) {
+    Midi_Device &dev = *devices[i];
+    if (dev.loopback || dev.opened) {
+      continue;
+    }
+    if (ids[i] < 0) {
+      if (print) {
+        std::cout << "Failed to find device, watching for it: "
+                  << dev.controller.get_name() << std::endl;
+      }
+      continue;
+    }
+    dev.opened = dev.controller.open(ids[i]);
+    opened += dev.opened ? 1 : 0;
+  }
+  return opened;
+}
+
+size_t Midi_Input::read(PmEvent *events, size_t max) {
+  size_t count = 0;
+  while (count < max && merged.pop(events[count])) {
+    count++;
+  }
+  return count;
+}
+
+void Midi_Input::print_stats(void) const {
+  for (size_t i = 0; i < devices.size(); i++) {
+    const Midi_Device_Stats &st = devices[i]->stats;
+    std::cout << "Midi device " << i << ": " << st.received.load()
+              << " received, " << st.dropped.load() << " dropped, "
+              << st.overflows.load() << " overflows, "
+              << st.reconnects.load() << " reconnects" << std::endl;
+  }
+  if (merge_dropped.load() > 0) {
+    std::cout << "Midi merge dropped: " << merge_dropped.load() << std::endl;
+  }
+}
+
+void Midi_Input::ingest_loop(void) {
+  TRACE_THREAD("midi ingest");
+  while (running.load(std::memory_order_relaxed)) {
+    {
+      TRACE_SCOPE("midi_poll");
+      // Anything stamped before this was already sitting in PortMidi's buffer
+      const PmTimestamp watermark = Pt_Time();
+      // Pairs with rescan(), which waits out polling after setting rescanning
+      polling.store(true);
+      if (!rescanning.load()) {
+        for (size_t i = 0; i < devices.size(); i++) {
+          if (devices[i]->opened && !devices[i]->lost.load()) {
+            poll_device(*devices[i]);
+          }
+        }
+      }
+      polling.store(false);
+      const size_t merged_count = merge(watermark);
+      TRACE_COUNT("midi merged", merged_count);
+      if (merged_count > 0 && notify) {
+        notify(notify_data);
+      }
+    }
+    std::this_thread::sleep_for(INGEST_PERIOD);
+  }
+}
+
+// So a stream that goes away can let go of what it was playing
+static void track_held(Midi_Device &dev, const PmEvent &ev) {
+  const u32 status = static_cast<u32>(Pm_MessageStatus(ev.message));
+  const u32 kind = status & STATUS_MASK;
+  if (kind != NOTE_ON && kind != NOTE_OFF) {
+    return;
+  }
+  const size_t key =
+      static_cast<size_t>(Pm_MessageData1(ev.message)) % MIDI_KEYS;
+  const bool on = kind == NOTE_ON && Pm_MessageData2(ev.message) > 0;
+  std::bitset<MIDI_KEYS> &keys = dev.held[status & CHANNEL_MASK];
+  if (keys[key] == on) {
+    return;
+  }
+  keys[key] = on;
+  if (on) {
+    dev.held_notes.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    dev.held_notes.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+void Midi_Input::poll_device(Midi_Device &dev) {
+  Controller &cont = dev.controller;
+  for (;;) {
+    const i32 count = cont.read_input();
+    // PortMidi resets the buffer after reporting it, pick up next round
+    if (count == pmBufferOverflow) {
+      dev.stats.overflows.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    // Any other error is the device going away, its note offs won't come.
+    // The watcher takes it from here
+    if (count < 0) {
+      release_held(dev);
+      dev.lost.store(true);
+      return;
+    }
+    if (count == 0) {
+      return;
+    }
+
+    for (i32 e = 0; e < count; e++) {
+      PmEvent ev = *cont.get_event_at(e);
+      const u32 status = static_cast<u32>(Pm_MessageStatus(ev.message));
+      if (dev.channel != CHANNEL_KEEP && status >= CHANNEL_MESSAGE_MIN &&
+          status <= CHANNEL_MESSAGE_MAX) {
+        ev.message = Pm_Message((status & STATUS_MASK) | (dev.channel - 1),
+                                Pm_MessageData1(ev.message),
+                                Pm_MessageData2(ev.message));
+      }
+      track_held(dev, ev);
+      if (dev.pending.push(ev)) {
+        dev.stats.received.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        dev.stats.dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+// Pushed after everything the device already sent
+void Midi_Input::release_held(Midi_Device &dev) {
+  const PmTimestamp now = Pt_Time();
+  for (size_t ch = 0; ch < MIDI_CHANNELS; ch++) {
+    for (size_t key = 0; key < MIDI_KEYS && dev.held[ch].any(); key++) {
+      if (!dev.held[ch][key]) {
+        continue;
+      }
+      PmEvent ev;
+      ev.message = Pm_Message(NOTE_OFF | ch, key, 0);
+      ev.timestamp = now;
+      if (!dev.pending.push(ev)) {
+        dev.stats.dropped.fetch_add(1, std::memory_order_relaxed);
+      }
+      dev.held[ch][key] = false;
+    }
+  }
+  dev.held_notes.store(0, std::memory_order_relaxed);
+}
+
+// A lost stream is rescanned for straight away. A device that was never
+// there is looked for every period, and when that keeps closing working
+// streams for nothing the period doubles. Either waits for the working
+// streams to let go of every note
+void Midi_Input::watch_loop(void) {
+  TRACE_THREAD("midi watch");
+  auto period = WATCH_PERIOD;
+  auto waited = std::chrono::milliseconds(0);
+  while (running.load(std::memory_order_relaxed)) {
+    std::this_thread::sleep_for(WATCH_STEP);
+    waited += WATCH_STEP;
+    bool missing = false;
+    bool lost = false;
+    bool healthy = false;
+    bool holding = false;
+    for (size_t i = 0; i < devices.size(); i++) {
+      const Midi_Device &dev = *devices[i];
+      if (dev.loopback) {
+        continue;
+      }
+      const bool working = dev.opened && !dev.lost.load();
+      missing = missing || !dev.opened;
+      lost = lost || (dev.opened && !working);
+      healthy = healthy || working;
+      holding = holding || (working && dev.held_notes.load() > 0);
+    }
+    if (holding || (!lost && !(missing && waited >= period))) {
+      continue;
+    }
+
+    TRACE_SCOPE("midi_rescan");
+    size_t found = 0;
+    if (!rescan(found)) {
+      continue;
+    }
+    waited = std::chrono::milliseconds(0);
+    if (lost || found > 0 || !healthy) {
+      period = WATCH_PERIOD;
+    } else {
+      period = std::min(period * 2, WATCH_PERIOD_MAX);
+    }
+  }
+}
+
+// PortMidi has to be torn down to see a new device, which closes every
+// stream. Whatever the open devices already buffered is read out first, they
+// come back on the same names with everything else, still holding what they
+// held. False if draining them turned up a held note, found is how many
+// devices came back or turned up
+bool Midi_Input::rescan(size_t &found) {
+  rescanning.store(true);
+  while (polling.load()) {
+    std::this_thread::yield();
+  }
+
+  std::vector<bool> was_open(devices.size(), false);
+  for (size_t i = 0; i < devices.size(); i++) {
+    Midi_Device &dev = *devices[i];
+    if (dev.opened && !dev.lost.load()) {
+      poll_device(dev);
+      was_open[i] = !dev.lost.load();
+      if (was_open[i] && dev.held_notes.load() > 0) {
+        rescanning.store(false);
+        return false;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < devices.size(); i++) {
+    Midi_Device &dev = *devices[i];
+    if (!dev.opened) {
+      continue;
+    }
+    if (!was_open[i]) {
+      std::cout << "Lost midi device: " << dev.controller.get_name()
+                << std::endl;
+    }
+    dev.controller.close();
+    dev.opened = false;
+    dev.lost.store(false);
+  }
+
+  Pm_Terminate();
+  if (Pm_Initialize() < 0) {
+    std::cerr << "Failed to restart PortMidi!" << std::endl;
+  } else {
+    open_devices(false);
+  }
+  found = 0;
+  for (size_t i = 0; i < devices.size(); i++) {
+    Midi_Device &dev = *devices[i];
+    if (dev.opened && !was_open[i]) {
+      dev.stats.reconnects.fetch_add(1, std::memory_order_relaxed);
+      std::cout << "Midi device connected: " << dev.controller.get_name()
+                << std::endl;
+      found++;
+    }
+  }
+  rescanning.store(false);
+  return true;
+}
+
+// k is tiny (a handful of devices) so a linear scan of the heads beats a heap.
+// Returns how many events were merged
+size_t Midi_Input::merge(PmTimestamp watermark) {
+  size_t count = 0;
+  for (;;) {
+    Midi_Device *next = nullptr;
+    PmTimestamp oldest = watermark;
+    for (size_t i = 0; i < devices.size(); i++) {
+      const PmEvent *head = devices[i]->pending.peek();
+      // Ties go to the lower device index so the order is stable
+      if (head && head->timestamp <= oldest &&
+          (!next || head->timestamp < oldest)) {
+        next = devices[i].get();
+        oldest = head->timestamp;
+      }
+    }
+    if (!next) {
+      return count;
+    }
+
+    PmEvent ev;
+    next->pending.pop(ev);
+    if (merged.push(ev)) {
+      count++;
+    } else {
+      merge_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+}
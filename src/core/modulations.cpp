@@ -1,14 +1,85 @@
-#include "../../inc/synth.hpp"
-#include <cmath>
-
-// Time to HZ forumla: f = 1.0 / T where f is the freq in HZ and T is the period
-// in seconds
-
-void Lfo::increment(f32 rate, i32 sample_rate) {
-  phase += (rate / (f32)sample_rate);
-  if (phase > 1.0f) {
-    phase -= 1.0f;
-  }
-}
-
-f32 Lfo::lfo_sine(void) { return sinf(2.0f * PI * phase); }
+#include "../../inc/synth.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Time to HZ forumla: f = 1.0 / T where f is the freq in HZ and T is the period
+// in seconds
+
+const f32 VIBRATO_MAX_CENTS = 50.0f;
+
+// frames at once so a control tick only costs one step
+void Lfo::increment(f32 rate, i32 sample_rate, size_t frames) {
+  phase += (rate * (f32)frames / (f32)sample_rate);
+  if (phase > 1.0f) {
+    phase -= 1.0f;
+  }
+}
+
+f32 Lfo::lfo_sine(void) { return sinf(2.0f * PI * phase); }
+
+Mod_Matrix::Mod_Matrix(void) : slots(), slot_count(0), rate(MOD_RATE_DEFAULT) {
+  set_defaults();
+}
+
+// What used to be hard wired, vibrato on the wheel, tremolo and bend
+void Mod_Matrix::set_defaults(void) {
+  slots.fill({MOD_SRC_NONE, MOD_SRC_NONE, MOD_DST_NONE, 0.0f});
+  slots[0] = {MOD_SRC_LFO_1, MOD_SRC_MOD_WHEEL, MOD_DST_PITCH,
+              VIBRATO_MAX_CENTS};
+  slots[1] = {MOD_SRC_LFO_2, MOD_SRC_NONE, MOD_DST_GAIN, 1.0f};
+  slots[2] = {MOD_SRC_PITCH_BEND, MOD_SRC_NONE, MOD_DST_PITCH,
+              TWO_SEMITONE_CENTS};
+  slot_count = 3;
+}
+
+void Mod_Matrix::set_rate(size_t val) {
+  rate = std::clamp<size_t>(val, MOD_RATE_MIN, MOD_RATE_MAX);
+}
+
+bool Mod_Matrix::set_slot_at(size_t pos, const Mod_Slot &slot) {
+  if (pos >= slots.size() || slot.source >= MOD_SRC_COUNT ||
+      slot.via >= MOD_SRC_COUNT || slot.dest >= MOD_DST_COUNT) {
+    return false;
+  }
+  slots[pos] = slot;
+  slot_count = std::max(slot_count, pos + 1);
+  return true;
+}
+
+// Audio thread, out of range routes are dropped rather than trusted
+void Mod_Matrix::load(const Preset &preset) {
+  set_rate(preset.mod_rate > 0 ? preset.mod_rate
+                               : static_cast<size_t>(MOD_RATE_DEFAULT));
+  if (preset.mod_count == 0) {
+    set_defaults();
+    return;
+  }
+  slots.fill({MOD_SRC_NONE, MOD_SRC_NONE, MOD_DST_NONE, 0.0f});
+  slot_count = 0;
+  const size_t count = std::min<size_t>(preset.mod_count, MOD_SLOTS);
+  for (size_t i = 0; i < count; i++) {
+    const Preset_Mod &m = preset.mods[i];
+    set_slot_at(i, {m.source, m.via, m.dest, m.amount});
+  }
+}
+
+// An empty matrix still stores one slot so it doesn't read back as defaults
+void Mod_Matrix::store(Preset &preset) const {
+  preset.mod_count = static_cast<u8>(std::max<size_t>(slot_count, 1));
+  preset.mod_rate = static_cast<u8>(rate);
+  for (size_t i = 0; i < slots.size(); i++) {
+    preset.mods[i].source = slots[i].source;
+    preset.mods[i].via = slots[i].via;
+    preset.mods[i].dest = slots[i].dest;
+    preset.mods[i].amount = slots[i].amount;
+  }
+}
+
+void Mod_Matrix::evaluate(const std::array<f32, MOD_SRC_COUNT> &sources,
+                          std::array<f32, MOD_DST_COUNT> &sums) const {
+  sums.fill(0.0f);
+  for (size_t i = 0; i < slot_count; i++) {
+    const Mod_Slot &s = slots[i];
+    sums[s.dest] += sources[s.source] * sources[s.via] * s.amount;
+  }
+}
@@ -0,0 +1,358 @@
+#include "../../inc/graph.hpp"
+#include "../../inc/kernels.hpp"
+#include "../../inc/synth.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// The nodes the default chains are built from. Anything looping over
+// oscillators or channels is a template so the builder can pick the
+// instantiation for the patch instead of the node branching per sample.
+
+static const f32 VOICE_SCALE = 1.0f / sqrtf((f32)VOICES);
+const f32 DELAY_MIX = 0.2f;
+const f32 SAMPLE_MIX = 0.8f;
+const f32 DUTY_MIN = 0.1f;
+const f32 DUTY_MAX = 1.0f;
+const f32 SQRT_2 = 1.41421356f;
+
+static f32 block_peak(const f32 *samples, size_t count) {
+  f32 peak = 0.0f;
+  for (size_t i = 0; i < count; i++) {
+    peak = std::max(peak, fabsf(samples[i]));
+  }
+  return peak;
+}
+
+// Sources frames ahead of now, so a tick's targets land where the ramp ends.
+// The LFOs step the whole tick at once
+static void read_sources(Synth *syn, Voice &v, size_t frames,
+                         std::array<f32, MOD_SRC_COUNT> &src) {
+  const i32 &sample_rate = syn->get_sample_rate();
+  Lfo &lfo_1 = v.get_vibrato_lfo();
+  Lfo &lfo_2 = v.get_trem_lfo();
+  lfo_1.increment(syn->get_vibrato_rate(), sample_rate, frames);
+  lfo_2.increment(syn->get_trem_rate(), sample_rate, frames);
+
+  src[MOD_SRC_NONE] = 1.0f;
+  src[MOD_SRC_LFO_1] = lfo_1.lfo_sine();
+  src[MOD_SRC_LFO_2] = lfo_2.lfo_sine();
+  src[MOD_SRC_ENV] = v.get_envelope();
+  src[MOD_SRC_VELOCITY] = v.get_vol_mult() - 1.0f;
+  src[MOD_SRC_MOD_WHEEL] = syn->get_mod_wheel();
+  src[MOD_SRC_PITCH_BEND] = syn->get_bend();
+}
+
+// The only place the pows and trig run, once per tick instead of per sample
+static void control_values(const Node_Ctx &ctx, size_t frames,
+                           std::array<f32, MOD_OUT_COUNT> &out, f32 &duty) {
+  Synth *syn = ctx.syn;
+  std::array<f32, MOD_SRC_COUNT> src;
+  std::array<f32, MOD_DST_COUNT> sums;
+  read_sources(syn, *ctx.voice, frames, src);
+  syn->get_matrix().evaluate(src, sums);
+
+  const std::array<ParamF32, S_PARAM_COUNT> &param_list =
+      syn->get_param_list();
+  const ParamF32 &cutoff = param_list[S_LOW_PASS];
+  out[MOD_OUT_PITCH] = powf(2.0f, sums[MOD_DST_PITCH] * CENTS_TO_OCTAVE);
+  out[MOD_OUT_CUTOFF] =
+      std::clamp(cutoff.value * powf(2.0f, sums[MOD_DST_CUTOFF]), cutoff.min,
+                 cutoff.max);
+
+  const f32 gain = std::max(
+      1.0f + sums[MOD_DST_GAIN] * param_list[S_TREMOLO_DEPTH].value, 0.0f);
+  out[MOD_OUT_GAIN_L] = gain;
+  out[MOD_OUT_GAIN_R] = gain;
+  // Equal power, scaled so the centre is unity like it was before pan
+  if (ctx.channels > 1 && sums[MOD_DST_PAN] != 0.0f) {
+    const f32 pan = std::clamp(sums[MOD_DST_PAN], -1.0f, 1.0f);
+    const f32 angle = (pan + 1.0f) * PI * 0.25f;
+    out[MOD_OUT_GAIN_L] = gain * cosf(angle) * SQRT_2;
+    out[MOD_OUT_GAIN_R] = gain * sinf(angle) * SQRT_2;
+  }
+  duty = sums[MOD_DST_DUTY];
+}
+
+// Runs the matrix every control tick and ramps between ticks. Cutoff is held
+// since the filter recomputes its coefficient whenever the value moves
+class Mod_Node : public Node {
+public:
+  Mod_Node(void)
+      : Node("mod", {},
+             {PORT_CONTROL, PORT_CONTROL, PORT_CONTROL, PORT_CONTROL}) {}
+  void process(const Node_Ctx &ctx, const f32 *const *in,
+               f32 *const *out) override {
+    (void)in;
+    Mod_State &st = ctx.voice->get_mod_state();
+    const size_t rate = ctx.syn->get_matrix().get_rate();
+    if (!st.primed) {
+      control_values(ctx, 0, st.current, st.duty);
+      st.step.fill(0.0f);
+      st.countdown = 0;
+      st.primed = true;
+    }
+
+    std::array<f32, MOD_OUT_COUNT> target;
+    for (size_t n = 0; n < ctx.frames; n++) {
+      if (st.countdown == 0) {
+        control_values(ctx, rate, target, st.duty);
+        for (size_t k = 0; k < MOD_OUT_COUNT; k++) {
+          st.step[k] = (target[k] - st.current[k]) / (f32)rate;
+        }
+        st.current[MOD_OUT_CUTOFF] = target[MOD_OUT_CUTOFF];
+        st.step[MOD_OUT_CUTOFF] = 0.0f;
+        st.countdown = rate;
+      }
+      st.countdown--;
+      for (size_t k = 0; k < MOD_OUT_COUNT; k++) {
+        st.current[k] += st.step[k];
+        out[k][n] = st.current[k];
+      }
+    }
+  }
+};
+
+// Pitch ratio in, duty offset is read off the voice once per block. The
+// waveforms are fixed when the chain is built, so each osc calls its kernel
+// directly and the loop over them has a compile time bound
+template <size_t OSC> class Osc_Node : public Node {
+public:
+  Osc_Node(const std::array<size_t, OSC> &_waves)
+      : Node("osc", {PORT_CONTROL}, {PORT_MONO}), waves(_waves) {}
+  void process(const Node_Ctx &ctx, const f32 *const *in,
+               f32 *const *out) override {
+    Synth *syn = ctx.syn;
+    Voice &v = *ctx.voice;
+    const f32 inv_rate = 1.0f / (f32)syn->get_sample_rate();
+
+    std::array<f32, BLOCK_FRAMES> freq;
+    const f32 base_freq = v.get_freq();
+    for (size_t n = 0; n < ctx.frames; n++) {
+      freq[n] = base_freq * in[0][n];
+      out[0][n] = 0.0f;
+    }
+
+    // The chain and the oscs come from the same preset and swap together,
+    // this only guards against a chain outliving its patch
+    std::vector<Oscillator> &oscs = syn->get_oscillators();
+    if (oscs.size() < OSC) {
+      return;
+    }
+    const Generator &gen = syn->get_generator();
+    const f32 duty_mod = v.get_mod_state().duty;
+    for (size_t o = 0; o < OSC; o++) {
+      const f32 duty =
+          std::clamp(oscs[o].get_duty() + duty_mod, DUTY_MIN, DUTY_MAX);
+      render_osc_as(waves[o], gen, oscs[o], ctx.voice_iter, freq.data(), duty,
+                    out[0], ctx.frames, inv_rate);
+    }
+  }
+
+private:
+  std::array<size_t, OSC> waves;
+};
+
+class Clip_Node : public Node {
+public:
+  Clip_Node(void) : Node("clip", {PORT_MONO}, {PORT_MONO}) {}
+  void process(const Node_Ctx &ctx, const f32 *const *in,
+               f32 *const *out) override {
+    const f32 &gain = ctx.syn->get_param_list()[S_GAIN].value;
+    for (size_t n = 0; n < ctx.frames; n++) {
+      out[0][n] = ctx.syn->polynomial_soft_clip(&in[0][n], gain);
+    }
+  }
+};
+
+// Mono and cutoff in, one filter state per channel out. The cutoff only
+// steps on a control tick so the coefficient is rarely recomputed
+template <size_t CH> class Filter_Node : public Node {
+public:
+  Filter_Node(void)
+      : Node("filter", {PORT_MONO, PORT_CONTROL}, {PORT_AUDIO}) {}
+  void process(const Node_Ctx &ctx, const f32 *const *in,
+               f32 *const *out) override {
+    LPF &lpf = ctx.voice->get_lpf();
+    const i32 &sample_rate = ctx.syn->get_sample_rate();
+    f32 cutoff = in[1][0];
+    f32 filter_alpha = lpf.alpha(cutoff, sample_rate);
+    std::array<f32, CHANNEL_MAX> &low = lpf.get_array();
+    for (size_t n = 0; n < ctx.frames; n++) {
+      if (in[1][n] != cutoff) {
+        cutoff = in[1][n];
+        filter_alpha = lpf.alpha(cutoff, sample_rate);
+      }
+      for (size_t c = 0; c < CH; c++) {
+        lerp_f32(&in[0][n], &low[c], filter_alpha);
+        out[0][n * CH + c] = low[c];
+      }
+    }
+  }
+};
+
+// Envelope, velocity and the per osc / per voice scaling
+template <size_t CH> class Env_Node : public Node {
+public:
+  Env_Node(void) : Node("envelope", {PORT_AUDIO}, {PORT_AUDIO}) {}
+  void process(const Node_Ctx &ctx, const f32 *const *in,
+               f32 *const *out) override {
+    Voice &v = *ctx.voice;
+    const std::array<ParamF32, S_PARAM_COUNT> &param_list =
+        ctx.syn->get_param_list();
+    const f32 &attack = param_list[S_ATTACK].value;
+    const f32 &decay = param_list[S_DECAY].value;
+    const f32 &sustain = param_list[S_SUSTAIN].value;
+    const f32 &release = param_list[S_RELEASE].value;
+    const f32 scale = ctx.syn->get_plan().osc_scale * VOICE_SCALE *
+                      param_list[S_VOLUME].value;
+    const f32 dt = ctx.syn->get_dt();
+
+    for (size_t n = 0; n < ctx.frames; n++) {
+      v.adsr(dt, attack, decay, sustain, release);
+      const f32 amp = v.get_vol_mult() * v.get_envelope() * scale;
+      for (size_t c = 0; c < CH; c++) {
+        out[0][n * CH + c] = in[0][n * CH + c] * amp;
+      }
+    }
+  }
+};
+
+// Gain and pan from the matrix, the tremolo lives here now
+template <size_t CH> class Amp_Node : public Node {
+public:
+  Amp_Node(void)
+      : Node("amp", {PORT_AUDIO, PORT_CONTROL, PORT_CONTROL}, {PORT_AUDIO}) {}
+  void process(const Node_Ctx &ctx, const f32 *const *in,
+               f32 *const *out) override {
+    for (size_t n = 0; n < ctx.frames; n++) {
+      for (size_t c = 0; c < CH; c++) {
+        out[0][n * CH + c] = in[0][n * CH + c] * in[1 + (c & 1)][n];
+      }
+    }
+  }
+};
+
+class Delay_Node : public Node {
+public:
+  Delay_Node(void) : Node("delay", {PORT_AUDIO}, {PORT_AUDIO}) {}
+  void process(const Node_Ctx &ctx, const f32 *const *in,
+               f32 *const *out) override {
+    Delay &delay = ctx.syn->get_delay();
+    const f32 threshold = ctx.syn->get_silence_threshold();
+    const size_t count = ctx.frames * ctx.channels;
+    if (delay.is_idle() && block_peak(in[0], count) < threshold) {
+      memset(out[0], 0, count * sizeof(f32));
+      return;
+    }
+
+    f32 peak = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+      const f32 delayed = delay.delay_read();
+      const f32 mixed =
+          SAMPLE_MIX * in[0][i] + DELAY_MIX * tanhf(in[0][i] + delayed);
+      out[0][i] = mixed;
+      delay.delay_write(mixed);
+      peak = std::max(peak, fabsf(mixed));
+    }
+    delay.track_tail(peak, count, threshold);
+  }
+};
+
+class Copy_Node : public Node {
+public:
+  Copy_Node(void) : Node("copy", {PORT_AUDIO}, {PORT_AUDIO}) {}
+  void process(const Node_Ctx &ctx, const f32 *const *in,
+               f32 *const *out) override {
+    memcpy(out[0], in[0], ctx.frames * ctx.channels * sizeof(f32));
+  }
+};
+
+// Out of range waveforms play as saw, like apply_patch clamps them
+template <size_t OSC>
+static std::unique_ptr<Node> make_osc_node(const Preset &preset) {
+  std::array<size_t, OSC> waves;
+  for (size_t o = 0; o < OSC; o++) {
+    const i32 wf = preset.oscs[o].waveform;
+    waves[o] = wf >= 0 && wf < (i32)WAVEFORM_COUNT ? (size_t)wf : SAW;
+  }
+  return std::make_unique<Osc_Node<OSC>>(waves);
+}
+
+static std::unique_ptr<Node> make_osc_node(const Preset &preset) {
+  switch (std::clamp<size_t>(preset.osc_count, 1, MAX_OSC_COUNT)) {
+  default:
+    return make_osc_node<1>(preset);
+  case 2:
+    return make_osc_node<2>(preset);
+  case 3:
+    return make_osc_node<3>(preset);
+  case 4:
+    return make_osc_node<4>(preset);
+  case 5:
+    return make_osc_node<5>(preset);
+  case 6:
+    return make_osc_node<6>(preset);
+  }
+}
+
+template <size_t CH>
+static bool build_voice_chain(Graph &graph, const Preset &preset) {
+  const u32 flags = preset.flags;
+  graph.clear();
+  const size_t mod = graph.add_node(std::make_unique<Mod_Node>());
+  size_t last = graph.add_node(make_osc_node(preset));
+  if (!graph.connect(mod, MOD_OUT_PITCH, last, 0)) {
+    return false;
+  }
+
+  if (!(flags & CHAIN_NO_SATURATE)) {
+    const size_t clip = graph.add_node(std::make_unique<Clip_Node>());
+    if (!graph.connect(last, 0, clip, 0)) {
+      return false;
+    }
+    last = clip;
+  }
+
+  const size_t lpf = graph.add_node(std::make_unique<Filter_Node<CH>>());
+  const size_t env = graph.add_node(std::make_unique<Env_Node<CH>>());
+  if (!(graph.connect(last, 0, lpf, 0) &&
+        graph.connect(mod, MOD_OUT_CUTOFF, lpf, 1) &&
+        graph.connect(lpf, 0, env, 0))) {
+    return false;
+  }
+  last = env;
+
+  if (!(flags & CHAIN_NO_TREMOLO)) {
+    const size_t amp = graph.add_node(std::make_unique<Amp_Node<CH>>());
+    if (!(graph.connect(last, 0, amp, 0) &&
+          graph.connect(mod, MOD_OUT_GAIN_L, amp, 1) &&
+          graph.connect(mod, MOD_OUT_GAIN_R, amp, 2))) {
+      return false;
+    }
+    last = amp;
+  }
+
+  return graph.set_output(last, 0) && graph.compile();
+}
+
+bool build_voice_graph(Graph &graph, const Preset &preset, i32 channels) {
+  if (channels > 1) {
+    return build_voice_chain<2>(graph, preset);
+  }
+  return build_voice_chain<1>(graph, preset);
+}
+
+bool build_master_graph(Graph &graph, i32 channels, u32 flags) {
+  (void)channels;
+  graph.clear();
+  size_t last = 0;
+  if (flags & CHAIN_NO_DELAY) {
+    last = graph.add_node(std::make_unique<Copy_Node>());
+  } else {
+    last = graph.add_node(std::make_unique<Delay_Node>());
+  }
+  return graph.connect(GRAPH_INPUT, 0, last, 0) && graph.set_output(last, 0) &&
+         graph.compile();
+}
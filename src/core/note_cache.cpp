@@ -0,0 +1,355 @@
+#include "../../inc/note_cache.hpp"
+#include "../../inc/rt_thread.hpp"
+#include "../../inc/trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+const std::chrono::milliseconds NOTE_CACHE_IDLE(2);
+// No velocity route, rendered at velocity 0 and scaled on the way out
+const f32 LAYER_ANY = -1.0f;
+
+// The middle of the velocity's band. Amplitude is scaled back to the live
+// velocity on the way out, only what a route does with it is quantized
+static f32 velocity_band(f32 velocity) {
+  const f32 bands = static_cast<f32>(NOTE_CACHE_VELOCITY_BANDS);
+  const f32 band = std::clamp(floorf(velocity * bands), 0.0f, bands - 1.0f);
+  return (band + 0.5f) / bands;
+}
+
+Note_Cache::Note_Cache(void)
+    : entries(), bindings(), requests(), patches(), scratch(), running(false),
+      worker(), ms(NOTE_CACHE_MS_DEFAULT), generation(1), sent_generation(0),
+      clock(0), hits(0), misses(0) {}
+
+Note_Cache::~Note_Cache(void) { stop(); }
+
+bool Note_Cache::start(size_t _ms, i32 sample_rate_max) {
+  if (running.load() || _ms == 0 || sample_rate_max <= 0) {
+    return false;
+  }
+  ms = std::min<size_t>(_ms, NOTE_CACHE_MS_MAX);
+  const size_t frames_max =
+      (ms * static_cast<size_t>(sample_rate_max) / 1000 + BLOCK_FRAMES - 1) /
+      BLOCK_FRAMES * BLOCK_FRAMES;
+  for (size_t i = 0; i < entries.size(); i++) {
+    Note_Entry &e = entries[i];
+    e.state.store(NOTE_EMPTY);
+    e.samples.assign(frames_max * CHANNEL_MAX, 0.0f);
+    e.snapshots.resize(frames_max / BLOCK_FRAMES + 1);
+  }
+  for (size_t i = 0; i < bindings.size(); i++) {
+    bindings[i] = {false, 0, 0, 1.0f};
+  }
+  running.store(true);
+  worker = std::thread(&Note_Cache::work_loop, this);
+  return true;
+}
+
+void Note_Cache::stop(void) {
+  if (!running.exchange(false)) {
+    return;
+  }
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+// Routes that can't sound right now are ignored, anything else has to read
+// only what's fixed for the length of the note
+bool Note_Cache::cacheable(const Synth &syn, bool &by_velocity) const {
+  by_velocity = false;
+  const Mod_Matrix &matrix = syn.get_matrix();
+  const u32 flags = syn.get_active_program().preset.flags;
+  const f32 tremolo = syn.get_param_list()[S_TREMOLO_DEPTH].value;
+  for (size_t i = 0; i < matrix.get_slot_count(); i++) {
+    const Mod_Slot &s = matrix.get_slot_at(i);
+    if (s.dest == MOD_DST_NONE || s.amount == 0.0f) {
+      continue;
+    }
+    const bool amp = s.dest == MOD_DST_GAIN || s.dest == MOD_DST_PAN;
+    if ((amp && (flags & CHAIN_NO_TREMOLO)) ||
+        (s.dest == MOD_DST_GAIN && tremolo == 0.0f) ||
+        (s.dest == MOD_DST_PAN && syn.get_channels() == 1)) {
+      continue;
+    }
+
+    bool zero = false, varies = false;
+    const u8 factors[] = {s.source, s.via};
+    for (size_t f = 0; f < ARR_LEN(factors); f++) {
+      switch (factors[f]) {
+      default:
+        break;
+      case MOD_SRC_LFO_1:
+      case MOD_SRC_LFO_2:
+        varies = true;
+        break;
+      case MOD_SRC_MOD_WHEEL:
+        zero = zero || syn.get_mod_wheel() == 0.0f;
+        varies = true;
+        break;
+      case MOD_SRC_PITCH_BEND:
+        zero = zero || syn.get_bend() == 0.0f;
+        varies = true;
+        break;
+      case MOD_SRC_VELOCITY:
+        by_velocity = true;
+        break;
+      }
+    }
+    if (varies && !zero) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// A ready entry for this generation, or pending if one is on its way
+size_t Note_Cache::find(u32 key, f32 layer, bool &pending) const {
+  pending = false;
+  for (size_t i = 0; i < entries.size(); i++) {
+    const Note_Entry &e = entries[i];
+    if (e.key != key || e.layer != layer || e.generation != generation) {
+      continue;
+    }
+    const u8 state = e.state.load(std::memory_order_acquire);
+    if (state == NOTE_READY) {
+      return i;
+    }
+    pending = pending || state == NOTE_RENDERING;
+  }
+  return NOTE_CACHE_SLOTS;
+}
+
+// Empty first, then stale, then the least recently used. Never one that's
+// rendering or has a voice on it
+size_t Note_Cache::claim(void) {
+  size_t best = NOTE_CACHE_SLOTS;
+  u64 best_rank = UINT64_MAX;
+  for (size_t i = 0; i < entries.size(); i++) {
+    const Note_Entry &e = entries[i];
+    const u8 state = e.state.load(std::memory_order_acquire);
+    if (state == NOTE_RENDERING || e.users > 0) {
+      continue;
+    }
+    if (state == NOTE_EMPTY) {
+      return i;
+    }
+    const u64 rank = e.generation != generation ? 0 : e.last_used;
+    if (rank < best_rank) {
+      best_rank = rank;
+      best = i;
+    }
+  }
+  return best;
+}
+
+bool Note_Cache::request(const Synth &syn, size_t slot) {
+  Note_Entry &e = entries[slot];
+  if (sent_generation != generation) {
+    Note_Patch patch;
+    patch.generation = generation;
+    patch.sample_rate = syn.get_sample_rate();
+    patch.channels = syn.get_channels();
+    syn.store_patch(patch.preset);
+    if (!patches.push(patch)) {
+      return false;
+    }
+    sent_generation = generation;
+  }
+  return requests.push({static_cast<u32>(slot), e.key, e.layer, generation});
+}
+
+// Right after the voice was started live, a hit takes it over from frame 0
+void Note_Cache::note_on(Synth &syn, size_t voice, f32 velocity) {
+  unbind(voice);
+  bool by_velocity = false;
+  if (!running.load(std::memory_order_relaxed) ||
+      !cacheable(syn, by_velocity)) {
+    return;
+  }
+  Voice &v = syn.get_voices()[voice];
+  const u32 key = v.get_key();
+  const f32 layer = by_velocity ? velocity_band(velocity) : LAYER_ANY;
+  // Rendered at a volume multiplier of 1 + its velocity, 0 without a layer
+  const f32 scale = v.get_vol_mult() / (1.0f + (by_velocity ? layer : 0.0f));
+
+  bool pending = false;
+  const size_t found = find(key, layer, pending);
+  if (found < NOTE_CACHE_SLOTS) {
+    Note_Entry &e = entries[found];
+    e.users++;
+    e.last_used = ++clock;
+    bindings[voice] = {true, static_cast<u32>(found), 0, scale};
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  misses.fetch_add(1, std::memory_order_relaxed);
+  if (pending) {
+    return;
+  }
+
+  const size_t slot = claim();
+  if (slot >= NOTE_CACHE_SLOTS) {
+    return;
+  }
+  Note_Entry &e = entries[slot];
+  const size_t rate = static_cast<size_t>(syn.get_sample_rate());
+  e.state.store(NOTE_RENDERING, std::memory_order_relaxed);
+  e.key = key;
+  e.layer = layer;
+  e.generation = generation;
+  e.frames = std::min((ms * rate / 1000 + BLOCK_FRAMES - 1) / BLOCK_FRAMES *
+                          BLOCK_FRAMES,
+                      (e.snapshots.size() - 1) * BLOCK_FRAMES);
+  e.last_used = ++clock;
+  if (!request(syn, slot)) {
+    e.state.store(NOTE_EMPTY, std::memory_order_relaxed);
+  }
+}
+
+void Note_Cache::unbind(size_t voice) {
+  Note_Binding &b = bindings[voice];
+  if (b.active) {
+    entries[b.slot].users--;
+    b.active = false;
+  }
+}
+
+// Velocity and the LFOs stay the live voice's. Nothing cached read the LFOs,
+// they're stepped once per control tick the frames would have run
+void Note_Cache::restore(Synth &syn, size_t voice, const Note_Snapshot &snap,
+                         size_t frames) {
+  Voice &v = syn.get_voices()[voice];
+  const f32 vol = v.get_vol_mult();
+  Lfo vibrato = v.get_vibrato_lfo();
+  Lfo tremolo = v.get_trem_lfo();
+  const size_t rate = syn.get_matrix().get_rate();
+  const size_t ticks = (frames + rate - 1) / rate;
+  for (size_t t = 0; t < ticks; t++) {
+    vibrato.increment(syn.get_vibrato_rate(), syn.get_sample_rate(), rate);
+    tremolo.increment(syn.get_trem_rate(), syn.get_sample_rate(), rate);
+  }
+  v = snap.voice;
+  v.set_vol_mult(vol);
+  v.get_vibrato_lfo() = vibrato;
+  v.get_trem_lfo() = tremolo;
+  std::vector<Oscillator> &oscs = syn.get_oscillators();
+  for (size_t o = 0; o < oscs.size() && o < snap.phases.size(); o++) {
+    *oscs[o].get_phase_at(voice) = snap.phases[o];
+  }
+}
+
+size_t Note_Cache::play(Synth &syn, size_t voice, f32 *out, size_t frames) {
+  Note_Binding &b = bindings[voice];
+  const Note_Entry &e = entries[b.slot];
+  const size_t channels = static_cast<size_t>(syn.get_channels());
+  const size_t n = std::min(frames, e.frames - b.pos);
+  const f32 *src = e.samples.data() + b.pos * channels;
+  for (size_t s = 0; s < n * channels; s++) {
+    out[s] = src[s] * b.scale;
+  }
+  b.pos += n;
+
+  Voice &v = syn.get_voices()[voice];
+  if (b.pos >= e.frames) {
+    restore(syn, voice, e.snapshots[e.frames / BLOCK_FRAMES], e.frames);
+    unbind(voice);
+  } else {
+    // For the meters and voice stealing, the chain isn't touching it
+    const Voice &at = e.snapshots[b.pos / BLOCK_FRAMES].voice;
+    v.set_envelope(at.get_envelope());
+    v.set_env_state(at.get_env_state());
+  }
+  return n;
+}
+
+void Note_Cache::leave(Synth &syn, size_t voice) {
+  Note_Binding &b = bindings[voice];
+  if (!b.active) {
+    return;
+  }
+  TRACE_SCOPE_ARG("note_cache_leave", voice);
+  const Note_Entry &e = entries[b.slot];
+  const size_t block = b.pos / BLOCK_FRAMES;
+  restore(syn, voice, e.snapshots[block], block * BLOCK_FRAMES);
+  const size_t rest = b.pos - block * BLOCK_FRAMES;
+  unbind(voice);
+  if (rest > 0) {
+    Node_Ctx ctx = {&syn, &syn.get_voices()[voice], voice, rest,
+                    static_cast<size_t>(syn.get_channels())};
+    syn.get_active_program().voice_graph.run(ctx, nullptr, scratch.data());
+  }
+}
+
+void Note_Cache::leave_all(Synth &syn) {
+  for (size_t i = 0; i < bindings.size(); i++) {
+    leave(syn, i);
+  }
+}
+
+void Note_Cache::work_loop(void) {
+  TRACE_THREAD("note_cache");
+  rt_enter_thread("note cache", RT_WORKER);
+  std::unique_ptr<Synth> wsyn = std::make_unique<Synth>();
+  std::unique_ptr<Program> prog = std::make_unique<Program>();
+  wsyn->set_fixed_phase(true);
+  u64 current = 0;
+  bool usable = false;
+
+  while (running.load(std::memory_order_relaxed)) {
+    Note_Request req;
+    if (!requests.pop(req)) {
+      std::this_thread::sleep_for(NOTE_CACHE_IDLE);
+      continue;
+    }
+    // Patches go in ahead of the requests that need them
+    const Note_Patch *next = patches.peek();
+    while (next && next->generation <= req.generation) {
+      current = next->generation;
+      usable = wsyn->set_output_format(next->sample_rate, next->channels);
+      if (usable) {
+        wsyn->apply_patch(next->preset);
+        usable = wsyn->build_program(*prog, next->preset);
+      }
+      Note_Patch done;
+      patches.pop(done);
+      next = patches.peek();
+    }
+
+    Note_Entry &e = entries[req.slot];
+    if (current != req.generation || !usable) {
+      e.state.store(NOTE_EMPTY, std::memory_order_release);
+      continue;
+    }
+    render(*wsyn, prog->voice_graph, e, req.key, req.layer);
+    e.state.store(NOTE_READY, std::memory_order_release);
+  }
+}
+
+// Voice 0 of the private synth, started the way a live note would be
+void Note_Cache::render(Synth &wsyn, Graph &graph, Note_Entry &entry, u32 key,
+                        f32 layer) {
+  TRACE_SCOPE_ARG("note_cache_render", key);
+  wsyn.start_voice(0, key, layer < 0.0f ? 0.0f : layer);
+  Voice &v = wsyn.get_voices()[0];
+  std::vector<Oscillator> &oscs = wsyn.get_oscillators();
+  const size_t channels = static_cast<size_t>(wsyn.get_channels());
+  const size_t blocks = entry.frames / BLOCK_FRAMES;
+  Node_Ctx ctx = {&wsyn, &v, 0, BLOCK_FRAMES, channels};
+  for (size_t b = 0; b <= blocks; b++) {
+    Note_Snapshot &snap = entry.snapshots[b];
+    snap.voice = v;
+    for (size_t o = 0; o < oscs.size(); o++) {
+      snap.phases[o] = *oscs[o].get_phase_at(0);
+    }
+    if (b < blocks) {
+      graph.run(ctx, nullptr,
+                entry.samples.data() + b * BLOCK_FRAMES * channels);
+    }
+  }
+}
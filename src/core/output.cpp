@@ -0,0 +1,109 @@
+#include "../../inc/audio_sys.hpp"
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Keep the float max below 2^31, 2147483647 isn't representable as f32
+const f32 S16_SCALE = 32767.0f;
+const f32 S32_SCALE = 2147483520.0f;
+const f32 U24_NORM = 1.0f / 16777216.0f;
+
+Dither::Dither(u32 seed) : state(), active(false) {
+  // xorshift dies on a zero state
+  for (size_t i = 0; i < state.size(); i++) {
+    state[i] = (seed + static_cast<u32>(i) * 0x9E3779B9u) | 1u;
+  }
+}
+
+// Uniform in [-0.5, 0.5) LSB from the top 24 bits of lane 0
+f32 Dither::uniform(void) {
+  u32 &s = state[0];
+  s ^= s << 13;
+  s ^= s >> 17;
+  s ^= s << 5;
+  return static_cast<f32>(s >> 8) * U24_NORM - 0.5f;
+}
+
+// Sum of two uniforms, triangular over [-1, 1) LSB
+f32 Dither::tpdf(void) { return active ? uniform() + uniform() : 0.0f; }
+
+void expand_channels(const f32 *in, f32 *out, size_t frames, size_t in_chan,
+                     size_t out_chan) {
+  for (size_t n = 0; n < frames; n++) {
+    for (size_t c = 0; c < out_chan; c++) {
+      out[n * out_chan + c] = c < in_chan ? in[n * in_chan + c] : 0.0f;
+    }
+  }
+}
+
+static inline i16 to_s16(f32 sample, f32 noise) {
+  f32 x = sample * S16_SCALE + noise;
+  x = x > S16_SCALE ? S16_SCALE : (x < -S16_SCALE - 1.0f ? -S16_SCALE - 1.0f : x);
+  return static_cast<i16>(lrintf(x));
+}
+
+static inline i32 to_s32(f32 sample) {
+  f32 x = sample * S32_SCALE;
+  x = x > S32_SCALE ? S32_SCALE : (x < -S32_SCALE ? -S32_SCALE : x);
+  return static_cast<i32>(lrintf(x));
+}
+
+#if defined(__SSE2__)
+static inline __m128 uniform_sse(__m128i &s) {
+  s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+  s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+  s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+  const __m128 u = _mm_cvtepi32_ps(_mm_srli_epi32(s, 8));
+  return _mm_sub_ps(_mm_mul_ps(u, _mm_set1_ps(U24_NORM)), _mm_set1_ps(0.5f));
+}
+
+static inline __m128i to_s16_sse(__m128 x, __m128 noise) {
+  x = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(S16_SCALE)), noise);
+  x = _mm_min_ps(x, _mm_set1_ps(S16_SCALE));
+  x = _mm_max_ps(x, _mm_set1_ps(-S16_SCALE - 1.0f));
+  return _mm_cvtps_epi32(x);
+}
+#endif
+
+void convert_f32_to_s16(const f32 *in, i16 *out, size_t count,
+                        Dither &dither) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  __m128i s = _mm_loadu_si128(reinterpret_cast<__m128i *>(dither.lanes()));
+  const bool active = dither.get_active_state();
+  for (; i + 8 <= count; i += 8) {
+    __m128 n0 = _mm_setzero_ps(), n1 = _mm_setzero_ps();
+    if (active) {
+      n0 = _mm_add_ps(uniform_sse(s), uniform_sse(s));
+      n1 = _mm_add_ps(uniform_sse(s), uniform_sse(s));
+    }
+    const __m128i lo = to_s16_sse(_mm_loadu_ps(in + i), n0);
+    const __m128i hi = to_s16_sse(_mm_loadu_ps(in + i + 4), n1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_packs_epi32(lo, hi));
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dither.lanes()), s);
+#endif
+  for (; i < count; i++) {
+    out[i] = to_s16(in[i], dither.tpdf());
+  }
+}
+
+// 32 bit output already sits far below the f32 mantissa, no dither needed
+void convert_f32_to_s32(const f32 *in, i32 *out, size_t count) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps(S32_SCALE);
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+    x = _mm_min_ps(x, scale);
+    x = _mm_max_ps(x, _mm_sub_ps(_mm_setzero_ps(), scale));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_cvtps_epi32(x));
+  }
+#endif
+  for (; i < count; i++) {
+    out[i] = to_s32(in[i]);
+  }
+}
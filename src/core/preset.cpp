@@ -0,0 +1,114 @@
+#include "../../inc/preset.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+Preset_Bank::Preset_Bank(std::string _file_path)
+    : file_path(_file_path), map() {}
+
+Preset_Bank::~Preset_Bank(void) { close(); }
+
+bool Preset_Bank::open(void) {
+  if (!map.open(file_path)) {
+    return false;
+  }
+
+  const Preset_Header *header =
+      reinterpret_cast<const Preset_Header *>(map.data());
+  if (map.size() < sizeof(Preset_Header) || header->magic != PRESET_MAGIC) {
+    std::cerr << "Not a preset bank: " << file_path << std::endl;
+    close();
+    return false;
+  }
+
+  if (header->version != PRESET_VERSION ||
+      header->record_size != sizeof(Preset)) {
+    std::cerr << "Unsupported preset bank version: " << header->version
+              << std::endl;
+    close();
+    return false;
+  }
+
+  const size_t needed = sizeof(Preset_Header) + header->count * sizeof(Preset);
+  if (header->count > PRESET_COUNT_MAX || map.size() < needed) {
+    std::cerr << "Preset bank is truncated: " << file_path << std::endl;
+    close();
+    return false;
+  }
+
+  std::cout << "Loaded " << header->count << " presets from " << file_path
+            << std::endl;
+  return true;
+}
+
+void Preset_Bank::close(void) { map.close(); }
+
+u32 Preset_Bank::get_count(void) const {
+  if (!map.is_open()) {
+    return 0;
+  }
+  return reinterpret_cast<const Preset_Header *>(map.data())->count;
+}
+
+const Preset *Preset_Bank::get_preset_at(u32 program) const {
+  if (program >= get_count()) {
+    return nullptr;
+  }
+  return reinterpret_cast<const Preset *>(map.data() + sizeof(Preset_Header)) +
+         program;
+}
+
+// Plain writes then remap, this only ever runs from the UI
+bool Preset_Bank::store(u32 program, const Preset &preset) {
+  if (program >= PRESET_COUNT_MAX) {
+    std::cerr << "Program out of range: " << program << std::endl;
+    return false;
+  }
+
+  Preset_Header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = PRESET_MAGIC;
+  header.version = PRESET_VERSION;
+  header.record_size = sizeof(Preset);
+  header.count = std::max(get_count(), program + 1);
+
+  // Unused slots below the new one get zeroed records
+  const u32 old_count = get_count();
+  map.close();
+
+  std::fstream out(file_path, std::ios::in | std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    out.open(file_path, std::ios::out | std::ios::binary);
+  }
+  if (!out.is_open()) {
+    std::cerr << "Failed to open preset bank for writing: " << file_path
+              << std::endl;
+    return false;
+  }
+
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  Preset empty;
+  memset(&empty, 0, sizeof(empty));
+  for (u32 i = old_count; i < program; i++) {
+    out.seekp(static_cast<std::streamoff>(sizeof(Preset_Header) +
+                                          i * sizeof(Preset)));
+    out.write(reinterpret_cast<const char *>(&empty), sizeof(empty));
+  }
+
+  out.seekp(static_cast<std::streamoff>(sizeof(Preset_Header) +
+                                        program * sizeof(Preset)));
+  out.write(reinterpret_cast<const char *>(&preset), sizeof(preset));
+  if (!out.good()) {
+    std::cerr << "Failed to write preset: " << file_path << std::endl;
+    return false;
+  }
+  out.close();
+
+  std::cout << "Stored program " << program << " in " << file_path
+            << std::endl;
+  return map.open(file_path);
+}
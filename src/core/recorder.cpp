@@ -0,0 +1,263 @@
+#include "../../inc/recorder.hpp"
+#include "../../inc/wav.hpp"
+
+#include <SDL3/SDL.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// O_DIRECT wants the buffer, offset and size all on this
+const size_t RECORD_ALIGN = 4096;
+const std::chrono::milliseconds RECORD_PERIOD(20);
+
+Recorder::Recorder(void)
+    : ring(), running(false), armed(false), busy(false), dropped(0), writer(),
+      path(), take_rate(0), take_channels(0), staging(nullptr),
+      encoded(nullptr), data_bytes(0), direct(false), failed(false),
+#ifdef _WIN32
+      file(nullptr) {
+}
+#else
+      fd(-1) {
+}
+#endif
+
+Recorder::~Recorder(void) {
+  stop();
+  SDL_aligned_free(staging);
+  SDL_aligned_free(encoded);
+}
+
+bool Recorder::start(const std::string &_path, i32 sample_rate,
+                     i32 channels) {
+  if (running.load() || sample_rate <= 0 || channels < 1 ||
+      channels > static_cast<i32>(CHANNEL_MAX)) {
+    return false;
+  }
+  // First take only, the ring is 4MB and most sessions never record
+  if (!ring) {
+    const size_t samples = RECORD_CHUNK_FRAMES * CHANNEL_MAX;
+    ring = std::make_unique<Record_Ring>();
+    staging = static_cast<f32 *>(
+        SDL_aligned_alloc(RECORD_ALIGN, samples * sizeof(f32)));
+    encoded = static_cast<u8 *>(
+        SDL_aligned_alloc(RECORD_ALIGN, samples * (RECORD_BITS / 8)));
+    if (!(staging && encoded)) {
+      std::cerr << "Failed to allocate recording buffers" << std::endl;
+      ring.reset();
+      SDL_aligned_free(staging);
+      SDL_aligned_free(encoded);
+      staging = nullptr;
+      encoded = nullptr;
+      return false;
+    }
+  }
+
+  path = _path;
+  take_rate = sample_rate;
+  take_channels = channels;
+  data_bytes = 0;
+  failed = false;
+  if (!open_file()) {
+    std::cerr << "Failed to open recording for writing: " << path
+              << std::endl;
+    return false;
+  }
+  // Placeholder until stop knows the size
+  wav_stream_header(encoded, static_cast<u32>(channels),
+                    static_cast<u32>(sample_rate), RECORD_BITS, 0);
+  if (!write_at(0, encoded, WAV_STREAM_HEADER_SIZE)) {
+    std::cerr << "Failed to write recording: " << path << std::endl;
+    close_file();
+    return false;
+  }
+
+  dropped.store(0);
+  running.store(true);
+  writer = std::thread(&Recorder::write_loop, this);
+  armed.store(true);
+  std::cout << "Recording to " << path << (direct ? " (direct)" : "")
+            << std::endl;
+  return true;
+}
+
+void Recorder::stop(void) {
+  if (!running.load()) {
+    return;
+  }
+  // Once the audio thread is out of block() the ring only shrinks
+  armed.store(false);
+  while (busy.load()) {
+    std::this_thread::yield();
+  }
+  running.store(false);
+  if (writer.joinable()) {
+    writer.join();
+  }
+  drain(true);
+
+  wav_stream_header(encoded, static_cast<u32>(take_channels),
+                    static_cast<u32>(take_rate), RECORD_BITS, data_bytes);
+  if (!failed && !write_at(0, encoded, WAV_STREAM_HEADER_SIZE)) {
+    failed = true;
+  }
+  close_file();
+
+  const u64 frame_bytes =
+      static_cast<u64>(take_channels) * (RECORD_BITS / 8);
+  std::cout << "Recorded "
+            << (f32)(data_bytes / frame_bytes) / (f32)take_rate << "s to "
+            << path << std::endl;
+  if (dropped.load() > 0) {
+    std::cerr << "Recording dropped " << dropped.load() << " blocks"
+              << std::endl;
+  }
+  if (failed) {
+    std::cerr << "Failed to write recording: " << path << std::endl;
+  }
+}
+
+// The second check pairs with stop(), which waits out busy after disarming
+void Recorder::block(const f32 *samples, size_t frames, i32 sample_rate,
+                     i32 channels) {
+  if (!armed.load()) {
+    return;
+  }
+  busy.store(true);
+  if (armed.load()) {
+    const size_t count = frames * static_cast<size_t>(channels);
+    if (sample_rate != take_rate || channels != take_channels ||
+        ring->capacity() - ring->size() < count) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      ring->push_n(samples, count);
+    }
+  }
+  busy.store(false);
+}
+
+void Recorder::write_loop(void) {
+  while (running.load(std::memory_order_relaxed)) {
+    drain(false);
+    std::this_thread::sleep_for(RECORD_PERIOD);
+  }
+}
+
+// Whole chunks only until the take ends, then whatever's left. After a
+// failed write the ring keeps draining so the audio side never backs up
+void Recorder::drain(bool final) {
+  const size_t chunk = RECORD_CHUNK_FRAMES * static_cast<size_t>(take_channels);
+  for (;;) {
+    const size_t ready = ring->size();
+    if (ready == 0 || (ready < chunk && !final)) {
+      return;
+    }
+    const size_t count = ring->pop_n(staging, chunk);
+    if (failed) {
+      continue;
+    }
+    const size_t bytes = count * (RECORD_BITS / 8);
+    wav_encode(staging, count, RECORD_BITS, encoded);
+    if (!write_at(WAV_STREAM_HEADER_SIZE + data_bytes, encoded, bytes)) {
+      failed = true;
+      continue;
+    }
+    data_bytes += bytes;
+  }
+}
+
+#ifdef _WIN32
+bool Recorder::open_file(void) {
+  HANDLE f = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                         NULL);
+  if (f == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  file = f;
+  direct = false;
+  return true;
+}
+
+bool Recorder::write_at(u64 offset, const u8 *bytes, size_t size) {
+  OVERLAPPED at = {};
+  at.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+  at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD written = 0;
+  return WriteFile(file, bytes, static_cast<DWORD>(size), &written, &at) &&
+         written == size;
+}
+
+void Recorder::close_file(void) {
+  if (file) {
+    CloseHandle(file);
+  }
+  file = nullptr;
+}
+#else
+// Falls back to the page cache where the filesystem refuses O_DIRECT
+bool Recorder::open_file(void) {
+  const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  direct = false;
+#ifdef O_DIRECT
+  fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+  direct = fd >= 0;
+#endif
+  if (fd < 0) {
+    fd = ::open(path.c_str(), flags, 0644);
+  }
+  return fd >= 0;
+}
+
+// The last chunk of a take is short, so is anything written where O_DIRECT
+// turned out not to work. Both finish through the page cache
+bool Recorder::write_at(u64 offset, const u8 *bytes, size_t size) {
+#ifdef O_DIRECT
+  const bool aligned = offset % RECORD_ALIGN == 0 && size % RECORD_ALIGN == 0 &&
+                       reinterpret_cast<uintptr_t>(bytes) % RECORD_ALIGN == 0;
+  if (direct && !aligned) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    direct = false;
+  }
+#endif
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t n = pwrite(fd, bytes + done, size - done,
+                             static_cast<off_t>(offset + done));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+#ifdef O_DIRECT
+    if (n < 0 && errno == EINVAL && direct) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+      direct = false;
+      continue;
+    }
+#endif
+    if (n <= 0) {
+      return false;
+    }
+    done += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+void Recorder::close_file(void) {
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  fd = -1;
+}
+#endif
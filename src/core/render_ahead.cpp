@@ -0,0 +1,150 @@
+#include "../../inc/render_ahead.hpp"
+#include "../../inc/audio_sys.hpp"
+#include "../../inc/rt_thread.hpp"
+#include "../../inc/synth.hpp"
+#include "../../inc/trace.hpp"
+#include "../../inc/util.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// How long the queue has to sit comfortably full before a block goes back
+const u64 AHEAD_WINDOW_NS = 2000000000ull;
+// The producer checks this many times a block
+const u64 AHEAD_POLLS = 4;
+
+Render_Ahead::Render_Ahead(size_t _depth_min)
+    : audio(nullptr), samples(), blocks(), running(false),
+      depth(std::max<size_t>(_depth_min, 1)), low_water(SIZE_MAX),
+      underruns(0), producer(), depth_min(std::max<size_t>(_depth_min, 1)),
+      depth_max(AHEAD_BLOCKS_MAX), block_frames(0), channels(0), poll_ns(0),
+      block(), window_start(0), seen_underruns(0), current_left(0),
+      current_sounding(false) {}
+
+Render_Ahead::~Render_Ahead(void) { stop(); }
+
+bool Render_Ahead::start(Audio_Sys *_audio, size_t _block_frames,
+                         size_t _channels) {
+  if (running.load() || !_audio || _block_frames == 0 || _channels == 0) {
+    return false;
+  }
+  audio = _audio;
+  block_frames = std::min<size_t>(_block_frames, RENDER_FRAMES_MAX);
+  channels = _channels;
+  depth_max = std::min<size_t>(AHEAD_BLOCKS_MAX,
+                               AHEAD_RING_SIZE / (block_frames * channels));
+  // Kept across a restart, the machine didn't get any calmer
+  depth.store(std::clamp(depth.load(), std::min(depth_min, depth_max),
+                         depth_max));
+  const u64 rate = static_cast<u64>(audio->get_synth()->get_sample_rate());
+  poll_ns = block_frames * 1000000000ull / (rate * AHEAD_POLLS);
+
+  // Stale blocks are in the old format
+  block.assign(block_frames * channels, 0.0f);
+  Ahead_Block stale;
+  while (blocks.pop(stale)) {
+  }
+  while (samples.pop_n(block.data(), block.size()) > 0) {
+  }
+  current_left = 0;
+  current_sounding = false;
+  low_water.store(SIZE_MAX);
+  seen_underruns = underruns.load();
+  window_start = now_ns();
+
+  running.store(true);
+  producer = std::thread(&Render_Ahead::produce_loop, this);
+  return true;
+}
+
+void Render_Ahead::stop(void) {
+  running.store(false);
+  if (producer.joinable()) {
+    producer.join();
+  }
+}
+
+size_t Render_Ahead::get_queued_frames(void) const {
+  return channels ? samples.size() / channels : 0;
+}
+
+bool Render_Ahead::pull(f32 *out, size_t frames) {
+  const size_t queued = get_queued_frames();
+  if (queued < low_water.load(std::memory_order_relaxed)) {
+    low_water.store(queued, std::memory_order_relaxed);
+  }
+
+  bool sounding = false;
+  size_t done = 0;
+  while (done < frames) {
+    if (current_left == 0) {
+      Ahead_Block next;
+      if (!blocks.pop(next)) {
+        break;
+      }
+      current_left = next.frames;
+      current_sounding = next.sounding != 0;
+    }
+    const size_t n = std::min(frames - done, current_left);
+    samples.pop_n(out + done * channels, n * channels);
+    sounding = sounding || current_sounding;
+    current_left -= n;
+    done += n;
+  }
+  if (done < frames) {
+    memset(out + done * channels, 0, (frames - done) * channels * sizeof(f32));
+    underruns.fetch_add(1, std::memory_order_relaxed);
+  }
+  return sounding;
+}
+
+// Samples go in before their block, so a block the callback can see always
+// has its samples behind it
+void Render_Ahead::produce_loop(void) {
+  TRACE_THREAD("render ahead");
+  rt_enter_thread("render ahead", RT_AUDIO);
+  const size_t count = block_frames * channels;
+  while (running.load(std::memory_order_relaxed)) {
+    const bool room = samples.capacity() - samples.size() >= count &&
+                      blocks.size() < blocks.capacity();
+    if (room && get_queued_frames() <
+                    depth.load(std::memory_order_relaxed) * block_frames) {
+      bool sounding = false;
+      {
+        TRACE_SCOPE("ahead_block");
+        sounding = audio->render(block.data(), block_frames);
+      }
+      samples.push_n(block.data(), count);
+      blocks.push({static_cast<u32>(block_frames), sounding ? 1u : 0u});
+      continue;
+    }
+    adapt(now_ns());
+    std::this_thread::sleep_for(std::chrono::nanoseconds(poll_ns));
+  }
+}
+
+void Render_Ahead::adapt(u64 now) {
+  const size_t current = depth.load(std::memory_order_relaxed);
+  const u64 missed = underruns.load(std::memory_order_relaxed);
+  if (missed != seen_underruns) {
+    seen_underruns = missed;
+    depth.store(std::min(current + 1, depth_max));
+    low_water.store(SIZE_MAX, std::memory_order_relaxed);
+    window_start = now;
+    return;
+  }
+  if (now - window_start < AHEAD_WINDOW_NS) {
+    return;
+  }
+  window_start = now;
+  const size_t low = low_water.exchange(SIZE_MAX, std::memory_order_relaxed);
+  if (low == SIZE_MAX) {
+    return;
+  }
+  if (low < block_frames + block_frames / 2) {
+    depth.store(std::min(current + 1, depth_max));
+  } else if (low >= 3 * block_frames && current > depth_min) {
+    depth.store(current - 1);
+  }
+}
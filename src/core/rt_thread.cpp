@@ -0,0 +1,228 @@
+#include "../../inc/rt_thread.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Under the kernel's own threads, about where other audio software sits
+const i32 RT_PRIORITY = 70;
+const i32 RT_NICE = -10;
+const u32 RT_MXCSR_FTZ = 0x8000;
+const u32 RT_MXCSR_DAZ = 0x0040;
+#if !defined(__linux__) && !defined(_WIN32)
+// Where there's nothing to wait on an address with
+const std::chrono::microseconds RT_WAIT_NAP(100);
+#endif
+
+static_assert(sizeof(std::atomic<u32>) == sizeof(u32) &&
+                  std::atomic<u32>::is_always_lock_free,
+              "rt_wait hands the atomic's address to the kernel");
+
+struct Rt_Slot {
+  std::atomic<bool> ready{false};
+  bool printed = false;
+  char line[RT_LINE_MAX];
+};
+
+static Rt_Config rt_config;
+static std::array<Rt_Slot, RT_THREAD_MAX> rt_slots;
+static std::atomic<size_t> rt_slot_count(0);
+static std::atomic<size_t> rt_next_cpu(0);
+static thread_local bool rt_entered = false;
+
+void rt_setup(const Rt_Config &config) { rt_config = config; }
+
+bool rt_denormals_off(void) {
+#if defined(__SSE2__) || defined(_M_X64)
+  _mm_setcsr(_mm_getcsr() | RT_MXCSR_FTZ | RT_MXCSR_DAZ);
+  return true;
+#elif defined(__aarch64__)
+  // FZ covers both directions on arm
+  u64 fpcr = 0;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+  fpcr |= 1ull << 24;
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+  return true;
+#else
+  return false;
+#endif
+}
+
+static void rt_prefault_stack(void) {
+  volatile u8 stack[RT_STACK_PREFAULT];
+  for (size_t i = 0; i < sizeof(stack); i += 4096) {
+    stack[i] = 0;
+  }
+}
+
+// Round robin over the configured cores, false when there are none or the
+// pin was refused
+static bool rt_pin(char *out, size_t size) {
+  if (rt_config.cpus.empty()) {
+    return false;
+  }
+  const u32 cpu =
+      rt_config.cpus[rt_next_cpu.fetch_add(1) % rt_config.cpus.size()];
+  bool pinned = false;
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+  pinned = cpu < 64 && SetThreadAffinityMask(GetCurrentThread(),
+                                             static_cast<DWORD_PTR>(1) << cpu);
+#endif
+  snprintf(out, size, pinned ? ", cpu %u" : ", cpu %u refused", cpu);
+  return pinned;
+}
+
+static void rt_raise(RT_ROLE role, char *out, size_t size) {
+#ifdef _WIN32
+  const int priority = role == RT_AUDIO ? THREAD_PRIORITY_TIME_CRITICAL
+                                        : THREAD_PRIORITY_HIGHEST;
+  if (SetThreadPriority(GetCurrentThread(), priority)) {
+    snprintf(out, size, "%s", role == RT_AUDIO ? "time critical" : "highest");
+  } else {
+    snprintf(out, size, "default, priority refused");
+  }
+#else
+  // Lanes a step under whoever they're waiting on
+  const i32 top = std::min(RT_PRIORITY, sched_get_priority_max(SCHED_FIFO));
+  const i32 priority = top - (role == RT_LANE ? 1 : 0);
+  sched_param param = {};
+  param.sched_priority = priority;
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+    snprintf(out, size, "SCHED_FIFO %d", priority);
+    return;
+  }
+#ifdef __linux__
+  // Per thread on linux, the tid stands in for a process
+  if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)),
+                  RT_NICE) == 0) {
+    snprintf(out, size, "nice %d, SCHED_FIFO refused", RT_NICE);
+    return;
+  }
+#endif
+  snprintf(out, size, "default, SCHED_FIFO and nice refused");
+#endif
+}
+
+void rt_enter_thread(const char *name, RT_ROLE role) {
+  if (rt_entered) {
+    return;
+  }
+  rt_entered = true;
+  const bool flushed = rt_denormals_off();
+  char sched[48] = "default";
+  char cpu[24] = "";
+  if (role != RT_WORKER) {
+    rt_prefault_stack();
+    const bool pinned = rt_pin(cpu, sizeof(cpu));
+    if (rt_config.realtime && (role == RT_AUDIO || pinned)) {
+      rt_raise(role, sched, sizeof(sched));
+    }
+  }
+
+  // Past RT_THREAD_MAX a thread is still set up, just not reported
+  const size_t index = rt_slot_count.fetch_add(1);
+  if (index >= RT_THREAD_MAX) {
+    return;
+  }
+  Rt_Slot &slot = rt_slots[index];
+  snprintf(slot.line, sizeof(slot.line), "%s: %s%s, %s", name, sched, cpu,
+           flushed ? "FTZ/DAZ" : "denormals left on");
+  slot.ready.store(true, std::memory_order_release);
+}
+
+void rt_lock_memory(void) {
+#ifdef _WIN32
+  std::cout << "RT memory: not locked, no mlockall here" << std::endl;
+#else
+  if (!rt_config.realtime) {
+    std::cout << "RT memory: not locked" << std::endl;
+    return;
+  }
+  // Locking future pages under a finite limit makes allocations fail once
+  // it's hit, so those only lock what's there now
+  rlimit limit = {};
+  getrlimit(RLIMIT_MEMLOCK, &limit);
+  const bool unlimited = limit.rlim_cur == RLIM_INFINITY;
+  const unsigned long long limit_kb =
+      static_cast<unsigned long long>(limit.rlim_cur) / 1024;
+  if (mlockall(unlimited ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT) == 0) {
+    if (unlimited) {
+      std::cout << "RT memory: locked, later allocations too" << std::endl;
+    } else {
+      std::cout << "RT memory: locked, later allocations aren't (limit "
+                << limit_kb << "KB)" << std::endl;
+    }
+    return;
+  }
+  std::cerr << "RT memory: not locked, " << strerror(errno);
+  if (!unlimited) {
+    std::cerr << " (limit " << limit_kb << "KB)";
+  }
+  std::cerr << std::endl;
+#endif
+}
+
+void rt_wait(std::atomic<u32> &word, u32 seen) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<u32 *>(&word), FUTEX_WAIT_PRIVATE, seen,
+          nullptr, nullptr, 0);
+#elif defined(_WIN32)
+  WaitOnAddress(&word, &seen, sizeof(seen), INFINITE);
+#else
+  if (word.load() == seen) {
+    std::this_thread::sleep_for(RT_WAIT_NAP);
+  }
+#endif
+}
+
+void rt_wake_all(std::atomic<u32> &word) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<u32 *>(&word), FUTEX_WAKE_PRIVATE,
+          INT32_MAX, nullptr, nullptr, 0);
+#elif defined(_WIN32)
+  WakeByAddressAll(&word);
+#else
+  (void)word;
+#endif
+}
+
+void rt_report(void) {
+  const size_t count = std::min<size_t>(rt_slot_count.load(), RT_THREAD_MAX);
+  for (size_t i = 0; i < count; i++) {
+    Rt_Slot &slot = rt_slots[i];
+    if (!slot.printed && slot.ready.load(std::memory_order_acquire)) {
+      std::cout << "RT " << slot.line << std::endl;
+      slot.printed = true;
+    }
+  }
+}
@@ -1,343 +1,751 @@
-#include "../../inc/synth.hpp"
-#include "../../inc/util.hpp"
-#include <cmath>
-
-const size_t DEFAULT_OSC_COUNT = 1;
-const f32 DEFAULT_DELAY_TIME = 0.5f;
-const f32 DEFAULT_DELAY_FEEDBACK = 0.5f;
-
-const f32 MINUTE = 60.0f;
-const f32 BPM_MIN = 1.0f;
-const f32 BPM_MAX = 240.0f;
-const f32 BASE_BPM = 120.0f;
-
-const f32 WHOLE_NOTE_BEATS = 4.0f;
-const f32 WHOLE_NOTE = 1.0f;
-const f32 HALF_NOTE = WHOLE_NOTE / 2.0f;
-const f32 QUARTER_NOTE = WHOLE_NOTE / 4.0f;
-const f32 EIGHT_NOTE = WHOLE_NOTE / 8.0f;
-const f32 SIXTEENTH_NOTE = WHOLE_NOTE / 16.0f;
-
-const f32 ENV_DEFAULT = 0.1f;
-const f32 ENV_MAX = 2.0f;
-const f32 ENV_MIN = 0.01f;
-
-const f32 LPF_MIN = 25.0f;
-const f32 LPF_MAX = 10000.0f;
-const f32 LPF_DEFAULT = 1000.0f;
-
-const f32 TREM_MAX = 1.0f;
-const f32 TREM_MIN = 0.0f;
-const f32 TREM_DEFAULT = 0.25f;
-
-const f32 DELAY_MAX = 3.0f;
-const f32 DELAY_MIN = 0.1f;
-const f32 DELAY_DEFAULT = 0.25f;
-
-const f32 GAIN_MAX = 6.0f;
-const f32 GAIN_MIN = 0.5f;
-const f32 GAIN_DEFAULT = 1.0f;
-
-const f32 VOL_MIN = 0.0f;
-const f32 VOL_MAX = 1.0f;
-const f32 VOL_DEFAULT = 1.0f;
-
-f32 create_vibrato(f32 sine, f32 cents) {
-  return powf(2.0f, sine * cents * CENTS_TO_OCTAVE);
-}
-
-void lerp_f32(const f32 *target, f32 *val, const f32 alpha) {
-  if (!val || !target)
-    return;
-  *val = *val + (*target - *val) * alpha;
-}
-
-f32 time_to_hz(f32 time) { return 1.0f / time; }
-
-f32 hz_to_rad_per_sec(f32 hz) { return 2.0f * PI * hz; }
-
-f32 rad_per_sec_to_hz(f32 rad) { return rad / (2.0f * PI); }
-
-f32 note_to_time(f32 tempo, f32 note_time) {
-  return (MINUTE / tempo) * (note_time * WHOLE_NOTE_BEATS);
-}
-
-Synth::Synth(void)
-    : params_f32(init_params()),
-      note_durations(
-          {WHOLE_NOTE, HALF_NOTE, QUARTER_NOTE, EIGHT_NOTE, SIXTEENTH_NOTE}),
-      oscs(DEFAULT_OSC_COUNT), voices(), generator(),
-      delay(sample_rate, DEFAULT_DELAY_TIME, DEFAULT_DELAY_FEEDBACK),
-      loop_sums() {}
-
-// attack - decay - sustain - release
-
-std::array<ParamF32, S_PARAM_COUNT> Synth::init_params(void) {
-  // MIN - MAX - VALUE - INC
-  return {
-      ParamF32("Attack", ENV_MIN, ENV_MAX, ENV_DEFAULT),
-      ParamF32("Decay", ENV_MIN, ENV_MAX, ENV_DEFAULT),
-      ParamF32("Sustain", ENV_MIN, ENV_MAX, ENV_DEFAULT),
-      ParamF32("Release", ENV_MIN, ENV_MAX, ENV_DEFAULT),
-
-      ParamF32("Volume", VOL_MIN, VOL_MAX, VOL_DEFAULT),
-      ParamF32("Gain", GAIN_MIN, GAIN_MAX, GAIN_DEFAULT),
-      ParamF32("Low-Pass", LPF_MIN, LPF_MAX, LPF_DEFAULT),
-      ParamF32("Tremolo", TREM_MIN, TREM_MAX, TREM_DEFAULT),
-      ParamF32("Delay Time", DELAY_MIN, DELAY_MAX, DELAY_DEFAULT),
-
-      ParamF32("BPM", BPM_MIN, BPM_MAX, BASE_BPM),
-  };
-}
-
-// Source: DAFX page 127
-f32 Synth::exp_hard_clip(const f32 *sample, f32 gain, f32 mix) const {
-  if (!sample)
-    return 0.0f;
-
-  f32 q = *sample * gain;
-  f32 z = copysignf(1.0f - expf(-fabsf(q)), q);
-  return mix * z + (1.0f - mix) * *sample;
-}
-
-// Source: DAFX page 125
-f32 Synth::polynomial_soft_clip(const f32 *sample, f32 gain) const {
-  if (!sample)
-    return 0.0f;
-
-  f32 threshold = 1.0f / 3.0f;
-  f32 x = *sample * gain;
-  f32 y = 0.0f;
-  if (fabsf(x) < threshold) {
-    y = 2.0f * x;
-  }
-
-  if (fabsf(x) >= threshold) {
-    if (x > 0.0f) {
-      y = (3.0f - powf(2.0f - x * 3.0f, 2.0f)) / 3.0f;
-    } else {
-      y = -(3.0f - powf(2.0f - fabsf(x) * 3.0f, 2.0f)) / 3.0f;
-    }
-  }
-
-  if (fabsf(x) > 2.0f * threshold) {
-    if (x > 0.0f) {
-      y = 1.0f;
-    }
-
-    if (x < 0.0f) {
-      y = -1.0f;
-    }
-  }
-
-  return y;
-}
-
-void Synth::inc_param(SYNTH_PARAMETER param) {
-  if (param < params_f32.size()) {
-    // const f32 min = params_f32[param].min;
-    // const f32 max = params_f32[param].max;
-    // const f32 base_val = params_f32[param].value;
-    // const f32 inc_val = params_f32[param].inc;
-    //
-    // params_f32[param].value = clamp_param_f32(min, max, base_val + inc_val);
-    // if(param == S_DELAY_TIME){
-    // delay.rebuild(sample_rate, params_f32[param].value);
-    //}
-  }
-}
-
-void Synth::dec_param(SYNTH_PARAMETER param) {
-  if (param < params_f32.size()) {
-    // const f32 min = params_f32[param].min;
-    // const f32 max = params_f32[param].max;
-    // const f32 base_val = params_f32[param].value;
-    //
-    // params_f32[param].value = clamp_param_f32(min, max, base_val + inc_val);
-    // if(param == S_DELAY_TIME){
-    // delay.rebuild(sample_rate, params_f32[param].value);
-    //}
-  }
-}
-
-f32 Synth::clamp_param_f32(f32 min, f32 max, f32 value) {
-  if (value < min) {
-    value = min;
-  }
-
-  if (value > max) {
-    value = max;
-  }
-
-  return value;
-}
-
-void Synth::set_param(SYNTH_PARAMETER param, f32 value) {
-  if (param < params_f32.size()) {
-    params_f32[param].value =
-        clamp_param_f32(params_f32[param].min, params_f32[param].max, value);
-  }
-}
-
-ParamF32 *Synth::get_param(SYNTH_PARAMETER param) {
-  if (param < params_f32.size()) {
-    return &params_f32[param];
-  }
-
-  return nullptr;
-}
-
-const ParamF32 *Synth::get_param(SYNTH_PARAMETER param) const {
-  if (param < params_f32.size()) {
-    return &params_f32[param];
-  }
-
-  return nullptr;
-}
-
-void Synth::run_events(std::vector<Keyboard_Command> &commands) {
-  for (size_t i = 0; i < commands.size(); i++) {
-    switch (commands[i].type) {
-    default:
-      break;
-
-    case Keyboard_Command::pitch_bend: {
-      f32 bend = calculate_pitch_bend(
-          TWO_SEMITONE_CENTS, normalize_msg_bipolar(commands[i].input.msg2));
-      set_pitch_bend(bend);
-    } break;
-
-    case Keyboard_Command::note_on: {
-      loop_voicings_on(commands[i].input.msg1,
-                       normalize_msg(commands[i].input.msg2));
-    } break;
-
-    case Keyboard_Command::note_off: {
-      loop_voicings_off(commands[i].input.msg1);
-    } break;
-
-    case Keyboard_Command::mod_wheel: {
-      set_vibrato_depth(
-          map_vibrato_depth(normalize_msg(commands[i].input.msg2)));
-    } break;
-    // not impl
-    case Keyboard_Command::vol_knob: {
-    } break;
-    }
-  }
-}
-
-std::vector<Keyboard_Command> Synth::read_event(Controller &cont) {
-  cont.clear_msg_buf();
-  std::vector<Keyboard_Command> commands(0);
-
-  const i32 event_count = cont.read_input();
-  for (i32 i = 0; i < event_count; i++) {
-    const PmEvent *ev = cont.get_event_at(i);
-    if (!ev) {
-      continue;
-    }
-    Midi_Input_Msg msg = cont.parse_event(*ev);
-
-    switch (msg.status) {
-    case CONTROL: {
-      switch (msg.msg1) {
-      case CONTROL_MOD_WHEEL: {
-        commands.push_back({Keyboard_Command::mod_wheel, msg});
-      } break;
-      }
-    } break;
-
-    case PITCH_BEND: {
-      commands.push_back({Keyboard_Command::pitch_bend, msg});
-    } break;
-
-    case NOTE_ON: {
-      commands.push_back({Keyboard_Command::note_on, msg});
-    } break;
-    case NOTE_OFF: {
-      commands.push_back({Keyboard_Command::note_off, msg});
-    } break;
-    }
-  }
-
-  return commands;
-}
-
-f32 Synth::calculate_pitch_bend(f32 cents, f32 normalized_midi_event) const {
-  const f32 bend = normalized_midi_event * cents;
-  return powf(2.0f, bend * CENTS_TO_OCTAVE);
-}
-
-f32 Synth::map_vibrato_depth(f32 normalized_midi_event) const {
-  return normalized_midi_event * vibrato_max;
-}
-
-void Synth::zero_loop_sums(void) {
-  for (size_t i = 0; i < loop_sums.size(); i++) {
-    loop_sums[i] = 0.0f;
-  }
-}
-
-Oscillator *Synth::get_osc_at(size_t pos) {
-  if (pos < oscs.size()) {
-    return &oscs[pos];
-  }
-  return nullptr;
-}
-
-f32 Synth::get_sum_at(size_t pos) const {
-  if (pos < loop_sums.size()) {
-    return loop_sums[pos];
-  }
-  return 0.0f;
-}
-
-void Synth::add_sum_at(size_t pos, const f32 *sum) {
-  if (!sum) {
-    return;
-  }
-  if (pos < loop_sums.size()) {
-    loop_sums[pos] = loop_sums[pos] + *sum;
-  }
-}
-
-void Synth::loop_voicings_off(u32 midi_key) {
-  for (size_t i = 0; i < voices.size(); i++) {
-    Voice *v = &voices[i];
-    if (v->get_key() == midi_key) {
-      for (size_t o = 0; o < oscs.size(); o++) {
-        v->set_active_count(v->get_active_count() - 1);
-      }
-      v->set_env_state(ENV_STATE::REL);
-    }
-  }
-}
-
-void Synth::loop_voicings_on(u32 midi_key, f32 normalized_velocity) {
-  for (size_t i = 0; i < voices.size(); i++) {
-    Voice *v = &voices[i];
-    if (v->get_active_count() <= 0 && v->done()) {
-      v->set_active_count(0);
-      v->set_key(midi_key);
-      v->set_freq(midi_to_freq((i32)midi_key));
-      v->get_lpf().reset();
-
-      for (size_t o = 0; o < oscs.size(); o++) {
-        oscs[o].reset(i);
-        v->set_active_count(v->get_active_count() + 1);
-      }
-
-      v->set_envelope(0.0f);
-      v->set_env_state(ENV_STATE::ATK);
-      v->set_vol_mult(1.0f + normalized_velocity);
-
-      for (size_t c = 0; c < static_cast<size_t>(channels); c++) {
-        v->set_clipped_at(c, 0.0f);
-        v->set_filtered_at(c, 0.0f);
-        v->set_out_at(c, 0.0f);
-      }
-      return;
-    }
-  }
-}
+#include "../../inc/synth.hpp"
+#include "../../inc/capture.hpp"
+#include "../../inc/note_cache.hpp"
+#include "../../inc/midi_input.hpp"
+#include "../../inc/trace.hpp"
+#include "../../inc/util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+const size_t DEFAULT_OSC_COUNT = 1;
+const f32 DEFAULT_DELAY_TIME = 0.5f;
+const u32 DEFAULT_SEED = 1;
+const f32 DEFAULT_DELAY_FEEDBACK = 0.5f;
+const f32 PATCH_FADE_S = 0.005f;
+const f32 SILENCE_DB_DEFAULT = -96.0f;
+
+const f32 MINUTE = 60.0f;
+const f32 BPM_MIN = 1.0f;
+const f32 BPM_MAX = 240.0f;
+const f32 BASE_BPM = 120.0f;
+const f32 BPM_INC = 1.0f;
+
+const f32 WHOLE_NOTE_BEATS = 4.0f;
+const f32 WHOLE_NOTE = 1.0f;
+const f32 HALF_NOTE = WHOLE_NOTE / 2.0f;
+const f32 QUARTER_NOTE = WHOLE_NOTE / 4.0f;
+const f32 EIGHT_NOTE = WHOLE_NOTE / 8.0f;
+const f32 SIXTEENTH_NOTE = WHOLE_NOTE / 16.0f;
+
+const f32 ENV_DEFAULT = 0.1f;
+const f32 ENV_MAX = 2.0f;
+const f32 ENV_MIN = 0.01f;
+const f32 ENV_INC = 0.01f;
+
+const f32 LPF_MIN = 25.0f;
+const f32 LPF_MAX = 10000.0f;
+const f32 LPF_DEFAULT = 1000.0f;
+const f32 LPF_INC = 25.0f;
+
+const f32 TREM_MAX = 1.0f;
+const f32 TREM_MIN = 0.0f;
+const f32 TREM_DEFAULT = 0.25f;
+const f32 TREM_INC = 0.05f;
+
+const f32 DELAY_MAX = 3.0f;
+const f32 DELAY_MIN = 0.1f;
+const f32 DELAY_DEFAULT = 0.25f;
+const f32 DELAY_INC = 0.05f;
+
+const f32 GAIN_MAX = 6.0f;
+const f32 GAIN_MIN = 0.5f;
+const f32 GAIN_DEFAULT = 1.0f;
+const f32 GAIN_INC = 0.1f;
+
+const f32 VOL_MIN = 0.0f;
+const f32 VOL_MAX = 1.0f;
+const f32 VOL_DEFAULT = 1.0f;
+const f32 VOL_INC = 0.05f;
+
+void lerp_f32(const f32 *target, f32 *val, const f32 alpha) {
+  if (!val || !target)
+    return;
+  *val = *val + (*target - *val) * alpha;
+}
+
+f32 time_to_hz(f32 time) { return 1.0f / time; }
+
+f32 hz_to_rad_per_sec(f32 hz) { return 2.0f * PI * hz; }
+
+f32 rad_per_sec_to_hz(f32 rad) { return rad / (2.0f * PI); }
+
+f32 note_to_time(f32 tempo, f32 note_time) {
+  return (MINUTE / tempo) * (note_time * WHOLE_NOTE_BEATS);
+}
+
+Synth::Synth(void)
+    : params_f32(init_params()),
+      note_durations(
+          {WHOLE_NOTE, HALF_NOTE, QUARTER_NOTE, EIGHT_NOTE, SIXTEENTH_NOTE}),
+      oscs(DEFAULT_OSC_COUNT), voices(), generator(),
+      delay(sample_rate, DEFAULT_DELAY_TIME, DEFAULT_DELAY_FEEDBACK),
+      loop_sums(), programs(), active(nullptr), patch_requested(false),
+      patch_snapshots(), bank(nullptr), program(0),
+      chain_flags(0), fade_state(FADE_NONE), fade_pos(0), fade_len(0), plan(),
+      voice_block(), mix_block(), event_queue(), arp(), rng(DEFAULT_SEED),
+      fixed_phase(false), matrix(), telemetry_scratch(), telemetry(),
+      capture(nullptr), note_cache(nullptr) {
+  // Patches change the count on the audio thread, never let that allocate
+  oscs.reserve(MAX_OSC_COUNT);
+  rebuild_plan();
+
+  set_silence_db(SILENCE_DB_DEFAULT);
+
+  // Nothing is rendering yet, take the default chains straight away
+  Preset preset;
+  store_patch(preset);
+  build_program(programs.get_back(), preset);
+  programs.publish();
+  programs.acquire();
+  active = &programs.get_front();
+}
+
+bool Synth::build_program(Program &prog, const Preset &preset) const {
+  prog.preset = preset;
+  if (!build_voice_graph(prog.voice_graph, preset, channels)) {
+    return false;
+  }
+  return build_master_graph(prog.master_graph, channels, preset.flags);
+}
+
+// Runs off the audio thread, the record is copied out of the mapping here so
+// the audio thread only ever sees the prepared copy
+bool Synth::load_program(u32 _program) {
+  if (!bank) {
+    return false;
+  }
+  const Preset *preset = bank->get_preset_at(_program);
+  if (!preset || preset->osc_count == 0) {
+    return false;
+  }
+  if (!publish_patch(*preset)) {
+    return false;
+  }
+  program = _program;
+  return true;
+}
+
+// Off the audio thread, it fades over to the patch at its next block
+bool Synth::publish_patch(const Preset &preset) {
+  if (!build_program(programs.get_back(), preset)) {
+    return false;
+  }
+  programs.publish();
+  return true;
+}
+
+bool Synth::set_patch(const Preset &preset) {
+  if (!build_program(*active, preset)) {
+    return false;
+  }
+  apply_patch(preset);
+  return true;
+}
+
+void Synth::store_patch(Preset &preset) const {
+  memset(&preset, 0, sizeof(preset));
+  snprintf(preset.name, sizeof(preset.name), "Program %u", program);
+  preset.param_count = S_PARAM_COUNT;
+  for (size_t i = 0; i < S_PARAM_COUNT; i++) {
+    preset.params[i] = params_f32[i].value;
+  }
+
+  preset.osc_count = static_cast<u32>(oscs.size());
+  for (size_t o = 0; o < oscs.size(); o++) {
+    preset.oscs[o].waveform = oscs[o].get_waveform();
+    preset.oscs[o].detune = oscs[o].get_detune();
+    preset.oscs[o].duty = oscs[o].get_duty();
+  }
+  preset.delay_time = delay.get_time();
+  preset.delay_feedback = delay.get_feedback();
+  preset.flags = chain_flags;
+
+  preset.arp_mode = arp.get_mode();
+  preset.arp_rate = static_cast<u8>(arp.get_rate());
+  preset.arp_gate = static_cast<u8>(lrintf(arp.get_gate() * 100.0f));
+  preset.arp_steps = static_cast<u8>(arp.get_pattern_length());
+  for (size_t i = 0; i < arp.get_pattern_length(); i++) {
+    preset.arp_pattern[i] = arp.get_pattern()[i];
+  }
+  matrix.store(preset);
+}
+
+bool Synth::take_patch(Preset &preset) {
+  if (!patch_snapshots.acquire()) {
+    return false;
+  }
+  preset = patch_snapshots.get_front();
+  return true;
+}
+
+void Synth::serve_patch(void) {
+  if (!patch_requested.load(std::memory_order_acquire)) {
+    return;
+  }
+  store_patch(patch_snapshots.get_back());
+  patch_snapshots.publish();
+  patch_requested.store(false, std::memory_order_release);
+}
+
+// Audio thread only, everything in here has to stay allocation free
+void Synth::apply_patch(const Preset &preset) {
+  // Everything cached was rendered on the old patch, once for the lot
+  if (note_cache) {
+    note_cache->leave_all(*this);
+    note_cache->invalidate();
+  }
+  const size_t count = std::min<size_t>(preset.param_count, S_PARAM_COUNT);
+  for (size_t i = 0; i < count; i++) {
+    set_param(static_cast<SYNTH_PARAMETER>(i), preset.params[i]);
+  }
+
+  const size_t osc_count =
+      std::clamp<size_t>(preset.osc_count, 1, MAX_OSC_COUNT);
+  oscs.resize(osc_count);
+  for (size_t o = 0; o < osc_count; o++) {
+    oscs[o].set_waveform(
+        std::clamp<i32>(preset.oscs[o].waveform, 0, WAVEFORM_COUNT - 1));
+    oscs[o].set_detune(preset.oscs[o].detune);
+    oscs[o].set_duty(preset.oscs[o].duty);
+  }
+
+  // Held notes count one per osc, keep them in step with the new count
+  for (size_t i = 0; i < voices.size(); i++) {
+    if (voices[i].get_active_count() > 0) {
+      voices[i].set_active_count(static_cast<i32>(osc_count));
+    }
+  }
+
+  delay.set_feedback(preset.delay_feedback);
+  if (preset.delay_time > 0.0f) {
+    delay.set_time(sample_rate, preset.delay_time);
+  }
+  chain_flags = preset.flags;
+  rebuild_plan();
+
+  if (preset.arp_mode != arp.get_mode()) {
+    all_notes_off();
+  }
+  arp.set_mode(preset.arp_mode);
+  arp.set_rate(preset.arp_rate);
+  if (preset.arp_gate > 0) {
+    arp.set_gate(static_cast<f32>(preset.arp_gate) / 100.0f);
+  }
+  if (preset.arp_steps > 0) {
+    arp.set_pattern(preset.arp_pattern, preset.arp_steps);
+  }
+  matrix.load(preset);
+}
+
+// Once per block, a new patch fades the output down, swaps and fades back in.
+// The old program keeps rendering until the swap so it stays ours until then
+void Synth::update_patch(void) {
+  if (fade_state == FADE_NONE && programs.pending()) {
+    fade_state = FADE_OUT;
+    fade_pos = 0;
+    fade_len = static_cast<size_t>(PATCH_FADE_S * (f32)sample_rate) + 1;
+    if (capture) {
+      capture->patch_pending();
+    }
+  }
+}
+
+f32 Synth::next_fade_gain(void) {
+  switch (fade_state) {
+  default:
+    return 1.0f;
+  case FADE_OUT: {
+    const f32 gain = 1.0f - (f32)fade_pos / (f32)fade_len;
+    if (++fade_pos >= fade_len) {
+      // Cached notes finish on the old chain before it goes
+      if (note_cache) {
+        note_cache->leave_all(*this);
+      }
+      programs.acquire();
+      active = &programs.get_front();
+      apply_patch(active->preset);
+      if (capture) {
+        capture->patch(active->preset);
+      }
+      fade_state = FADE_IN;
+      fade_pos = 0;
+    }
+    return gain;
+  }
+  case FADE_IN: {
+    const f32 gain = (f32)fade_pos / (f32)fade_len;
+    if (++fade_pos >= fade_len) {
+      fade_state = FADE_NONE;
+    }
+    return gain;
+  }
+  }
+}
+
+// LPF alphas and LFO increments are derived from sample_rate as they run, the
+// delay line is the only thing holding samples
+bool Synth::set_output_format(i32 rate, i32 chans) {
+  if (rate <= 0 || rate > sample_rate_max || chans <= 0) {
+    return false;
+  }
+  if (note_cache) {
+    note_cache->leave_all(*this);
+    note_cache->invalidate();
+  }
+  channels = std::min(chans, channel_max);
+  if (rate != sample_rate) {
+    sample_rate = rate;
+    delay.rebuild(sample_rate, delay.get_time());
+  }
+  for (size_t i = 0; i < voices.size(); i++) {
+    voices[i].get_lpf().reset();
+  }
+  // Caller holds the audio thread off and publishes from this thread, the
+  // chains are built per channel count. A program that's published but not
+  // swapped in yet gets rebuilt too, it swaps in when its fade says so
+  if (active) {
+    build_program(*active, active->preset);
+  }
+  Program *next = programs.get_pending();
+  if (next) {
+    build_program(*next, next->preset);
+  }
+  return true;
+}
+
+// attack - decay - sustain - release
+
+std::array<ParamF32, S_PARAM_COUNT> Synth::init_params(void) {
+  // MIN - MAX - VALUE - INC
+  return {
+      ParamF32("Attack", ENV_MIN, ENV_MAX, ENV_DEFAULT, ENV_INC),
+      ParamF32("Decay", ENV_MIN, ENV_MAX, ENV_DEFAULT, ENV_INC),
+      ParamF32("Sustain", ENV_MIN, ENV_MAX, ENV_DEFAULT, ENV_INC),
+      ParamF32("Release", ENV_MIN, ENV_MAX, ENV_DEFAULT, ENV_INC),
+
+      ParamF32("Volume", VOL_MIN, VOL_MAX, VOL_DEFAULT, VOL_INC),
+      ParamF32("Gain", GAIN_MIN, GAIN_MAX, GAIN_DEFAULT, GAIN_INC),
+      ParamF32("Low-Pass", LPF_MIN, LPF_MAX, LPF_DEFAULT, LPF_INC),
+      ParamF32("Tremolo", TREM_MIN, TREM_MAX, TREM_DEFAULT, TREM_INC),
+      ParamF32("Delay Time", DELAY_MIN, DELAY_MAX, DELAY_DEFAULT, DELAY_INC),
+
+      ParamF32("BPM", BPM_MIN, BPM_MAX, BASE_BPM, BPM_INC),
+  };
+}
+
+// Source: DAFX page 127
+f32 Synth::exp_hard_clip(const f32 *sample, f32 gain, f32 mix) const {
+  if (!sample)
+    return 0.0f;
+
+  f32 q = *sample * gain;
+  f32 z = copysignf(1.0f - expf(-fabsf(q)), q);
+  return mix * z + (1.0f - mix) * *sample;
+}
+
+// Source: DAFX page 125
+f32 Synth::polynomial_soft_clip(const f32 *sample, f32 gain) const {
+  if (!sample)
+    return 0.0f;
+
+  f32 threshold = 1.0f / 3.0f;
+  f32 x = *sample * gain;
+  f32 y = 0.0f;
+  if (fabsf(x) < threshold) {
+    y = 2.0f * x;
+  }
+
+  if (fabsf(x) >= threshold) {
+    if (x > 0.0f) {
+      y = (3.0f - powf(2.0f - x * 3.0f, 2.0f)) / 3.0f;
+    } else {
+      y = -(3.0f - powf(2.0f - fabsf(x) * 3.0f, 2.0f)) / 3.0f;
+    }
+  }
+
+  if (fabsf(x) > 2.0f * threshold) {
+    if (x > 0.0f) {
+      y = 1.0f;
+    }
+
+    if (x < 0.0f) {
+      y = -1.0f;
+    }
+  }
+
+  return y;
+}
+
+void Synth::inc_param(SYNTH_PARAMETER param) {
+  if (param < params_f32.size()) {
+    step_param(param, params_f32[param].inc);
+  }
+}
+
+void Synth::dec_param(SYNTH_PARAMETER param) {
+  if (param < params_f32.size()) {
+    step_param(param, -params_f32[param].inc);
+  }
+}
+
+// Audio thread, from run_event
+void Synth::step_param(SYNTH_PARAMETER param, f32 step) {
+  ParamF32 &p = params_f32[param];
+  const f32 next = clamp_param_f32(p.min, p.max, p.value + step);
+  if (next == p.value) {
+    return;
+  }
+  p.value = next;
+  // The line is sized for DELAY_MAX up front, set_time never allocates
+  if (param == S_DELAY_TIME) {
+    delay.set_time(sample_rate, p.value);
+  }
+  if (note_cache) {
+    note_cache->leave_all(*this);
+    note_cache->invalidate();
+  }
+}
+
+f32 Synth::clamp_param_f32(f32 min, f32 max, f32 value) {
+  if (value < min) {
+    value = min;
+  }
+
+  if (value > max) {
+    value = max;
+  }
+
+  return value;
+}
+
+void Synth::set_param(SYNTH_PARAMETER param, f32 value) {
+  if (param < params_f32.size()) {
+    params_f32[param].value =
+        clamp_param_f32(params_f32[param].min, params_f32[param].max, value);
+  }
+}
+
+ParamF32 *Synth::get_param(SYNTH_PARAMETER param) {
+  if (param < params_f32.size()) {
+    return &params_f32[param];
+  }
+
+  return nullptr;
+}
+
+const ParamF32 *Synth::get_param(SYNTH_PARAMETER param) const {
+  if (param < params_f32.size()) {
+    return &params_f32[param];
+  }
+
+  return nullptr;
+}
+
+void Synth::run_events(std::vector<Keyboard_Command> &commands) {
+  for (size_t i = 0; i < commands.size(); i++) {
+    run_event(commands[i]);
+  }
+}
+
+void Synth::run_event(const Keyboard_Command &command) {
+  switch (command.type) {
+  default:
+    break;
+
+  case Keyboard_Command::pitch_bend: {
+    const f32 next = normalize_msg_bipolar(command.input.msg2);
+    if (note_cache && next != bend) {
+      note_cache->leave_all(*this);
+    }
+    bend = next;
+  } break;
+
+  // The arp always tracks held keys so switching it on mid chord picks them up
+  case Keyboard_Command::note_on: {
+    arp.press(command.input.msg1, command.input.msg2);
+    if (!arp.enabled()) {
+      loop_voicings_on(command.input.msg1, normalize_msg(command.input.msg2));
+    }
+  } break;
+
+  case Keyboard_Command::note_off: {
+    arp.release(command.input.msg1);
+    if (!arp.enabled()) {
+      loop_voicings_off(command.input.msg1);
+    }
+  } break;
+
+  case Keyboard_Command::mod_wheel: {
+    const f32 next = normalize_msg(command.input.msg2);
+    if (note_cache && next != mod_wheel) {
+      note_cache->leave_all(*this);
+    }
+    mod_wheel = next;
+  } break;
+  // not impl
+  case Keyboard_Command::vol_knob: {
+  } break;
+
+  // Never queued, queue_events loads programs on the main thread since that
+  // builds graphs
+  case Keyboard_Command::program_change: {
+  } break;
+
+  case Keyboard_Command::arp_next_mode: {
+    arp.stop(this);
+    all_notes_off();
+    arp.set_mode(static_cast<u8>(arp.get_mode() + 1));
+  } break;
+
+  case Keyboard_Command::arp_next_rate: {
+    arp.set_rate((arp.get_rate() + 1) % D_COUNT);
+  } break;
+
+  case Keyboard_Command::param_inc: {
+    inc_param(static_cast<SYNTH_PARAMETER>(command.input.msg1));
+  } break;
+
+  case Keyboard_Command::param_dec: {
+    dec_param(static_cast<SYNTH_PARAMETER>(command.input.msg1));
+  } break;
+  }
+}
+
+// Main thread, program changes build graphs so they stay here, everything
+// else goes to the audio thread in order. False if the queue was full
+bool Synth::queue_events(std::vector<Keyboard_Command> &commands) {
+  bool queued = true;
+  for (size_t i = 0; i < commands.size(); i++) {
+    if (commands[i].type == Keyboard_Command::program_change) {
+      load_program(commands[i].input.msg1);
+      continue;
+    }
+    if (!event_queue.push(commands[i])) {
+      queued = false;
+    }
+  }
+  return queued;
+}
+
+// Audio thread, top of every callback
+void Synth::drain_events(void) {
+  TRACE_COUNT("events", event_queue.size());
+  Keyboard_Command command;
+  while (event_queue.pop(command)) {
+    if (capture) {
+      capture->command(command);
+    }
+    run_event(command);
+  }
+}
+
+f32 Synth::get_note_duration(size_t duration) const {
+  return duration < note_durations.size() ? note_durations[duration]
+                                          : note_durations[D_SIXTEENTH];
+}
+
+// Already merged in timestamp order across every open device
+std::vector<Keyboard_Command> Synth::read_event(Midi_Input &input) {
+  std::vector<Keyboard_Command> commands(0);
+  std::array<PmEvent, INPUT_BUFFER_MAX> events;
+
+  size_t event_count = 0;
+  while ((event_count = input.read(events.data(), events.size())) > 0) {
+    for (size_t i = 0; i < event_count; i++) {
+      parse_command(events[i], commands);
+    }
+  }
+  return commands;
+}
+
+void Synth::parse_command(const PmEvent &ev,
+                          std::vector<Keyboard_Command> &commands) const {
+  const Midi_Input_Msg msg(Pm_MessageStatus(ev.message),
+                           Pm_MessageData1(ev.message),
+                           Pm_MessageData2(ev.message));
+
+  switch (msg.status) {
+  case CONTROL: {
+    switch (msg.msg1) {
+    case CONTROL_MOD_WHEEL: {
+      commands.push_back({Keyboard_Command::mod_wheel, msg});
+    } break;
+    }
+  } break;
+
+  case PITCH_BEND: {
+    commands.push_back({Keyboard_Command::pitch_bend, msg});
+  } break;
+
+  case PROGRAM_CHANGE: {
+    commands.push_back({Keyboard_Command::program_change, msg});
+  } break;
+
+  case NOTE_ON: {
+    commands.push_back({Keyboard_Command::note_on, msg});
+  } break;
+  case NOTE_OFF: {
+    commands.push_back({Keyboard_Command::note_off, msg});
+  } break;
+  }
+}
+
+void Synth::zero_loop_sums(void) {
+  for (size_t i = 0; i < loop_sums.size(); i++) {
+    loop_sums[i] = 0.0f;
+  }
+}
+
+Oscillator *Synth::get_osc_at(size_t pos) {
+  if (pos < oscs.size()) {
+    return &oscs[pos];
+  }
+  return nullptr;
+}
+
+f32 Synth::get_sum_at(size_t pos) const {
+  if (pos < loop_sums.size()) {
+    return loop_sums[pos];
+  }
+  return 0.0f;
+}
+
+void Synth::add_sum_at(size_t pos, const f32 *sum) {
+  if (!sum) {
+    return;
+  }
+  if (pos < loop_sums.size()) {
+    loop_sums[pos] = loop_sums[pos] + *sum;
+  }
+}
+
+void Synth::loop_voicings_off(u32 midi_key) {
+  for (size_t i = 0; i < voices.size(); i++) {
+    Voice *v = &voices[i];
+    if (v->get_key() == midi_key) {
+      if (note_cache) {
+        note_cache->leave(*this, i);
+      }
+      for (size_t o = 0; o < oscs.size(); o++) {
+        v->set_active_count(v->get_active_count() - 1);
+      }
+      v->set_env_state(ENV_STATE::REL);
+    }
+  }
+}
+
+void Synth::all_notes_off(void) {
+  for (size_t i = 0; i < voices.size(); i++) {
+    if (voices[i].get_active_count() > 0) {
+      loop_voicings_off(voices[i].get_key());
+    }
+  }
+}
+
+void Synth::begin_telemetry(void) {
+  for (size_t i = 0; i < telemetry_scratch.voices.size(); i++) {
+    telemetry_scratch.voices[i].cycles = 0;
+  }
+}
+
+// Audio thread, end of every callback
+void Synth::publish_telemetry(void) {
+  telemetry_scratch.block++;
+  for (size_t i = 0; i < voices.size(); i++) {
+    Voice_Telemetry &t = telemetry_scratch.voices[i];
+    t.key = voices[i].get_key();
+    t.active = voices[i].get_active_count();
+    t.stage = voices[i].get_env_state();
+    t.level = voices[i].get_envelope();
+  }
+  telemetry.write(telemetry_scratch);
+}
+
+// Any thread, a few retries covers the writer lapping us
+bool Synth::read_telemetry(Voice_Snapshot &snapshot) const {
+  const size_t TELEMETRY_RETRIES = 4;
+  for (size_t i = 0; i < TELEMETRY_RETRIES; i++) {
+    if (telemetry.read(snapshot)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Read from the UI thread for meters, a stale count only costs a frame
+// Nothing sounding, nothing about to start and the effects have rung out, the
+// render can skip the chains entirely
+bool Synth::is_silent(void) const {
+  return fade_state == FADE_NONE && arp.idle() && get_sounding_voices() == 0 &&
+         ((chain_flags & CHAIN_NO_DELAY) || delay.is_idle());
+}
+
+void Synth::set_silence_db(f32 db) {
+  silence_threshold = powf(10.0f, db / 20.0f);
+}
+
+size_t Synth::get_sounding_voices(void) const {
+  size_t count = 0;
+  for (size_t i = 0; i < voices.size(); i++) {
+    if (voices[i].get_active_count() > 0 || voices[i].releasing()) {
+      count++;
+    }
+  }
+  return count;
+}
+
+// A free voice if there is one, otherwise the quietest one in its release
+static size_t pick_voice(const std::array<Voice, VOICES> &voices) {
+  size_t quietest = VOICES;
+  for (size_t i = 0; i < voices.size(); i++) {
+    const Voice &v = voices[i];
+    if (v.get_active_count() <= 0 && v.done()) {
+      return i;
+    }
+    if (v.get_active_count() <= 0 && v.releasing() &&
+        (quietest == VOICES ||
+         v.get_envelope() < voices[quietest].get_envelope())) {
+      quietest = i;
+    }
+  }
+  return quietest;
+}
+
+void Synth::loop_voicings_on(u32 midi_key, f32 normalized_velocity) {
+  const size_t i = pick_voice(voices);
+  if (i >= voices.size()) {
+    return;
+  }
+  start_voice(i, midi_key, normalized_velocity);
+  if (note_cache) {
+    note_cache->note_on(*this, i, normalized_velocity);
+  }
+}
+
+void Synth::start_voice(size_t i, u32 midi_key, f32 normalized_velocity) {
+  Voice *v = &voices[i];
+  v->set_active_count(0);
+  v->set_key(midi_key);
+  v->set_freq(midi_to_freq((i32)midi_key));
+  v->get_lpf().reset();
+  v->reset_mod();
+
+  for (size_t o = 0; o < oscs.size(); o++) {
+    const f32 phase = fixed_phase ? 0.5f * (f32)o / (f32)oscs.size()
+                                  : rng.range(0.0f, 0.5f);
+    oscs[o].reset(i, phase);
+    v->set_active_count(v->get_active_count() + 1);
+  }
+
+  v->set_envelope(0.0f);
+  v->set_env_state(ENV_STATE::ATK);
+  v->set_vol_mult(1.0f + normalized_velocity);
+
+  for (size_t c = 0; c < static_cast<size_t>(channels); c++) {
+    v->set_clipped_at(c, 0.0f);
+    v->set_filtered_at(c, 0.0f);
+    v->set_out_at(c, 0.0f);
+  }
+}
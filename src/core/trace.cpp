@@ -0,0 +1,160 @@
+#include "../../inc/trace.hpp"
+
+#ifdef SGSA_TRACE
+#include "../../inc/lockfree.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+struct Trace_Thread {
+  Spsc_Ring<Trace_Event, TRACE_RING_SIZE> ring;
+  std::atomic<bool> live{false};
+  std::atomic<u64> dropped{0};
+  char name[TRACE_NAME_MAX];
+  // collector side, a ring over the last TRACE_HISTORY events
+  std::vector<Trace_Event> history;
+  size_t history_next = 0;
+};
+
+static std::array<Trace_Thread, TRACE_THREAD_MAX> trace_threads;
+static std::atomic<size_t> trace_thread_count(0);
+static thread_local Trace_Thread *trace_local = nullptr;
+static thread_local bool trace_claimed = false;
+static const std::chrono::steady_clock::time_point trace_epoch =
+    std::chrono::steady_clock::now();
+
+u64 trace_now(void) {
+  return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - trace_epoch)
+                              .count());
+}
+
+// Once per thread, past TRACE_THREAD_MAX a thread just doesn't get traced
+static Trace_Thread *trace_claim(const char *name) {
+  trace_claimed = true;
+  const size_t index = trace_thread_count.fetch_add(1);
+  if (index >= TRACE_THREAD_MAX) {
+    return nullptr;
+  }
+  Trace_Thread &t = trace_threads[index];
+  snprintf(t.name, sizeof(t.name), "%s", name);
+  t.live.store(true, std::memory_order_release);
+  return &t;
+}
+
+void trace_thread_name(const char *name) {
+  if (!trace_claimed) {
+    trace_local = trace_claim(name);
+  }
+}
+
+static void trace_push(const Trace_Event &event) {
+  if (!trace_claimed) {
+    trace_local = trace_claim("thread");
+  }
+  if (trace_local && !trace_local->ring.push(event)) {
+    trace_local->dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void trace_span(const char *name, u64 start, u64 end, u32 arg) {
+  const u64 dur = end - start;
+  trace_push({name, start,
+              dur < TRACE_COUNTER ? static_cast<u32>(dur) : TRACE_COUNTER - 1,
+              arg});
+}
+
+void trace_counter(const char *name, u32 value) {
+  trace_push({name, trace_now(), TRACE_COUNTER, value});
+}
+
+void trace_collect(void) {
+  for (size_t i = 0; i < TRACE_THREAD_MAX; i++) {
+    Trace_Thread &t = trace_threads[i];
+    if (!t.live.load(std::memory_order_acquire)) {
+      continue;
+    }
+    if (t.history.empty()) {
+      t.history.reserve(TRACE_HISTORY);
+    }
+    Trace_Event event;
+    while (t.ring.pop(event)) {
+      if (t.history.size() < TRACE_HISTORY) {
+        t.history.push_back(event);
+      } else {
+        t.history[t.history_next] = event;
+      }
+      t.history_next = (t.history_next + 1) % TRACE_HISTORY;
+    }
+  }
+}
+
+// Chrome wants microseconds, kept to the ns
+static void write_us(std::ofstream &out, u64 ns) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%llu.%03llu",
+           static_cast<unsigned long long>(ns / 1000),
+           static_cast<unsigned long long>(ns % 1000));
+  out << buf;
+}
+
+bool trace_export(const std::string &path) {
+  trace_collect();
+  std::ofstream out(path, std::ios::out | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Failed to open trace for writing: " << path << std::endl;
+    return false;
+  }
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  bool first = true;
+  size_t count = 0;
+  u64 dropped = 0;
+  for (size_t i = 0; i < TRACE_THREAD_MAX; i++) {
+    const Trace_Thread &t = trace_threads[i];
+    if (!t.live.load(std::memory_order_acquire)) {
+      continue;
+    }
+    dropped += t.dropped.load();
+    out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\","
+        << "\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"" << t.name
+        << "\"}}";
+    first = false;
+
+    // Oldest first once the history has wrapped
+    const size_t size = t.history.size();
+    const size_t begin = size < TRACE_HISTORY ? 0 : t.history_next;
+    for (size_t k = 0; k < size; k++) {
+      const Trace_Event &e = t.history[(begin + k) % size];
+      out << ",\n{\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << i
+          << ",\"ts\":";
+      write_us(out, e.start);
+      if (e.dur == TRACE_COUNTER) {
+        out << ",\"ph\":\"C\",\"args\":{\"value\":" << e.arg << "}}";
+      } else {
+        out << ",\"ph\":\"X\",\"dur\":";
+        write_us(out, e.dur);
+        out << ",\"args\":{\"arg\":" << e.arg << "}}";
+      }
+      count++;
+    }
+  }
+  out << "\n]}\n";
+  if (!out.good()) {
+    std::cerr << "Failed to write trace: " << path << std::endl;
+    return false;
+  }
+  std::cout << "Wrote " << count << " trace events to " << path;
+  if (dropped > 0) {
+    std::cout << ", " << dropped << " dropped on full rings";
+  }
+  std::cout << std::endl;
+  return true;
+}
+
+#endif
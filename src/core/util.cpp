@@ -1,36 +1,44 @@
-#include "../../inc/util.hpp"
-#include <cmath>
-#include <cstring>
-
-f32 rand_f32_range(f32 min, f32 max) {
-  float scale = (f32)rand() / (f32)RAND_MAX;
-  return min + scale * (max - min);
-}
-
-f32 midi_to_freq(i32 n) {
-  const i32 A4 = 69;
-  const f32 A4f = 440.0f;
-  const f32 NOTES = 12.0f;
-  return A4f * powf(2.0f, (f32)(n - A4) / NOTES);
-}
-
-void copy_char_buffer(const char *src, char *dst, size_t len) {
-  strcpy(dst, src);
-  dst[len] = '\0';
-}
-
-u8 toggle_bit(u8 original, u8 pos) { return original ^= pos; }
-
-u8 clear_bit(u8 original, u8 pos) { return original &= ~pos; }
-
-u8 set_bit(u8 original, u8 pos) { return original |= pos; }
-
-bool check_bit(u8 original, u8 mask, u8 want) {
-  return (original & mask) == want;
-}
-
-f32 normalize_msg_bipolar(u32 value) {
-  return ((f32)value / (INT8_MAX + 1)) * 2.0f - 1.0f;
-}
-
-f32 normalize_msg(u32 value) { return ((f32)value / INT8_MAX); }
+#include "../../inc/util.hpp"
+#include <cmath>
+#include <cstring>
+
+u32 Rng::next(void) {
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Top 24 bits so every step is exactly representable
+f32 Rng::range(f32 min, f32 max) {
+  const f32 scale = (f32)(next() >> 8) / 16777216.0f;
+  return min + scale * (max - min);
+}
+
+f32 midi_to_freq(i32 n) {
+  const i32 A4 = 69;
+  const f32 A4f = 440.0f;
+  const f32 NOTES = 12.0f;
+  return A4f * powf(2.0f, (f32)(n - A4) / NOTES);
+}
+
+void copy_char_buffer(const char *src, char *dst, size_t len) {
+  strcpy(dst, src);
+  dst[len] = '\0';
+}
+
+u8 toggle_bit(u8 original, u8 pos) { return original ^= pos; }
+
+u8 clear_bit(u8 original, u8 pos) { return original &= ~pos; }
+
+u8 set_bit(u8 original, u8 pos) { return original |= pos; }
+
+bool check_bit(u8 original, u8 mask, u8 want) {
+  return (original & mask) == want;
+}
+
+f32 normalize_msg_bipolar(u32 value) {
+  return ((f32)value / (INT8_MAX + 1)) * 2.0f - 1.0f;
+}
+
+f32 normalize_msg(u32 value) { return ((f32)value / INT8_MAX); }
@@ -0,0 +1,125 @@
+#include "../../inc/wav.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static void put_u16(u8 *out, u32 value) {
+  out[0] = static_cast<u8>(value & 0xFF);
+  out[1] = static_cast<u8>((value >> 8) & 0xFF);
+}
+
+static void put_u32(u8 *out, u32 value) {
+  put_u16(out, value & 0xFFFF);
+  put_u16(out + 2, value >> 16);
+}
+
+static void put_u64(u8 *out, u64 value) {
+  put_u32(out, static_cast<u32>(value & 0xFFFFFFFF));
+  put_u32(out + 4, static_cast<u32>(value >> 32));
+}
+
+// "fmt " and its 16 bytes
+static void put_fmt(u8 *out, u32 channels, u32 sample_rate, u32 bits) {
+  const u32 block_align = channels * (bits / 8);
+  memcpy(out, "fmt ", 4);
+  put_u32(out + 4, 16);
+  put_u16(out + 8, bits == 32 ? WAV_FLOAT : WAV_PCM);
+  put_u16(out + 10, channels);
+  put_u32(out + 12, sample_rate);
+  put_u32(out + 16, sample_rate * block_align);
+  put_u16(out + 20, block_align);
+  put_u16(out + 22, bits);
+}
+
+bool wav_bits_valid(u32 bits) { return bits == 16 || bits == 24 || bits == 32; }
+
+void wav_header(u8 *out, u32 channels, u32 sample_rate, u32 bits,
+                u32 data_size) {
+  memcpy(out, "RIFF", 4);
+  put_u32(out + 4, WAV_HEADER_SIZE - 8 + data_size);
+  memcpy(out + 8, "WAVE", 4);
+  put_fmt(out + 12, channels, sample_rate, bits);
+  memcpy(out + 36, "data", 4);
+  put_u32(out + 40, data_size);
+}
+
+// RIFF/RF64, JUNK/ds64 (28), fmt, a JUNK pad, then data's own 8 bytes end on
+// the boundary
+void wav_stream_header(u8 *out, u32 channels, u32 sample_rate, u32 bits,
+                       u64 data_size) {
+  const u32 DS64_SIZE = 28;
+  const u32 PAD_AT = 72;
+  const u32 DATA_AT = WAV_STREAM_HEADER_SIZE - 8;
+  const u64 riff_size = WAV_STREAM_HEADER_SIZE - 8 + data_size;
+  const bool rf64 = riff_size > 0xFFFFFFFFull;
+  const u32 block_align = channels * (bits / 8);
+  memset(out, 0, WAV_STREAM_HEADER_SIZE);
+
+  memcpy(out, rf64 ? "RF64" : "RIFF", 4);
+  put_u32(out + 4, rf64 ? 0xFFFFFFFF : static_cast<u32>(riff_size));
+  memcpy(out + 8, "WAVE", 4);
+  memcpy(out + 12, rf64 ? "ds64" : "JUNK", 4);
+  put_u32(out + 16, DS64_SIZE);
+  if (rf64) {
+    put_u64(out + 20, riff_size);
+    put_u64(out + 28, data_size);
+    put_u64(out + 36, block_align ? data_size / block_align : 0);
+  }
+  put_fmt(out + 48, channels, sample_rate, bits);
+  memcpy(out + PAD_AT, "JUNK", 4);
+  put_u32(out + PAD_AT + 4, DATA_AT - PAD_AT - 8);
+  memcpy(out + DATA_AT, "data", 4);
+  put_u32(out + DATA_AT + 4,
+          rf64 ? 0xFFFFFFFF : static_cast<u32>(data_size));
+}
+
+void wav_encode(const f32 *samples, size_t count, u32 bits,
+                std::vector<u8> &out) {
+  out.resize(count * (bits / 8));
+  wav_encode(samples, count, bits, out.data());
+}
+
+void wav_encode(const f32 *samples, size_t count, u32 bits, u8 *dst) {
+  const size_t width = bits / 8;
+  if (bits == 32) {
+    memcpy(dst, samples, count * sizeof(f32));
+    return;
+  }
+  const f32 scale = bits == 16 ? 32767.0f : 8388607.0f;
+  for (size_t i = 0; i < count; i++) {
+    const f32 clamped = std::clamp(samples[i], -1.0f, 1.0f);
+    const u32 value = static_cast<u32>(lrintf(clamped * scale));
+    for (size_t b = 0; b < width; b++) {
+      dst[i * width + b] = static_cast<u8>((value >> (8 * b)) & 0xFF);
+    }
+  }
+}
+
+bool write_wav(const std::string &path, const f32 *samples, size_t frames,
+               u32 channels, u32 sample_rate, u32 bits) {
+  if (!wav_bits_valid(bits) || channels == 0) {
+    return false;
+  }
+  std::vector<u8> data;
+  wav_encode(samples, frames * channels, bits, data);
+  u8 header[WAV_HEADER_SIZE];
+  wav_header(header, channels, sample_rate, bits,
+             static_cast<u32>(data.size()));
+
+  std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Failed to open wav for writing: " << path << std::endl;
+    return false;
+  }
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(data.data()),
+            static_cast<std::streamsize>(data.size()));
+  if (!out.good()) {
+    std::cerr << "Failed to write wav: " << path << std::endl;
+    return false;
+  }
+  return true;
+}
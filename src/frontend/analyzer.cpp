@@ -0,0 +1,122 @@
+#include "../../inc/analyzer.hpp"
+#include <algorithm>
+#include <cmath>
+
+const f32 SPECTRUM_FLOOR_DB = -96.0f;
+const f32 SPECTRUM_MIN_HZ = 20.0f;
+// Per update, about 30dB a second at 60 frames
+const f32 PEAK_DECAY_DB = 0.5f;
+const size_t TAP_CHUNK = 512;
+
+Analyzer::Analyzer(void)
+    : history(), write_pos(0), window(), bit_reverse(), twiddles(), bins(),
+      window_gain(0.0f), scope(), bands(), peaks() {
+  for (size_t i = 0; i < FFT_SIZE; i++) {
+    window[i] = 0.5f - 0.5f * cosf(2.0f * PI * (f32)i / (f32)FFT_SIZE);
+    window_gain += window[i];
+
+    size_t rev = 0;
+    for (size_t b = 0; b < FFT_LOG2; b++) {
+      rev |= ((i >> b) & 1) << (FFT_LOG2 - 1 - b);
+    }
+    bit_reverse[i] = static_cast<u16>(rev);
+  }
+  for (size_t k = 0; k < twiddles.size(); k++) {
+    const f32 angle = -2.0f * PI * (f32)k / (f32)FFT_SIZE;
+    twiddles[k] = std::complex<f32>(cosf(angle), sinf(angle));
+  }
+  bands.fill(SPECTRUM_FLOOR_DB);
+  peaks.fill(SPECTRUM_FLOOR_DB);
+}
+
+f32 Analyzer::get_floor_db(void) const { return SPECTRUM_FLOOR_DB; }
+
+// Cheap, just copies, safe to call every loop
+void Analyzer::pull(Audio_Tap &tap) {
+  std::array<f32, TAP_CHUNK> chunk;
+  size_t count = 0;
+  while ((count = tap.pop_n(chunk.data(), chunk.size())) > 0) {
+    for (size_t i = 0; i < count; i++) {
+      history[write_pos] = chunk[i];
+      write_pos = (write_pos + 1) % ANALYZER_HISTORY;
+    }
+  }
+}
+
+// Only when a frame is actually being drawn
+void Analyzer::update(i32 sample_rate) {
+  update_scope();
+  update_spectrum(sample_rate);
+}
+
+// Latest rising zero crossing that still leaves a full span after it, falls
+// back to the newest span so silence still draws a flat line
+void Analyzer::update_scope(void) {
+  const size_t search = ANALYZER_HISTORY - SCOPE_SPAN;
+  size_t start = search;
+  for (size_t i = search; i > 1; i--) {
+    const f32 prev = history[(write_pos + i - 1) % ANALYZER_HISTORY];
+    const f32 cur = history[(write_pos + i) % ANALYZER_HISTORY];
+    if (prev < 0.0f && cur >= 0.0f) {
+      start = i;
+      break;
+    }
+  }
+  for (size_t i = 0; i < SCOPE_SPAN; i++) {
+    scope[i] = history[(write_pos + start + i) % ANALYZER_HISTORY];
+  }
+}
+
+// Iterative radix 2, in place on bins
+void Analyzer::fft(void) {
+  for (size_t i = 0; i < FFT_SIZE; i++) {
+    const size_t j = bit_reverse[i];
+    if (i < j) {
+      std::swap(bins[i], bins[j]);
+    }
+  }
+  for (size_t len = 2; len <= FFT_SIZE; len <<= 1) {
+    const size_t half = len / 2;
+    const size_t stride = FFT_SIZE / len;
+    for (size_t i = 0; i < FFT_SIZE; i += len) {
+      for (size_t k = 0; k < half; k++) {
+        const std::complex<f32> t = twiddles[k * stride] * bins[i + k + half];
+        bins[i + k + half] = bins[i + k] - t;
+        bins[i + k] += t;
+      }
+    }
+  }
+}
+
+void Analyzer::update_spectrum(i32 sample_rate) {
+  const size_t offset = ANALYZER_HISTORY - FFT_SIZE;
+  for (size_t i = 0; i < FFT_SIZE; i++) {
+    const f32 x = history[(write_pos + offset + i) % ANALYZER_HISTORY];
+    bins[i] = std::complex<f32>(x * window[i], 0.0f);
+  }
+  fft();
+
+  // Full scale sine reads 0dB
+  const f32 norm = 2.0f / window_gain;
+  const f32 nyquist = NYQUIST((f32)sample_rate);
+  const f32 bin_hz = (f32)sample_rate / (f32)FFT_SIZE;
+  const f32 ratio = nyquist / SPECTRUM_MIN_HZ;
+  for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+    const f32 lo_hz = SPECTRUM_MIN_HZ * powf(ratio, (f32)b / SPECTRUM_BANDS);
+    const f32 hi_hz =
+        SPECTRUM_MIN_HZ * powf(ratio, (f32)(b + 1) / SPECTRUM_BANDS);
+    // Low bands are narrower than a bin, they take the nearest one
+    size_t lo = static_cast<size_t>(lrintf(lo_hz / bin_hz));
+    size_t hi = static_cast<size_t>(lrintf(hi_hz / bin_hz));
+    lo = std::min<size_t>(std::max<size_t>(lo, 1), FFT_SIZE / 2 - 1);
+    hi = std::min<size_t>(std::max(hi, lo + 1), FFT_SIZE / 2);
+
+    f32 mag = 0.0f;
+    for (size_t k = lo; k < hi; k++) {
+      mag = std::max(mag, std::abs(bins[k]));
+    }
+    const f32 db = mag > 0.0f ? 20.0f * log10f(mag * norm) : SPECTRUM_FLOOR_DB;
+    bands[b] = std::max(db, SPECTRUM_FLOOR_DB);
+    peaks[b] = std::max(peaks[b] - PEAK_DECAY_DB, bands[b]);
+  }
+}
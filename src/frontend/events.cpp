@@ -1,75 +1,131 @@
-#include "../../inc/gui.hpp"
-
-void Events::run_events(std::vector<Event_Command> &commands, Window &_win) {
-  for (size_t i = 0; i < commands.size(); i++) {
-    switch (commands[i].type) {
-    default:
-      break;
-    case Event_Command::keydown: {
-      switch (commands[i].key.keycode) {
-      default:
-        break;
-      case SDLK_UP: {
-        up();
-      } break;
-      case SDLK_LEFT: {
-        emit_dec_param();
-      } break;
-      case SDLK_RIGHT: {
-        emit_inc_param();
-      } break;
-      case SDLK_DOWN: {
-        down();
-      } break;
-      }
-    } break;
-    case Event_Command::quit: {
-      _win.set_quit(true);
-    } break;
-    }
-  }
-}
-
-void Events::emit_inc_param(void) {
-  requests.push_back(Modify_Request(cursor, Modify_Request::REQ_INC));
-}
-
-void Events::emit_dec_param(void) {
-  requests.push_back(Modify_Request(cursor, Modify_Request::REQ_DEC));
-}
-
-void Events::down(void) {
-  const size_t next = cursor + 1;
-  cursor = static_cast<SYNTH_PARAMETER>(next % S_PARAM_COUNT);
-}
-
-void Events::up(void) {
-  const i32 _cursor = static_cast<i32>(cursor);
-  const i32 prev = _cursor - 1;
-  if (prev >= 0) {
-    cursor = static_cast<SYNTH_PARAMETER>(cursor - 1);
-  }
-}
-
-std::vector<Event_Command> Events::read_event(void) {
-  SDL_Event event;
-  std::vector<Event_Command> commands(0);
-
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-    default:
-      break;
-
-    case SDL_EVENT_KEY_DOWN: {
-      commands.push_back({Event_Command::keydown, Mouse_Event{},
-                          Key_Event{event.key.key, event.key.mod}});
-    } break;
-
-    case SDL_EVENT_QUIT: {
-      commands.push_back({Event_Command::quit, Mouse_Event{}, Key_Event{}});
-    } break;
-    }
-  }
-
-  return commands;
-}
+#include "../../inc/gui.hpp"
+
+void Events::run_events(std::vector<Event_Command> &commands, Window &_win) {
+  for (size_t i = 0; i < commands.size(); i++) {
+    switch (commands[i].type) {
+    default:
+      break;
+    case Event_Command::keydown: {
+      switch (commands[i].key.keycode) {
+      default:
+        break;
+      case SDLK_UP: {
+        up();
+        _win.mark_dirty(DIRTY_CURSOR);
+      } break;
+      case SDLK_LEFT: {
+        emit_dec_param();
+      } break;
+      case SDLK_RIGHT: {
+        emit_inc_param();
+      } break;
+      case SDLK_DOWN: {
+        down();
+        _win.mark_dirty(DIRTY_CURSOR);
+      } break;
+      case SDLK_S: {
+        _win.set_save_patch(true);
+      } break;
+      case SDLK_A: {
+        _win.set_arp_mode_next(true);
+      } break;
+      case SDLK_R: {
+        _win.set_arp_rate_next(true);
+      } break;
+      case SDLK_V: {
+        _win.toggle_view(VIEW_ANALYZER);
+        _win.mark_dirty(DIRTY_WINDOW);
+      } break;
+      case SDLK_G: {
+        _win.toggle_view(VIEW_VOICES);
+        _win.mark_dirty(DIRTY_WINDOW);
+      } break;
+      case SDLK_D: {
+        _win.set_dump_voices(true);
+      } break;
+      case SDLK_T: {
+        _win.set_export_trace(true);
+      } break;
+      case SDLK_W: {
+        _win.set_toggle_record(true);
+      } break;
+      }
+    } break;
+    case Event_Command::audio_format_changed: {
+      _win.set_audio_changed(commands[i].device);
+    } break;
+    case Event_Command::window_exposed: {
+      _win.update_size();
+      _win.mark_dirty(DIRTY_WINDOW);
+    } break;
+    case Event_Command::quit: {
+      _win.set_quit(true);
+    } break;
+    }
+  }
+}
+
+void Events::emit_inc_param(void) {
+  requests.push_back(Modify_Request(cursor, Modify_Request::REQ_INC));
+}
+
+void Events::emit_dec_param(void) {
+  requests.push_back(Modify_Request(cursor, Modify_Request::REQ_DEC));
+}
+
+void Events::down(void) {
+  const size_t next = cursor + 1;
+  cursor = static_cast<SYNTH_PARAMETER>(next % S_PARAM_COUNT);
+}
+
+void Events::up(void) {
+  const i32 _cursor = static_cast<i32>(cursor);
+  const i32 prev = _cursor - 1;
+  if (prev >= 0) {
+    cursor = static_cast<SYNTH_PARAMETER>(cursor - 1);
+  }
+}
+
+// Sleeps up to timeout_ms for the first event then takes whatever else queued
+std::vector<Event_Command> Events::read_event(i32 timeout_ms) {
+  SDL_Event event;
+  std::vector<Event_Command> commands(0);
+
+  bool pending = SDL_WaitEventTimeout(&event, timeout_ms);
+  while (pending) {
+    push_event(event, commands);
+    pending = SDL_PollEvent(&event);
+  }
+
+  return commands;
+}
+
+void Events::push_event(const SDL_Event &event,
+                        std::vector<Event_Command> &commands) const {
+  switch (event.type) {
+  default:
+    break;
+
+  case SDL_EVENT_KEY_DOWN: {
+    commands.push_back({Event_Command::keydown, Mouse_Event{},
+                        Key_Event{event.key.key, event.key.mod}});
+  } break;
+
+  case SDL_EVENT_AUDIO_DEVICE_FORMAT_CHANGED: {
+    if (!event.adevice.recording) {
+      commands.push_back({Event_Command::audio_format_changed, Mouse_Event{},
+                          Key_Event{}, event.adevice.which});
+    }
+  } break;
+
+  case SDL_EVENT_WINDOW_EXPOSED:
+  case SDL_EVENT_WINDOW_RESIZED: {
+    commands.push_back(
+        {Event_Command::window_exposed, Mouse_Event{}, Key_Event{}});
+  } break;
+
+  case SDL_EVENT_QUIT: {
+    commands.push_back({Event_Command::quit, Mouse_Event{}, Key_Event{}});
+  } break;
+  }
+}
@@ -1,131 +1,417 @@
-#include "../../inc/gui.hpp"
-#include <iostream>
-
-const u8 NULLCHAR = '\0';
-
-Glyph_Entry::Glyph_Entry(void) : texture(), width(0), height(0), c(0) {}
-
-Glyphs::Glyphs(std::string _file_path, f32 _font_size)
-    : glyph_table(), file_path(_file_path), font_size(_font_size),
-      font(nullptr), line_skip(0) {
-
-  std::array default_colours{SDL_Color{0, 0, 0, 255},
-                             SDL_Color{255, 255, 255, 255}};
-
-  for (size_t i = 0; i < colours.size(); i++) {
-    colours[i] = default_colours[i];
-  }
-}
-
-Glyphs::~Glyphs(void) { table_deallocate(); }
-
-i32 Glyphs::get_string_width(const std::string &str) const {
-  i32 x = 0;
-  for (size_t i = 0; i < str.size(); i++) {
-    const u8 c = static_cast<u8>(str[i]);
-    const Glyph_Entry *glyph = get_glyph_at(c, COLOUR_BASE);
-    if (!glyph) {
-      continue;
-    }
-    x += glyph->width;
-  }
-  return x;
-}
-
-const Glyph_Entry *Glyphs::get_glyph_at(const u8 ch,
-                                        size_t colour_index) const {
-  if (colour_index >= glyph_table.size() && glyph_table.size() > 0) {
-    colour_index = glyph_table.size() - 1;
-  } else if (glyph_table.size() == 0) {
-    return nullptr;
-  }
-
-  if (ch >= 32 && ch < ASCII_SIZE) {
-    return &glyph_table[colour_index][ch];
-  } else {
-    return &glyph_table[colour_index]['?'];
-  }
-}
-
-bool Glyphs::open(void) {
-  TTF_Font *tmp = TTF_OpenFont(file_path.c_str(), font_size);
-  if (!tmp) {
-    std::cerr << "Failed to open font from path: " << file_path << std::endl;
-    std::cerr << "TTF Error: " << SDL_GetError() << std::endl;
-    return false;
-  }
-  font = tmp;
-  return true;
-}
-
-void Glyphs::close(void) {
-  if (font) {
-    TTF_CloseFont(font);
-  }
-}
-
-void Glyphs::find_line_skip(void) {
-  if (font) {
-    line_skip = TTF_GetFontLineSkip(font);
-  }
-}
-
-SDL_Surface *Glyphs::create_glyph_surface(const char *str,
-                                          const SDL_Color &col) {
-  SDL_Surface *tmp = TTF_RenderText_Blended(font, str, 0, col);
-  if (!tmp) {
-    std::cerr << "Error rendering text: " << SDL_GetError() << std::endl;
-    return nullptr;
-  }
-  return tmp;
-}
-
-bool Glyphs::table_allocate(Renderer &renderer) {
-  if (!font) {
-    std::cerr << "Invalid font parameter" << std::endl;
-    return false;
-  }
-
-  for (size_t c = 0; c < colours.size(); c++) {
-    std::array<Glyph_Entry, ASCII_SIZE> &glyph_array = glyph_table[c];
-    for (u8 i = ASCII_START; i < ASCII_SIZE; i++) {
-      Glyph_Entry &e = glyph_array[i];
-      const char charstr[] = {(char)i, NULLCHAR};
-
-      SDL_Surface *surf = create_glyph_surface(charstr, colours[c]);
-      if (!surf) {
-        std::cerr << "Failed to generate table" << std::endl;
-        return false;
-      }
-      SDL_Texture *texture = renderer.create_texture(surf);
-      if (!texture) {
-        std::cerr << "Failed to generate table" << std::endl;
-        return false;
-      }
-
-      const i32 width = surf->w;
-      const i32 height = surf->h;
-
-      e.width = width;
-      e.height = height;
-      e.texture = texture;
-      e.c = i;
-
-      SDL_DestroySurface(surf);
-    }
-  }
-  std::cerr << "Generated " << colours.size() * (ASCII_SIZE - ASCII_START)
-            << " characters" << std::endl;
-  return true;
-}
-
-void Glyphs::table_deallocate(void) {
-  for (size_t c = 0; c < colours.size(); c++) {
-    std::array<Glyph_Entry, ASCII_SIZE> &glyph_array = glyph_table[c];
-    for (u8 i = ASCII_START; i < ASCII_SIZE; i++) {
-      Glyph_Entry &e = glyph_array[i];
-      SDL_DestroyTexture(e.texture);
-      e.texture = nullptr;
-    }
-  }
-}
+#include "../../inc/gui.hpp"
+#include "../../inc/mapped_file.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+const u8 NULLCHAR = '\0';
+
+const SDL_Color ATLAS_WHITE = {255, 255, 255, 255};
+const f32 COLOUR_NORM = 1.0f / 255.0f;
+const size_t QUAD_VERTICES = 4;
+const size_t QUAD_INDICES = 6;
+const size_t ATLAS_BYTES_PER_PIXEL = 4;
+const char *GLYPH_CACHE_FILE = "glyphs.cache";
+const char *GLYPH_CACHE_APP = "sgsa";
+
+struct Glyph_Cache_Rect {
+  i32 x, y, w, h;
+};
+
+// Followed by the atlas, RGBA32 rows packed with no pitch padding
+struct Glyph_Cache_Header {
+  u32 magic;
+  u32 version;
+  u64 key;
+  i32 atlas_width, atlas_height, line_skip, reserved;
+  Glyph_Cache_Rect rects[ASCII_SIZE];
+};
+
+static u64 fnv1a(u64 hash, const void *data, size_t size) {
+  const u8 *bytes = static_cast<const u8 *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// The platform's cache directory, made if missing. The pref path is for
+// settings, it's only used when there's no cache directory to be found
+static std::string find_cache_dir(void) {
+  std::string dir;
+#ifdef _WIN32
+  const char *local = SDL_getenv("LOCALAPPDATA");
+  if (local && local[0] != NULLCHAR) {
+    dir = std::string(local) + "\\" + GLYPH_CACHE_APP + "\\";
+  }
+#else
+  const char *home = SDL_getenv("HOME");
+#ifdef __APPLE__
+  if (home && home[0] != NULLCHAR) {
+    dir = std::string(home) + "/Library/Caches/" + GLYPH_CACHE_APP + "/";
+  }
+#else
+  const char *xdg = SDL_getenv("XDG_CACHE_HOME");
+  if (xdg && xdg[0] == '/') {
+    dir = std::string(xdg) + "/" + GLYPH_CACHE_APP + "/";
+  } else if (home && home[0] != NULLCHAR) {
+    dir = std::string(home) + "/.cache/" + GLYPH_CACHE_APP + "/";
+  }
+#endif
+#endif
+  if (!dir.empty() && SDL_CreateDirectory(dir.c_str())) {
+    return dir;
+  }
+
+  char *pref = SDL_GetPrefPath(GLYPH_CACHE_APP, GLYPH_CACHE_APP);
+  dir = pref ? pref : "";
+  SDL_free(pref);
+  return dir;
+}
+
+Glyph_Entry::Glyph_Entry(void) : src(), width(0), height(0), c(0) {}
+
+Glyphs::Glyphs(std::string _file_path, f32 _font_size)
+    : glyph_table(), atlas(nullptr), atlas_width(0), atlas_height(0),
+      file_path(_file_path), font_size(_font_size), font(nullptr),
+      line_skip(0), cache_path(), cache_key(0) {
+
+  std::array default_colours{SDL_Color{0, 0, 0, 255},
+                             SDL_Color{255, 255, 255, 255}};
+
+  for (size_t i = 0; i < colours.size(); i++) {
+    colours[i] = default_colours[i];
+  }
+}
+
+Glyphs::~Glyphs(void) { table_deallocate(); }
+
+i32 Glyphs::get_string_width(const std::string &str) const {
+  i32 x = 0;
+  for (size_t i = 0; i < str.size(); i++) {
+    const u8 c = static_cast<u8>(str[i]);
+    const Glyph_Entry *glyph = get_glyph_at(c);
+    if (!glyph) {
+      continue;
+    }
+    x += glyph->width;
+  }
+  return x;
+}
+
+const Glyph_Entry *Glyphs::get_glyph_at(const u8 ch) const {
+  if (ch >= ASCII_START && ch < ASCII_SIZE) {
+    return &glyph_table[ch];
+  } else {
+    return &glyph_table['?'];
+  }
+}
+
+const SDL_Color &Glyphs::get_colour(size_t colour_index) const {
+  if (colour_index >= colours.size()) {
+    colour_index = COLOUR_BASE;
+  }
+  return colours[colour_index];
+}
+
+// Returns true when the quads had to be rebuilt
+bool Glyphs::layout_string(Text_Layout &layout, const std::string &str, i32 x,
+                           i32 y, size_t colour_index) const {
+  if (layout.valid && layout.text == str && layout.colour == colour_index) {
+    if (layout.x != x || layout.y != y) {
+      const f32 dx = static_cast<f32>(x - layout.x);
+      const f32 dy = static_cast<f32>(y - layout.y);
+      for (size_t v = 0; v < layout.vertices.size(); v++) {
+        layout.vertices[v].position.x += dx;
+        layout.vertices[v].position.y += dy;
+      }
+      layout.x = x;
+      layout.y = y;
+    }
+    return false;
+  }
+
+  layout.text = str;
+  layout.x = x;
+  layout.y = y;
+  layout.colour = colour_index;
+  layout.vertices.clear();
+  layout.indices.clear();
+  layout.vertices.reserve(str.size() * QUAD_VERTICES);
+  layout.indices.reserve(str.size() * QUAD_INDICES);
+
+  const SDL_Color &col = get_colour(colour_index);
+  const SDL_FColor fcol = {col.r * COLOUR_NORM, col.g * COLOUR_NORM,
+                           col.b * COLOUR_NORM, col.a * COLOUR_NORM};
+  const f32 inv_w = atlas_width > 0 ? 1.0f / (f32)atlas_width : 0.0f;
+  const f32 inv_h = atlas_height > 0 ? 1.0f / (f32)atlas_height : 0.0f;
+
+  f32 pen = static_cast<f32>(x);
+  const f32 top = static_cast<f32>(y);
+  for (size_t i = 0; i < str.size(); i++) {
+    const Glyph_Entry *glyph = get_glyph_at(static_cast<u8>(str[i]));
+    const f32 w = static_cast<f32>(glyph->width);
+    const f32 h = static_cast<f32>(glyph->height);
+    const f32 u0 = glyph->src.x * inv_w, u1 = (glyph->src.x + w) * inv_w;
+    const f32 v0 = glyph->src.y * inv_h, v1 = (glyph->src.y + h) * inv_h;
+
+    const int base = static_cast<int>(layout.vertices.size());
+    layout.vertices.push_back({{pen, top}, fcol, {u0, v0}});
+    layout.vertices.push_back({{pen + w, top}, fcol, {u1, v0}});
+    layout.vertices.push_back({{pen + w, top + h}, fcol, {u1, v1}});
+    layout.vertices.push_back({{pen, top + h}, fcol, {u0, v1}});
+    const int quad[QUAD_INDICES] = {base, base + 1, base + 2,
+                                    base, base + 2, base + 3};
+    layout.indices.insert(layout.indices.end(), quad, quad + QUAD_INDICES);
+    pen += w;
+  }
+  layout.width = static_cast<i32>(pen) - x;
+  layout.valid = true;
+  return true;
+}
+
+bool Glyphs::load(Renderer &renderer) {
+  cache_path.clear();
+  cache_key = find_cache_key();
+  const std::string dir = cache_key != 0 ? find_cache_dir() : "";
+  if (!dir.empty()) {
+    cache_path = dir + GLYPH_CACHE_FILE;
+  }
+  if (!cache_path.empty() && load_cache(renderer)) {
+    std::cerr << "Loaded glyph atlas from " << cache_path << std::endl;
+    return true;
+  }
+
+  if (!open()) {
+    return false;
+  }
+  find_line_skip();
+  return table_allocate(renderer);
+}
+
+// TTF only comes up once something actually has to be rasterized
+bool Glyphs::open(void) {
+  if (!TTF_WasInit() && !TTF_Init()) {
+    std::cerr << "Failed to initialize SDL_TTF! -> " << SDL_GetError()
+              << std::endl;
+    return false;
+  }
+  TTF_Font *tmp = TTF_OpenFont(file_path.c_str(), font_size);
+  if (!tmp) {
+    std::cerr << "Failed to open font from path: " << file_path << std::endl;
+    std::cerr << "TTF Error: " << SDL_GetError() << std::endl;
+    return false;
+  }
+  font = tmp;
+  return true;
+}
+
+void Glyphs::close(void) {
+  if (font) {
+    TTF_CloseFont(font);
+  }
+}
+
+void Glyphs::find_line_skip(void) {
+  if (font) {
+    line_skip = TTF_GetFontLineSkip(font);
+  }
+}
+
+SDL_Surface *Glyphs::create_glyph_surface(const char *str,
+                                          const SDL_Color &col) {
+  SDL_Surface *tmp = TTF_RenderText_Blended(font, str, 0, col);
+  if (!tmp) {
+    std::cerr << "Error rendering text: " << SDL_GetError() << std::endl;
+    return nullptr;
+  }
+  return tmp;
+}
+
+// Every glyph goes into one white atlas, packed left to right in rows
+bool Glyphs::table_allocate(Renderer &renderer) {
+  if (!font) {
+    std::cerr << "Invalid font parameter" << std::endl;
+    return false;
+  }
+
+  std::array<SDL_Surface *, ASCII_SIZE> surfaces{};
+  i32 x = 0, y = 0, row_height = 0;
+  bool ok = true;
+  for (u8 i = ASCII_START; i < ASCII_SIZE && ok; i++) {
+    const char charstr[] = {(char)i, NULLCHAR};
+    SDL_Surface *surf = create_glyph_surface(charstr, ATLAS_WHITE);
+    if (!surf) {
+      ok = false;
+      break;
+    }
+    surfaces[i] = surf;
+
+    if (x + surf->w > ATLAS_WIDTH) {
+      x = 0;
+      y += row_height + ATLAS_PADDING;
+      row_height = 0;
+    }
+    Glyph_Entry &e = glyph_table[i];
+    e.src = {(f32)x, (f32)y, (f32)surf->w, (f32)surf->h};
+    e.width = surf->w;
+    e.height = surf->h;
+    e.c = i;
+
+    x += surf->w + ATLAS_PADDING;
+    row_height = SDL_max(row_height, surf->h);
+  }
+
+  SDL_Surface *sheet = nullptr;
+  if (ok) {
+    atlas_width = ATLAS_WIDTH;
+    atlas_height = y + row_height;
+    sheet = SDL_CreateSurface(atlas_width, atlas_height, SDL_PIXELFORMAT_RGBA32);
+    ok = sheet != nullptr;
+  }
+
+  for (u8 i = ASCII_START; i < ASCII_SIZE; i++) {
+    if (!surfaces[i]) {
+      continue;
+    }
+    if (ok) {
+      // Copy the alpha straight across instead of blending onto nothing
+      SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+      const SDL_Rect dst = {(i32)glyph_table[i].src.x,
+                            (i32)glyph_table[i].src.y, glyph_table[i].width,
+                            glyph_table[i].height};
+      ok = SDL_BlitSurface(surfaces[i], NULL, sheet, &dst);
+    }
+    SDL_DestroySurface(surfaces[i]);
+  }
+
+  if (ok) {
+    atlas = renderer.create_texture(sheet);
+    ok = atlas != nullptr;
+  }
+  if (ok && !cache_path.empty()) {
+    store_cache(sheet);
+  }
+  if (sheet) {
+    SDL_DestroySurface(sheet);
+  }
+  if (!ok) {
+    std::cerr << "Failed to generate glyph atlas: " << SDL_GetError()
+              << std::endl;
+    return false;
+  }
+
+  std::cerr << "Generated " << (ASCII_SIZE - ASCII_START) << " characters in a "
+            << atlas_width << "x" << atlas_height << " atlas" << std::endl;
+  return true;
+}
+
+void Glyphs::table_deallocate(void) {
+  if (atlas) {
+    SDL_DestroyTexture(atlas);
+    atlas = nullptr;
+  }
+}
+
+// Anything that changes what gets rasterized goes in. Zero when the font
+// can't be looked at, which skips the cache
+u64 Glyphs::find_cache_key(void) const {
+  SDL_PathInfo info;
+  if (!SDL_GetPathInfo(file_path.c_str(), &info)) {
+    return 0;
+  }
+  const i32 params[] = {GLYPH_CACHE_VERSION, TTF_Version(), ATLAS_WIDTH,
+                        ATLAS_PADDING,       ASCII_START,   ASCII_SIZE};
+  u64 key = 0xcbf29ce484222325ull;
+  key = fnv1a(key, file_path.data(), file_path.size());
+  key = fnv1a(key, &font_size, sizeof(font_size));
+  key = fnv1a(key, &info.size, sizeof(info.size));
+  key = fnv1a(key, &info.modify_time, sizeof(info.modify_time));
+  key = fnv1a(key, params, sizeof(params));
+  return key;
+}
+
+// The surface points straight into the mapping, only the texture upload
+// touches the pixels
+bool Glyphs::load_cache(Renderer &renderer) {
+  Mapped_File file;
+  if (!file.open(cache_path) || file.size() < sizeof(Glyph_Cache_Header)) {
+    return false;
+  }
+  Glyph_Cache_Header head;
+  memcpy(&head, file.data(), sizeof(head));
+  if (head.magic != GLYPH_CACHE_MAGIC || head.version != GLYPH_CACHE_VERSION ||
+      head.key != cache_key || head.atlas_width != ATLAS_WIDTH ||
+      head.atlas_height <= 0) {
+    return false;
+  }
+  const size_t pitch = (size_t)head.atlas_width * ATLAS_BYTES_PER_PIXEL;
+  if (file.size() != sizeof(head) + pitch * (size_t)head.atlas_height) {
+    return false;
+  }
+
+  // SDL doesn't write through it, the surface is gone before the mapping
+  void *pixels = const_cast<u8 *>(file.data() + sizeof(head));
+  SDL_Surface *sheet =
+      SDL_CreateSurfaceFrom(head.atlas_width, head.atlas_height,
+                            SDL_PIXELFORMAT_RGBA32, pixels, (int)pitch);
+  if (!sheet) {
+    return false;
+  }
+  SDL_Texture *tex = renderer.create_texture(sheet);
+  SDL_DestroySurface(sheet);
+  if (!tex) {
+    return false;
+  }
+
+  table_deallocate();
+  atlas = tex;
+  atlas_width = head.atlas_width;
+  atlas_height = head.atlas_height;
+  line_skip = head.line_skip;
+  for (u8 i = ASCII_START; i < ASCII_SIZE; i++) {
+    const Glyph_Cache_Rect &r = head.rects[i];
+    Glyph_Entry &e = glyph_table[i];
+    e.src = {(f32)r.x, (f32)r.y, (f32)r.w, (f32)r.h};
+    e.width = r.w;
+    e.height = r.h;
+    e.c = i;
+  }
+  return true;
+}
+
+// Written next to the old one and renamed over it, a reader never sees half
+// a file
+void Glyphs::store_cache(const SDL_Surface *sheet) const {
+  Glyph_Cache_Header head;
+  memset(&head, 0, sizeof(head));
+  head.magic = GLYPH_CACHE_MAGIC;
+  head.version = GLYPH_CACHE_VERSION;
+  head.key = cache_key;
+  head.atlas_width = atlas_width;
+  head.atlas_height = atlas_height;
+  head.line_skip = line_skip;
+  for (u8 i = ASCII_START; i < ASCII_SIZE; i++) {
+    const Glyph_Entry &e = glyph_table[i];
+    head.rects[i] = {(i32)e.src.x, (i32)e.src.y, e.width, e.height};
+  }
+
+  const std::string tmp = cache_path + ".tmp";
+  std::ofstream out(tmp, std::ios::binary | std::ios::out | std::ios::trunc);
+  if (!out.is_open()) {
+    std::cerr << "Failed to open glyph cache for writing: " << tmp
+              << std::endl;
+    return;
+  }
+  out.write(reinterpret_cast<const char *>(&head), sizeof(head));
+  const size_t row = (size_t)atlas_width * ATLAS_BYTES_PER_PIXEL;
+  const char *pixels = static_cast<const char *>(sheet->pixels);
+  for (i32 y = 0; y < atlas_height; y++) {
+    out.write(pixels + (size_t)y * (size_t)sheet->pitch, (std::streamsize)row);
+  }
+  out.close();
+  if (!out.good() || !SDL_RenamePath(tmp.c_str(), cache_path.c_str())) {
+    std::cerr << "Failed to write glyph cache: " << cache_path << std::endl;
+  }
+}
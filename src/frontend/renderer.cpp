@@ -1,56 +1,168 @@
-#include "../../inc/gui.hpp"
-#include <cmath>
-#include <iostream>
-
-bool Rect::point_in_rect(i32 _x, i32 _y) const {
-  return (_x >= x && _x <= x + w) && (_y >= y && _y <= y + h);
-}
-
-// She const on my non const renderer data until I constawsdk pnlasdas
-void Renderer::render_param_list(
-    const std::array<ParamF32, S_PARAM_COUNT> &items, const Glyphs &g) const {
-  const f32 width_f32 = static_cast<f32>(window_width);
-  for (size_t i = 0; i < items.size(); i++) {
-    const ParamF32 &p = items[i];
-
-    const i32 rect_width = g.get_string_width(p.name);
-    const i32 n = static_cast<i32>(i);
-    const i32 y = n * g.get_line_skip();
-    const i32 x = static_cast<i32>(
-        roundf((p.value - p.min) / (p.max - p.min) * width_f32));
-
-    Rect rect{x, y, rect_width, g.get_line_skip()};
-
-    render_rect_i(rect.x - (rect_width / 2), rect.y, rect.w, rect.h);
-    render_string(g, p.name, y, x - (rect_width / 2));
-  }
-}
-
-i32 Renderer::render_string(const Glyphs &g, const std::string &str,
-                            const i32 &y, const i32 &start_x) const {
-  i32 x = start_x;
-  for (size_t i = 0; i < str.size(); i++) {
-    const u8 c = static_cast<u8>(str[i]);
-    const Glyph_Entry *glyph = g.get_glyph_at(c, COLOUR_BASE);
-    if (!glyph) {
-      continue;
-    }
-    render_char(glyph, y, x);
-    x += glyph->width;
-  }
-
-  return x - start_x;
-}
-
-void Renderer::render_rect_i(i32 x, i32 y, i32 w, i32 h) const {
-  SDL_FRect rect{(f32)x, (f32)y, (f32)w, (f32)h};
-  SDL_RenderFillRect(r, &rect);
-}
-
-void Renderer::render_char(const Glyph_Entry *glyph, const i32 &y,
-                           const i32 &x) const {
-  SDL_FRect box = {(f32)x, (f32)y, (f32)glyph->width, (f32)glyph->height};
-  if (!SDL_RenderTexture(r, glyph->texture, NULL, &box)) {
-    std::cerr << "Failed to render character: " << SDL_GetError() << std::endl;
-  }
-}
+#include "../../inc/gui.hpp"
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+bool Rect::point_in_rect(i32 _x, i32 _y) const {
+  return (_x >= x && _x <= x + w) && (_y >= y && _y <= y + h);
+}
+
+const i32 METER_HEIGHT = 8;
+const f32 PEAK_HEIGHT = 2.0f;
+
+// Layouts only rebuild when a value moves its label, the boxes and labels then
+// go out as one fill call and one geometry call each. The cursor row is drawn
+// light on the background instead of dark on a box
+void Renderer::render_param_list(
+    const std::array<ParamF32, S_PARAM_COUNT> &items, const Glyphs &g,
+    size_t cursor) {
+  const f32 width_f32 = static_cast<f32>(window_width);
+  for (size_t i = 0; i < items.size(); i++) {
+    const ParamF32 &p = items[i];
+    Text_Layout &layout = param_layouts[i];
+
+    const i32 n = static_cast<i32>(i);
+    const i32 y = n * g.get_line_skip();
+    const i32 x = static_cast<i32>(
+        roundf((p.value - p.min) / (p.max - p.min) * width_f32));
+    // Width only changes with the text, the previous layout already has it
+    const i32 rect_width = layout.valid && layout.text == p.name
+                               ? layout.width
+                               : g.get_string_width(p.name);
+
+    g.layout_string(layout, p.name, x - (rect_width / 2), y,
+                    i == cursor ? COLOUR_LIGHT : COLOUR_BASE);
+    param_rects[i] = {(f32)(x - (rect_width / 2)), (f32)y, (f32)rect_width,
+                      (f32)g.get_line_skip()};
+    drawn_values[i] = p.value;
+  }
+
+  // Cursor box goes last so it can be left out of the fill
+  size_t rect_count = param_rects.size();
+  if (cursor < rect_count) {
+    std::swap(param_rects[cursor], param_rects[rect_count - 1]);
+    rect_count--;
+  }
+  SDL_RenderFillRects(r, param_rects.data(), (int)rect_count);
+  for (size_t i = 0; i < param_layouts.size(); i++) {
+    render_layout(g, param_layouts[i]);
+  }
+}
+
+bool Renderer::param_list_changed(
+    const std::array<ParamF32, S_PARAM_COUNT> &items) const {
+  for (size_t i = 0; i < items.size(); i++) {
+    if (items[i].value != drawn_values[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Sounding voices as a bar along the bottom edge
+void Renderer::render_voice_meter(size_t active, size_t total) {
+  meter_value = active;
+  if (total == 0) {
+    return;
+  }
+  const i32 w = static_cast<i32>(
+      (static_cast<f32>(active) / static_cast<f32>(total)) *
+      static_cast<f32>(window_width));
+  render_rect_i(0, window_height - METER_HEIGHT, w, METER_HEIGHT);
+}
+
+// One line strip, full scale fills the area
+void Renderer::render_scope(const Analyzer &an, const SDL_FRect &area) {
+  const std::array<f32, SCOPE_SPAN> &scope = an.get_scope();
+  const f32 mid = area.y + area.h * 0.5f;
+  const f32 step = area.w / (f32)(SCOPE_SPAN - 1);
+  for (size_t i = 0; i < SCOPE_SPAN; i++) {
+    const f32 v = scope[i] > 1.0f ? 1.0f : (scope[i] < -1.0f ? -1.0f : scope[i]);
+    scope_points[i] = {area.x + step * (f32)i, mid - v * area.h * 0.5f};
+  }
+  SDL_RenderLines(r, scope_points.data(), (int)scope_points.size());
+}
+
+// Bars from the floor up, peaks as thin caps, one fill call each
+void Renderer::render_spectrum(const Analyzer &an, const SDL_FRect &area) {
+  const f32 floor_db = an.get_floor_db();
+  const f32 bar_w = area.w / (f32)SPECTRUM_BANDS;
+  const f32 bottom = area.y + area.h;
+  for (size_t b = 0; b < SPECTRUM_BANDS; b++) {
+    const f32 level = 1.0f - an.get_bands()[b] / floor_db;
+    const f32 peak = 1.0f - an.get_peaks()[b] / floor_db;
+    const f32 x = area.x + bar_w * (f32)b;
+    const f32 h = SDL_max(level, 0.0f) * area.h;
+    band_rects[b] = {x, bottom - h, bar_w - 1.0f, h};
+    peak_rects[b] = {x, bottom - SDL_max(peak, 0.0f) * area.h, bar_w - 1.0f,
+                     PEAK_HEIGHT};
+  }
+  SDL_RenderFillRects(r, band_rects.data(), (int)band_rects.size());
+  SDL_RenderFillRects(r, peak_rects.data(), (int)peak_rects.size());
+}
+
+// A cell per voice, label on top, envelope level filling up from the bottom
+// and render cost as a strip along the bottom relative to the busiest voice.
+// Suspect voices get flagged in the label
+void Renderer::render_voice_grid(const Voice_Monitor &mon, const Glyphs &g,
+                                 const SDL_FRect &area) {
+  const size_t COLUMNS = 4;
+  const size_t rows = (VOICES + COLUMNS - 1) / COLUMNS;
+  const f32 cell_w = area.w / (f32)COLUMNS;
+  const f32 cell_h = area.h / (f32)rows;
+  const f32 label_h = (f32)g.get_line_skip();
+  const f32 bar_h = SDL_max(cell_h - label_h - PEAK_HEIGHT * 2.0f, 0.0f);
+  const u64 peak = mon.get_peak_cycles();
+
+  const Voice_Snapshot &s = mon.get_latest();
+  for (size_t i = 0; i < VOICES; i++) {
+    const Voice_Telemetry &t = s.voices[i];
+    const f32 x = area.x + cell_w * (f32)(i % COLUMNS);
+    const f32 y = area.y + cell_h * (f32)(i / COLUMNS);
+
+    std::string label = std::to_string(i) + " " + get_stage_name(t.stage);
+    if (t.stage != OFF || t.active != 0) {
+      label += " " + std::to_string(t.key) + " x" + std::to_string(t.active);
+    }
+    if (mon.is_suspect(i)) {
+      label += " !";
+    }
+    g.layout_string(voice_layouts[i], label, (i32)x, (i32)y, COLOUR_LIGHT);
+
+    const f32 level = t.level > 1.0f ? 1.0f : (t.level < 0.0f ? 0.0f : t.level);
+    level_rects[i] = {x, y + label_h + bar_h * (1.0f - level), cell_w - 2.0f,
+                      bar_h * level};
+    const f32 cost = peak > 0 ? (f32)t.cycles / (f32)peak : 0.0f;
+    cost_rects[i] = {x, y + cell_h - PEAK_HEIGHT * 2.0f,
+                     (cell_w - 2.0f) * cost, PEAK_HEIGHT};
+  }
+
+  SDL_RenderFillRects(r, level_rects.data(), (int)level_rects.size());
+  SDL_RenderFillRects(r, cost_rects.data(), (int)cost_rects.size());
+  for (size_t i = 0; i < voice_layouts.size(); i++) {
+    render_layout(g, voice_layouts[i]);
+  }
+}
+
+i32 Renderer::render_string(const Glyphs &g, const std::string &str,
+                            const i32 &y, const i32 &start_x) {
+  g.layout_string(scratch, str, start_x, y, COLOUR_BASE);
+  render_layout(g, scratch);
+  return scratch.width;
+}
+
+void Renderer::render_layout(const Glyphs &g, const Text_Layout &layout) const {
+  if (layout.indices.empty()) {
+    return;
+  }
+  if (!SDL_RenderGeometry(r, g.get_atlas(), layout.vertices.data(),
+                          (int)layout.vertices.size(), layout.indices.data(),
+                          (int)layout.indices.size())) {
+    std::cerr << "Failed to render string: " << SDL_GetError() << std::endl;
+  }
+}
+
+void Renderer::render_rect_i(i32 x, i32 y, i32 w, i32 h) const {
+  SDL_FRect rect{(f32)x, (f32)y, (f32)w, (f32)h};
+  SDL_RenderFillRect(r, &rect);
+}
@@ -0,0 +1,59 @@
+#include "../../inc/telemetry.hpp"
+
+#include <iomanip>
+
+static const char *STAGE_NAMES[] = {"ATK", "DEC", "REL", "SUS", "OFF"};
+
+const char *get_stage_name(u8 stage) {
+  return stage <= OFF ? STAGE_NAMES[stage] : "???";
+}
+
+Voice_Monitor::Voice_Monitor(void)
+    : history(VOICE_HISTORY), write_pos(0), count(0), latest() {}
+
+// False when the audio thread hasn't finished a block since the last pull
+bool Voice_Monitor::pull(const Synth &syn) {
+  Voice_Snapshot snapshot;
+  if (!syn.read_telemetry(snapshot) || snapshot.block == latest.block) {
+    return false;
+  }
+  latest = snapshot;
+  history[write_pos] = snapshot;
+  write_pos = (write_pos + 1) % history.size();
+  count = count < history.size() ? count + 1 : count;
+  return true;
+}
+
+u64 Voice_Monitor::get_peak_cycles(void) const {
+  u64 peak = 0;
+  for (size_t i = 0; i < latest.voices.size(); i++) {
+    peak = latest.voices[i].cycles > peak ? latest.voices[i].cycles : peak;
+  }
+  return peak;
+}
+
+bool Voice_Monitor::is_suspect(size_t voice) const {
+  const Voice_Telemetry &t = latest.voices[voice];
+  return t.active < 0 || (t.stage == OFF && t.active > 0);
+}
+
+// Oldest first, idle voices left out unless they look stuck
+void Voice_Monitor::dump(std::ostream &out) const {
+  out << "Voice telemetry, last " << count << " blocks" << std::endl;
+  const size_t start = (write_pos + history.size() - count) % history.size();
+  for (size_t h = 0; h < count; h++) {
+    const Voice_Snapshot &s = history[(start + h) % history.size()];
+    out << "block " << s.block << std::endl;
+    for (size_t i = 0; i < s.voices.size(); i++) {
+      const Voice_Telemetry &t = s.voices[i];
+      if (t.stage == OFF && t.active == 0) {
+        continue;
+      }
+      out << "  voice " << std::setw(2) << i << " key " << std::setw(3)
+          << t.key << " " << get_stage_name(t.stage) << " active "
+          << t.active << " level " << std::fixed << std::setprecision(3)
+          << t.level << " cycles " << t.cycles << std::endl;
+    }
+  }
+  out << std::defaultfloat;
+}
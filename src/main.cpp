@@ -1,143 +1,596 @@
-#include "../inc/synth.hpp"
-#include "../inc/audio_sys.hpp"
-#include "../inc/gui.hpp"
-
-#include <ctime>
-#include <iostream>
-#include <portmidi.h>
-
-static bool initialize(void);
-static bool quit(void);
-static void listen_event_emits(Events& events, Synth& syn);
-
-static bool initialize(void) {
-  if (!SDL_Init(SDL_INIT_AUDIO | SDL_INIT_EVENTS | SDL_INIT_VIDEO)) {
-    std::cerr << "Failed to initialize SDL! -> " << SDL_GetError() << std::endl;
-    return false;
-  }
-
-  if(!TTF_Init()){
-    std::cerr << "Failed to initialize SDL_TTF! -> " << SDL_GetError() << std::endl;
-    return false;
-  }
-
-  if (Pm_Initialize() < 0) {
-    std::cerr << "Failed to initialize PortMidi!" << std::endl;
-    return false;
-  }
-  return true;
-}
-
-static bool quit(void) {
-  TTF_Quit();
-  SDL_Quit();
-  if (Pm_Terminate() < 0) {
-    std::cerr << "PortMidi failed to terminate correctly!" << std::endl;
-    return false;
-  }
-  return true;
-}
-
-
- //static void listen_event_emits(Events& events, Synth& syn){
-   //std::vector<Modify_Request> reqs = events.get_requests();
-   //for(size_t i = 0; i < reqs.size(); i++){
-     //const Modify_Request& req = reqs[i];
-     //switch(req.method){
-       //case Modify_Request::REQ_DEC: {
-         //syn.dec_param(req.index);
-       //} break;
-       //case Modify_Request::REQ_INC: {
-         //syn.inc_param(req.index);
-       //} break;
-     //}
-   //}
-   //events.clear_requests();
- //}
-
-int main(int argc, char **argv) {
-  const char *name_arg = NULL;
-  if (argc > 1 && argc < 3) {
-    name_arg = argv[1];
-  } else {
-    std::cout << "Usage: sgsa device-name" << std::endl;
-    return 0;
-  }
-  srand((unsigned int)time(NULL));
-
-  if (!initialize()) {
-    return 0;
-  }
-  const i32 compiled = SDL_VERSION;
-  const i32 linked = SDL_GetVersion();
-
-  std::cout << "Compiled SDL Version: " << SDL_VERSIONNUM_MAJOR(compiled) << "."
-            << SDL_VERSIONNUM_MINOR(compiled) << "."
-            << SDL_VERSIONNUM_MICRO(compiled) << "." << std::endl;
-
-  std::cout << "Linked SDL Version: " << SDL_VERSIONNUM_MAJOR(linked) << "."
-            << SDL_VERSIONNUM_MINOR(linked) << "."
-            << SDL_VERSIONNUM_MICRO(linked) << "." << std::endl;
-
-  Window win(SDL_WINDOW_HIDDEN, 400, 300);
-  if(!win.create_window()){
-    quit();
-    return 1;
-  }
-  
-  if(!win.get_render_class().create_renderer(win.get_window())){
-    quit();
-    return 1;
-  }
-
-
-  Glyphs glyphs("arial.ttf", 18.0f);
-  if(!glyphs.open()){
-    quit();
-    return 1;
-  }
-  glyphs.find_line_skip();
-
-  if(!glyphs.table_allocate(win.get_render_class())){
-    quit();
-    return 1;
-  }
-
-  Synth syn;
-  Controller controller(name_arg);
-  Audio_Sys audio(syn.get_channels(), syn.get_sample_rate());
-
-  audio.open(&syn);
-  controller.open();
-  win.show_window();
-
-  const u32 FPS = 120;
-  const u32 FG = 1000 / FPS;
-  while (!win.get_quit()) {
-    const u64 START = SDL_GetTicks();
-  
-    win.get_render_class().clear_colour(0, 0, 0, 255);
-    win.get_render_class().clear();
-    
-    std::vector<Event_Command> sdl_cmds = win.get_event_class().read_event();
-    std::vector<Keyboard_Command> midi_cmds = syn.read_event(controller);
-
-    syn.run_events(midi_cmds);
-    win._run_events(sdl_cmds);
-    
-    win.get_render_class().clear_colour(255, 255, 255, 255);
-    win.get_render_class().present();
-
-    const u64 FT = SDL_GetTicks() - START;
-    if (FT < FG) {
-      const u32 DELAY = (u32)(FG - FT);
-      SDL_Delay(DELAY);
-    }
-  }
-
-  audio.close();
-  controller.close();
-  glyphs.close();
-  quit();
-  return 0;
-}
+#include "../inc/synth.hpp"
+#include "../inc/audio_sys.hpp"
+#include "../inc/gui.hpp"
+#include "../inc/midi_input.hpp"
+#include "../inc/analyzer.hpp"
+#include "../inc/telemetry.hpp"
+#include "../inc/golden.hpp"
+#include "../inc/batch.hpp"
+#include "../inc/capture.hpp"
+#include "../inc/ensemble.hpp"
+#include "../inc/trace.hpp"
+#include "../inc/latency.hpp"
+#include "../inc/note_cache.hpp"
+#include "../inc/recorder.hpp"
+#include "../inc/render_ahead.hpp"
+#include "../inc/rt_thread.hpp"
+#include "../inc/util.hpp"
+
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <portmidi.h>
+#include <thread>
+#include <vector>
+
+struct Device_Option {
+  const char *name;
+  u32 channel;
+};
+
+struct Options {
+  std::vector<Device_Option> devices;
+  i32 device_frames = 0;
+  bool dither = false;
+  const char *bank_path = "presets.sgsb";
+  bool vsync = false;
+  f32 silence_db = -96.0f;
+  // Headless, renders the golden scenarios and exits
+  const char *golden_record = nullptr;
+  const char *golden_check = nullptr;
+  const char *capture = nullptr;
+  // Starts a take as soon as audio is up, W starts and stops more
+  const char *record = nullptr;
+  // Headless, plays a capture back offline and exits
+  const char *replay = nullptr;
+  const char *replay_out = nullptr;
+  // Headless, notes to time per configuration, --frames narrows the sweep
+  i32 latency_notes = 0;
+  // ms of each note to pre-render, 0 leaves the cache off
+  i32 note_cache_ms = 0;
+  // Multi-timbral, part n plays MIDI channel n
+  i32 parts = 1;
+  // Blocks rendered ahead of the device at least, 0 renders in the callback
+  i32 ahead_blocks = 0;
+  Rt_Config rt;
+  // Headless, renders a note grid from a bank program into wavs and exits
+  const char *batch_dir = nullptr;
+  i32 program = -1;
+  Batch_Grid grid;
+  i32 jobs = 0;
+};
+
+static bool parse_options(int argc, char **argv, Options &opts);
+static bool initialize(void);
+static bool quit(void);
+static void listen_event_emits(Events &events,
+                               std::vector<Keyboard_Command> &commands);
+static void wake_main_loop(void *userdata);
+static bool run_batch(Options &opts);
+
+static bool parse_options(int argc, char **argv, Options &opts) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      opts.device_frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bank") == 0 && i + 1 < argc) {
+      opts.bank_path = argv[++i];
+    } else if (strcmp(argv[i], "--dither") == 0) {
+      opts.dither = true;
+    } else if (strcmp(argv[i], "--vsync") == 0) {
+      opts.vsync = true;
+    } else if (strcmp(argv[i], "--silence-db") == 0 && i + 1 < argc) {
+      opts.silence_db = (f32)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--golden-record") == 0 && i + 1 < argc) {
+      opts.golden_record = argv[++i];
+    } else if (strcmp(argv[i], "--golden-check") == 0 && i + 1 < argc) {
+      opts.golden_check = argv[++i];
+    } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      opts.capture = argv[++i];
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      opts.record = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      opts.replay = argv[++i];
+    } else if (strcmp(argv[i], "--replay-out") == 0 && i + 1 < argc) {
+      opts.replay_out = argv[++i];
+    } else if (strcmp(argv[i], "--latency") == 0) {
+      opts.latency_notes = LATENCY_NOTES_DEFAULT;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        opts.latency_notes = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--note-cache") == 0) {
+      opts.note_cache_ms = NOTE_CACHE_MS_DEFAULT;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        opts.note_cache_ms = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--ahead") == 0) {
+      opts.ahead_blocks = AHEAD_BLOCKS_DEFAULT;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        opts.ahead_blocks = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--no-rt") == 0) {
+      opts.rt.realtime = false;
+    } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+      if (!parse_batch_list(argv[++i], opts.rt.cpus)) {
+        return false;
+      }
+    } else if (strcmp(argv[i], "--parts") == 0 && i + 1 < argc) {
+      opts.parts = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      opts.batch_dir = argv[++i];
+    } else if (strcmp(argv[i], "--program") == 0 && i + 1 < argc) {
+      opts.program = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+      if (!parse_batch_list(argv[++i], opts.grid.keys)) {
+        return false;
+      }
+    } else if (strcmp(argv[i], "--velocities") == 0 && i + 1 < argc) {
+      if (!parse_batch_list(argv[++i], opts.grid.velocities)) {
+        return false;
+      }
+    } else if (strcmp(argv[i], "--round-robin") == 0 && i + 1 < argc) {
+      opts.grid.round_robins = static_cast<u32>(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--hold") == 0 && i + 1 < argc) {
+      opts.grid.hold_s = (f32)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--tail") == 0 && i + 1 < argc) {
+      opts.grid.tail_s = (f32)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc) {
+      opts.grid.bits = static_cast<u32>(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      opts.jobs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      // Remaps the device named just before it
+      const i32 channel = atoi(argv[++i]);
+      if (opts.devices.empty() || channel < 1 || channel > 16) {
+        return false;
+      }
+      opts.devices.back().channel = static_cast<u32>(channel);
+    } else if (argv[i][0] != '-') {
+      opts.devices.push_back({argv[i], CHANNEL_KEEP});
+    } else {
+      return false;
+    }
+  }
+  if (opts.golden_record || opts.golden_check || opts.replay) {
+    return true;
+  }
+  if (opts.batch_dir) {
+    return opts.jobs >= 0 && opts.silence_db < 0.0f;
+  }
+  if (opts.latency_notes != 0) {
+    return opts.latency_notes > 0 && opts.device_frames >= 0;
+  }
+  return !opts.devices.empty() && opts.devices.size() <= MIDI_DEVICE_MAX &&
+         opts.device_frames >= 0 && opts.silence_db < 0.0f &&
+         opts.note_cache_ms >= 0 && opts.parts >= 1 &&
+         opts.parts <= (i32)ENSEMBLE_PARTS_MAX && opts.ahead_blocks >= 0 &&
+         opts.ahead_blocks <= (i32)AHEAD_BLOCKS_MAX;
+}
+
+// Just what the audio device needs. Video comes up once sound is going,
+// PortMidi on its own thread and TTF only if the glyph cache misses
+static bool initialize(void) {
+  if (!SDL_Init(SDL_INIT_AUDIO | SDL_INIT_EVENTS)) {
+    std::cerr << "Failed to initialize SDL! -> " << SDL_GetError() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Device enumeration is the slow part of PortMidi, nothing else waits on it
+static void open_midi(Midi_Input *midi, u64 *took_ns) {
+  const u64 start = now_ns();
+  if (Pm_Initialize() < 0) {
+    std::cerr << "Failed to initialize PortMidi!" << std::endl;
+  } else {
+    midi->open();
+  }
+  *took_ns = now_ns() - start;
+}
+
+static bool open_ui(Window &win, Glyphs &glyphs, bool vsync) {
+  if (!SDL_InitSubSystem(SDL_INIT_VIDEO)) {
+    std::cerr << "Failed to initialize SDL video! -> " << SDL_GetError()
+              << std::endl;
+    return false;
+  }
+  if (!win.create_window() ||
+      !win.get_render_class().create_renderer(win.get_window())) {
+    return false;
+  }
+  if (vsync) {
+    win.get_render_class().set_vsync(true);
+  }
+  return glyphs.load(win.get_render_class());
+}
+
+// Ingest thread, pushes an empty event so the main loop's wait returns
+static void wake_main_loop(void *userdata) {
+  SDL_Event event;
+  memset(&event, 0, sizeof(event));
+  event.type = *static_cast<const u32 *>(userdata);
+  SDL_PushEvent(&event);
+}
+
+static bool quit(void) {
+  if (TTF_WasInit()) {
+    TTF_Quit();
+  }
+  SDL_Quit();
+  if (Pm_Terminate() < 0) {
+    std::cerr << "PortMidi failed to terminate correctly!" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+// Param edits go through the audio queue like everything else, so they land
+// between blocks and a capture sees them
+static void listen_event_emits(Events &events,
+                               std::vector<Keyboard_Command> &commands) {
+  std::vector<Modify_Request> &reqs = events.get_requests();
+  for (size_t i = 0; i < reqs.size(); i++) {
+    const Modify_Request &req = reqs[i];
+    const Midi_Input_Msg msg(0, static_cast<u32>(req.index), 0);
+    switch (req.method) {
+    case Modify_Request::REQ_DEC: {
+      commands.push_back({Keyboard_Command::param_dec, msg});
+    } break;
+    case Modify_Request::REQ_INC: {
+      commands.push_back({Keyboard_Command::param_inc, msg});
+    } break;
+    }
+  }
+  events.clear_requests();
+}
+
+// The default patch unless a program is named, then it has to be there
+static bool run_batch(Options &opts) {
+  Preset preset;
+  Synth().store_patch(preset);
+  if (opts.program >= 0) {
+    Preset_Bank bank(opts.bank_path);
+    const Preset *stored =
+        bank.open() ? bank.get_preset_at(static_cast<u32>(opts.program))
+                    : nullptr;
+    if (!stored || stored->osc_count == 0) {
+      std::cerr << "No program " << opts.program << " in " << opts.bank_path
+                << std::endl;
+      return false;
+    }
+    preset = *stored;
+  }
+  if (opts.grid.keys.empty()) {
+    parse_batch_list("36-96", opts.grid.keys);
+  }
+  if (opts.grid.velocities.empty()) {
+    opts.grid.velocities.push_back(100);
+  }
+  opts.grid.trim_db = opts.silence_db;
+  return batch_render(preset, opts.grid, opts.batch_dir,
+                      static_cast<size_t>(opts.jobs));
+}
+
+int main(int argc, char **argv) {
+  // Offline renders flush denormals the same way the live threads do
+  rt_denormals_off();
+  Options opts;
+  if (!parse_options(argc, argv, opts)) {
+    std::cout << "Usage: sgsa device-name [-c channel] [device-name [-c channel]...] "
+                 "[--frames 32|64|128...] [--dither] [--bank presets.sgsb] "
+                 "[--vsync] [--silence-db -96] [--capture session.sgsc] "
+                 "[--record take.wav] [--note-cache [ms]] [--parts 1-16] "
+                 "[--ahead [blocks]] [--no-rt] [--cpus 2,3]"
+              << std::endl;
+    std::cout << "       sgsa --golden-record dir | --golden-check dir"
+              << std::endl;
+    std::cout << "       sgsa --replay session.sgsc [--replay-out out.f32]"
+              << std::endl;
+    std::cout << "       sgsa --latency [notes] [--frames 128]" << std::endl;
+    std::cout << "       sgsa --batch dir [--bank presets.sgsb] [--program n] "
+                 "[--keys 36-96:1] [--velocities 40,80,127] [--round-robin 1] "
+                 "[--hold 1.0] [--tail 4.0] [--bits 16|24|32] [--jobs n]"
+              << std::endl;
+    return 0;
+  }
+  if (opts.golden_record) {
+    return golden_record(opts.golden_record) ? 0 : 1;
+  }
+  if (opts.golden_check) {
+    return golden_check(opts.golden_check) ? 0 : 1;
+  }
+  if (opts.replay) {
+    return replay_session(opts.replay, opts.replay_out) ? 0 : 1;
+  }
+  if (opts.batch_dir) {
+    return run_batch(opts) ? 0 : 1;
+  }
+
+  if (opts.latency_notes > 0) {
+    if (!SDL_Init(SDL_INIT_AUDIO | SDL_INIT_EVENTS)) {
+      std::cerr << "Failed to initialize SDL! -> " << SDL_GetError()
+                << std::endl;
+      return 1;
+    }
+    std::vector<i32> sizes;
+    if (opts.device_frames > 0) {
+      sizes.push_back(opts.device_frames);
+    }
+    const bool measured =
+        latency_sweep(sizes, static_cast<size_t>(opts.latency_notes));
+    SDL_Quit();
+    return measured ? 0 : 1;
+  }
+
+  const u64 startup = now_ns();
+  if (!initialize()) {
+    return 0;
+  }
+  const i32 compiled = SDL_VERSION;
+  const i32 linked = SDL_GetVersion();
+
+  std::cout << "Compiled SDL Version: " << SDL_VERSIONNUM_MAJOR(compiled) << "."
+            << SDL_VERSIONNUM_MINOR(compiled) << "."
+            << SDL_VERSIONNUM_MICRO(compiled) << "." << std::endl;
+
+  std::cout << "Linked SDL Version: " << SDL_VERSIONNUM_MAJOR(linked) << "."
+            << SDL_VERSIONNUM_MINOR(linked) << "."
+            << SDL_VERSIONNUM_MICRO(linked) << "." << std::endl;
+
+  // Ahead of every thread that renders
+  rt_setup(opts.rt);
+  Synth syn;
+  const u32 seed = (u32)time(NULL);
+  syn.set_seed(seed);
+  syn.set_silence_db(opts.silence_db);
+  // Kept even when the file is missing, the first save creates it
+  Preset_Bank bank(opts.bank_path);
+  syn.set_bank(&bank);
+  if (bank.open()) {
+    syn.load_program(0);
+  }
+
+  Midi_Input midi;
+  for (size_t i = 0; i < opts.devices.size(); i++) {
+    midi.add_device(opts.devices[i].name, opts.devices[i].channel);
+  }
+  u32 midi_wake_event = SDL_RegisterEvents(1);
+  if (midi_wake_event != 0) {
+    midi.set_notify(wake_main_loop, &midi_wake_event);
+  }
+  u64 midi_ns = 0;
+  std::thread midi_opener(open_midi, &midi, &midi_ns);
+  Audio_Sys audio(syn.get_channels(), syn.get_sample_rate(),
+                  opts.device_frames);
+  audio.set_dither(opts.dither);
+
+  Note_Cache note_cache;
+  if (opts.note_cache_ms > 0 &&
+      note_cache.start(static_cast<size_t>(opts.note_cache_ms),
+                       syn.get_sample_rate_max())) {
+    syn.set_fixed_phase(true);
+    syn.set_note_cache(&note_cache);
+  }
+
+  Ensemble ensemble(syn);
+  if (!ensemble.start(static_cast<size_t>(opts.parts), seed, opts.silence_db)) {
+    std::cerr << "Failed to start " << opts.parts << " parts" << std::endl;
+  }
+  if (ensemble.get_part_count() > 1) {
+    audio.set_ensemble(&ensemble);
+    std::cout << ensemble.get_part_count() << " parts on "
+              << ensemble.get_lane_count() << " cores" << std::endl;
+    if (opts.capture) {
+      std::cerr << "Captures only replay a single part, not capturing"
+                << std::endl;
+      opts.capture = nullptr;
+    }
+  }
+
+  // Opened ahead of the device so the first block is in it
+  Session_Capture capture;
+  const u32 capture_flags = syn.get_note_cache() ? CAPTURE_FIXED_PHASE : 0u;
+  if (opts.capture &&
+      capture.open(opts.capture, seed, syn.get_sample_rate(),
+                   syn.get_channels(), opts.silence_db, capture_flags)) {
+    syn.set_capture(&capture);
+  }
+
+  Recorder recorder;
+  audio.set_recorder(&recorder);
+  std::unique_ptr<Render_Ahead> ahead;
+  if (opts.ahead_blocks > 0) {
+    ahead = std::make_unique<Render_Ahead>(
+        static_cast<size_t>(opts.ahead_blocks));
+    audio.set_render_ahead(ahead.get());
+  }
+  if (audio.open(&syn)) {
+    std::cout << "Output latency: " << audio.get_latency_ms() << "ms"
+              << std::endl;
+  }
+  u32 takes = 0;
+  if (opts.record) {
+    recorder.start(opts.record, syn.get_sample_rate(), syn.get_channels());
+  }
+  // Before the UI, so the graphics driver's mappings aren't locked with it
+  rt_lock_memory();
+  const u64 audio_ready = now_ns();
+
+  // A failed UI still shuts the audio side down the normal way
+  Window win(SDL_WINDOW_HIDDEN, 400, 300);
+  Glyphs glyphs("arial.ttf", 18.0f);
+  const bool ui = open_ui(win, glyphs, opts.vsync);
+  const u64 ui_ready = now_ns();
+  midi_opener.join();
+  std::cout << "Startup: audio " << (audio_ready - startup) / 1000000
+            << "ms, ui " << (ui_ready - audio_ready) / 1000000 << "ms, midi "
+            << midi_ns / 1000000 << "ms alongside" << std::endl;
+  if (ui) {
+    win.show_window();
+  } else {
+    win.set_quit(true);
+  }
+
+  // The loop sleeps in the event wait, MIDI wakes it through the ingest
+  // thread. Meters only tick while something is sounding
+  const u64 METER_PERIOD = 1000 / 30;
+  const u64 ANALYZER_PERIOD = 1000 / 60;
+  const i32 IDLE_WAIT_MS = 1000;
+  const i32 SAVE_POLL_MS = 5;
+  const char *TRACE_PATH = "sgsa_trace.json";
+  const char *TAKE_PATH = "sgsa_take_%03u.wav";
+  TRACE_THREAD("main");
+  Renderer &rend = win.get_render_class();
+  Analyzer analyzer;
+  Voice_Monitor voice_monitor;
+  bool metering = false;
+  bool saving = false;
+  u64 next_meter = 0;
+  while (!win.get_quit()) {
+    i32 timeout = IDLE_WAIT_MS;
+    if (metering) {
+      const u64 now = SDL_GetTicks();
+      timeout = next_meter > now ? (i32)(next_meter - now) : 0;
+    }
+    // The snapshot turns up within a block
+    if (saving) {
+      timeout = SDL_min(timeout, SAVE_POLL_MS);
+    }
+
+    std::vector<Event_Command> sdl_cmds =
+        win.get_event_class().read_event(timeout);
+    TRACE_SCOPE("ui_pass");
+    std::vector<Keyboard_Command> midi_cmds;
+    if (!ensemble.read_event(midi, midi_cmds)) {
+      std::cerr << "Part event queue full, dropped input" << std::endl;
+    }
+
+    win._run_events(sdl_cmds);
+    listen_event_emits(win.get_event_class(), midi_cmds);
+
+    if (win.get_arp_mode_next()) {
+      midi_cmds.push_back({Keyboard_Command::arp_next_mode, Midi_Input_Msg()});
+      win.set_arp_mode_next(false);
+    }
+    if (win.get_arp_rate_next()) {
+      midi_cmds.push_back({Keyboard_Command::arp_next_rate, Midi_Input_Msg()});
+      win.set_arp_rate_next(false);
+    }
+    // Played on the audio clock, not at this loop's frame rate
+    if (!syn.queue_events(midi_cmds)) {
+      std::cerr << "Event queue full, dropped input" << std::endl;
+    }
+
+    // Every playback device reports its format changes, only ours matters
+    if (win.get_audio_changed() != 0) {
+      if (win.get_audio_changed() == audio.get_device()) {
+        audio.reconfigure();
+      }
+      win.set_audio_changed(0);
+    }
+
+    // The patch is copied out on the audio thread, the live one is its
+    if (win.get_save_patch()) {
+      syn.request_patch();
+      saving = true;
+      win.set_save_patch(false);
+    }
+    Preset saved;
+    if (saving && syn.take_patch(saved)) {
+      bank.store(syn.get_program(), saved);
+      saving = false;
+    }
+
+    // Drained every pass so the tap never fills, the FFT only runs on a redraw
+    audio.set_tap_enabled(win.get_view() == VIEW_ANALYZER);
+    analyzer.pull(audio.get_tap());
+    // Sampled even while hidden so a dump has history behind it
+    voice_monitor.pull(syn);
+    if (win.get_dump_voices()) {
+      voice_monitor.dump(std::cout);
+      win.set_dump_voices(false);
+    }
+    trace_collect();
+    rt_report();
+    if (win.get_export_trace()) {
+      trace_export(TRACE_PATH);
+      win.set_export_trace(false);
+    }
+    if (win.get_toggle_record()) {
+      if (recorder.is_recording()) {
+        recorder.stop();
+      } else {
+        char take[32];
+        snprintf(take, sizeof(take), TAKE_PATH, ++takes);
+        recorder.start(take, syn.get_sample_rate(), syn.get_channels());
+      }
+      win.set_toggle_record(false);
+    }
+
+    // Patches load on the audio thread, so params are diffed rather than told
+    if (rend.param_list_changed(syn.get_param_list())) {
+      win.mark_dirty(DIRTY_PARAMS);
+    }
+    const u64 meter_period =
+        win.get_view() == VIEW_ANALYZER ? ANALYZER_PERIOD : METER_PERIOD;
+    if (metering && SDL_GetTicks() >= next_meter) {
+      win.mark_dirty(DIRTY_METERS);
+      next_meter = SDL_GetTicks() + meter_period;
+    }
+
+    if (win.get_dirty() != DIRTY_NONE) {
+      TRACE_SCOPE_ARG("ui_frame", win.get_dirty());
+      rend.clear_colour(0, 0, 0, 255);
+      rend.clear();
+      rend.clear_colour(255, 255, 255, 255);
+      const f32 w = (f32)win.get_width(), h = (f32)win.get_height();
+      if (win.get_view() == VIEW_ANALYZER) {
+        analyzer.update(syn.get_sample_rate());
+        rend.render_scope(analyzer, {0.0f, 0.0f, w, h * 0.5f});
+        rend.render_spectrum(analyzer, {0.0f, h * 0.5f, w, h * 0.5f});
+      } else if (win.get_view() == VIEW_VOICES) {
+        // Kept clear of the voice meter along the bottom
+        rend.render_voice_grid(voice_monitor, glyphs, {0.0f, 0.0f, w, h - 8.0f});
+      } else {
+        rend.render_param_list(syn.get_param_list(), glyphs,
+                               win.get_event_class().get_cursor());
+      }
+      rend.render_voice_meter(syn.get_sounding_voices(), VOICES);
+      TRACE_SCOPE("present");
+      rend.present();
+      win.clear_dirty();
+    }
+
+    // Notes just queued haven't reached the voices yet, keep ticking for them.
+    // The analyzer and voice grid always tick while they're up
+    const bool was_metering = metering;
+    metering = win.get_view() != VIEW_PARAMS || !midi_cmds.empty() ||
+               syn.get_sounding_voices() > 0 || rend.get_meter_value() > 0;
+    if (metering && !was_metering) {
+      next_meter = SDL_GetTicks() + meter_period;
+    }
+  }
+
+  audio.close();
+  recorder.stop();
+  if (audio.get_render_ahead()) {
+    std::cout << "Render ahead: " << ahead->get_depth() << " blocks of "
+              << ahead->get_block_frames() << " frames, "
+              << ahead->get_underruns() << " underruns" << std::endl;
+  }
+  ensemble.stop();
+  syn.set_capture(nullptr);
+  capture.close();
+  if (syn.get_note_cache()) {
+    syn.set_note_cache(nullptr);
+    note_cache.stop();
+    std::cout << "Note cache: " << note_cache.get_hits() << " hits, "
+              << note_cache.get_misses() << " misses" << std::endl;
+  }
+  midi.close();
+  midi.print_stats();
+  glyphs.close();
+  quit();
+  return ui ? 0 : 1;
+}